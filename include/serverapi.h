@@ -22,12 +22,17 @@ enum ApiOp
 	API_OP_UNLOCK_FILE,
 	API_OP_CLOSE_FILE,
 	API_OP_REMOVE_FILE,
+	API_OP_PIN_FILE,
+	API_OP_UNPIN_FILE,
 };
 
 enum ResponseType
 {
 	RESPONSE_OK,
 	RESPONSE_ERR,
+	/* Just like `RESPONSE_OK`, but the evicted files it counts were kept by the
+	 * server instead of following. */
+	RESPONSE_OK_SPOOLED,
 };
 
 enum FileFlag
@@ -86,7 +91,7 @@ readNFiles(int N, const char *dirname);
 
 /* Reads the file located at `pathname` and asks the storage server to start
  * tracking it. Any evicted file due to this request is then written to
- * `dirname` if not NULL.
+ * `dirname` if not NULL, unless the server spools evicted files itself.
  *
  * It returns 0 on success and -1 on failure (read `errno` for more information). */
 int
@@ -95,7 +100,8 @@ writeFile(const char *pathname, const char *dirname);
 /* Atomically appends some content to the file located at `pathname` currently
  * tracked by the storage server. `buf` must point to a readable memory region
  * of size `size`, which contains the appended data. Any evicted file due to
- * this request is then written to `dirname` if not NULL.
+ * this request is then written to `dirname` if not NULL, unless the server
+ * spools evicted files itself.
  *
  * It returns 0 on success and -1 on failure (read `errno` for more information). */
 int
@@ -129,4 +135,18 @@ closeFile(const char *pathname);
 int
 removeFile(const char *pathname);
 
+/* Asks the storage server to never evict the file located at `pathname`, no
+ * matter how full it gets. It can still be removed with `removeFile`.
+ *
+ * It returns 0 on success and -1 on failure (read `errno` for more information). */
+int
+pinFile(const char *pathname);
+
+/* Lets the storage server evict the file located at `pathname` again, after
+ * `pinFile`.
+ *
+ * It returns 0 on success and -1 on failure (read `errno` for more information). */
+int
+unpinFile(const char *pathname);
+
 #endif
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+
+#include "global_state.h"
+#include "logc/src/log.h"
+#include "receiver.h"
+#include "serverapi.h"
+#include "slab.h"
+#include "utilities.h"
+#include "workload_queue.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTSTRING "hc:e:"
+
+/* Same as the client library's. */
+#define HEADER_MAGIC_CODE 0x86b2f464f65e01ULL
+#define BENCH_MAX_SETTINGS 64
+/* Connections are opened in batches that fit within the backlog. */
+#define BENCH_BACKLOG 512
+/* File descriptors that aren't connections, with some slack. */
+#define BENCH_SPARE_FDS 64
+
+#define DEFAULT_CONNECTIONS "10,100,1000,10000,100000"
+#define DEFAULT_EVENTS_COUNT 20000
+
+void
+print_help(void)
+{
+	puts("Benchmark for the receiver of the file storage server. One client sends");
+	puts("requests back to back while all other connections stay idle, and each");
+	puts("request is answered as soon as it gets to the workload queue. Options:");
+	puts("");
+	puts("-h");
+	puts("    Prints this message and exits.");
+	puts("-c n1[,n2...]");
+	puts("    Numbers of idle connections. 10,100,1000,10000,100000 by default.");
+	puts("    Those that don't fit within the file descriptor limit are skipped.");
+	puts("-e events");
+	puts("    Requests sent by the busy client for each run. 20000 by default.");
+}
+
+struct BenchArgs
+{
+	unsigned connections[BENCH_MAX_SETTINGS];
+	unsigned connections_count;
+	unsigned events_count;
+	bool help_message;
+};
+
+struct BenchResult
+{
+	/* CPU time of the receiver thread alone, which is what should stay flat. */
+	double receiver_ns_per_event;
+	double round_trip_us;
+};
+
+struct Pinger
+{
+	int fd;
+	unsigned events_count;
+	double seconds;
+	bool done;
+};
+
+/* Parses a comma-separated list of positive numbers into `list`. Returns 0 on
+ * success, -1 otherwise. */
+static int
+parse_number_list(char *s, unsigned list[BENCH_MAX_SETTINGS], unsigned *count)
+{
+	*count = 0;
+	char *saveptr = NULL;
+	for (char *n = strtok_r(s, ",", &saveptr); n; n = strtok_r(NULL, ",", &saveptr)) {
+		char *end = NULL;
+		unsigned long long val = strtoull(n, &end, 10);
+		if (*count == BENCH_MAX_SETTINGS || n[0] == '-' || *end != '\0' || val == 0 ||
+		    val > UINT_MAX) {
+			return -1;
+		}
+		list[(*count)++] = val;
+	}
+	return *count > 0 ? 0 : -1;
+}
+
+/* Fills in `args` from the command line. Returns 0 on success, -1 on bad
+ * options, after logging them. */
+static int
+bench_args_parse(int argc, char **argv, struct BenchArgs *args)
+{
+	memset(args, 0, sizeof(struct BenchArgs));
+	char default_connections[] = DEFAULT_CONNECTIONS;
+	parse_number_list(default_connections, args->connections, &args->connections_count);
+	args->events_count = DEFAULT_EVENTS_COUNT;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, OPTSTRING)) != -1) {
+		unsigned list[BENCH_MAX_SETTINGS];
+		unsigned list_count = 0;
+		switch (c) {
+			case 'h':
+				args->help_message = true;
+				break;
+			case 'c':
+				if (parse_number_list(optarg, args->connections, &args->connections_count) <
+				    0) {
+					log_fatal("Invalid numbers of connections '%s'.", optarg);
+					return -1;
+				}
+				break;
+			case 'e':
+				if (parse_number_list(optarg, list, &list_count) < 0 || list_count != 1) {
+					log_fatal("Invalid number of events '%s'.", optarg);
+					return -1;
+				}
+				args->events_count = list[0];
+				break;
+			default:
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* Stands in for the workers, replying with a single byte to every message. */
+static void *
+responder_entry_point(void *args)
+{
+	UNUSED(args);
+	struct Message *msg = NULL;
+	while ((msg = workload_queue_pull(0))) {
+		uint8_t response[1] = { RESPONSE_OK };
+		write_bytes(msg->fd, response, 1);
+		free(msg->buffer.raw);
+		free(msg);
+	}
+	return NULL;
+}
+
+static void *
+pinger_entry_point(void *args)
+{
+	struct Pinger *pinger = args;
+	/* A `readFile` request, even though nobody will look at it. */
+	uint8_t request[8 + 8 + 2];
+	u64_to_big_endian(HEADER_MAGIC_CODE, request);
+	u64_to_big_endian(2, request + 8);
+	request[16] = API_OP_READ_FILE;
+	request[17] = '/';
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < pinger->events_count; i++) {
+		uint8_t response[1];
+		if (write_bytes(pinger->fd, request, sizeof(request)) < 0 ||
+		    read_bytes(pinger->fd, response, 1) <= 0) {
+			log_error("The busy client lost its connection.");
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pinger->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	/* Closing the connection wakes the receiver up one last time. */
+	__atomic_store_n(&pinger->done, true, __ATOMIC_RELEASE);
+	close(pinger->fd);
+	return NULL;
+}
+
+static int
+connect_to(const struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (const struct sockaddr *)addr, SUN_LEN(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static double
+thread_cpu_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Runs the busy client against a receiver with `idle_count` idle connections.
+ * Returns 0 on success, -1 on system errors. */
+static int
+bench_run(unsigned idle_count, unsigned events_count, struct BenchResult *result)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/sol-benchmark-%d.sk", getpid());
+	unlink(addr.sun_path);
+	int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket_fd < 0 || bind(socket_fd, (struct sockaddr *)&addr, SUN_LEN(&addr)) < 0 ||
+	    listen(socket_fd, BENCH_BACKLOG) < 0) {
+		log_fatal("Couldn't listen on '%s'.", addr.sun_path);
+		return -1;
+	}
+	struct Receiver *receiver = receiver_create(socket_fd, 1);
+
+	int *idle_fds = xmalloc(sizeof(int) * idle_count);
+	unsigned connected = 0;
+	int err = 0;
+	while (connected < idle_count && err == 0) {
+		unsigned batch_end = connected + BENCH_BACKLOG;
+		for (; connected < idle_count && connected < batch_end; connected++) {
+			idle_fds[connected] = connect_to(&addr);
+			if (idle_fds[connected] < 0) {
+				log_fatal("Couldn't open idle connection n.%u.", connected);
+				err = -1;
+				break;
+			}
+		}
+		/* All of them are waiting within the backlog, and get accepted at once. */
+		err |= receiver_poll(receiver);
+	}
+
+	struct Pinger pinger = { .fd = -1, .events_count = events_count, .done = false };
+	if (err == 0) {
+		pinger.fd = connect_to(&addr);
+		err = pinger.fd < 0 ? -1 : receiver_poll(receiver);
+	}
+	if (err == 0) {
+		pthread_t pinger_thread;
+		double cpu_start = thread_cpu_ns();
+		if (pthread_create(&pinger_thread, NULL, pinger_entry_point, &pinger) != 0) {
+			log_fatal("Couldn't spawn the busy client.");
+			close(pinger.fd);
+			err = -1;
+		} else {
+			while (!__atomic_load_n(&pinger.done, __ATOMIC_ACQUIRE) && err == 0) {
+				err = receiver_poll(receiver);
+			}
+			double cpu_end = thread_cpu_ns();
+			pthread_join(pinger_thread, NULL);
+			result->receiver_ns_per_event = (cpu_end - cpu_start) / events_count;
+			result->round_trip_us = pinger.seconds * 1e6 / events_count;
+		}
+	} else if (pinger.fd >= 0) {
+		close(pinger.fd);
+	}
+
+	for (unsigned i = 0; i < connected; i++) {
+		close(idle_fds[i]);
+	}
+	free(idle_fds);
+	receiver_free(receiver);
+	unlink(addr.sun_path);
+	return err;
+}
+
+/* Raises the soft limit on file descriptors as far as possible, and returns
+ * how many connections fit within it. Both ends of each are in this process. */
+static unsigned
+max_connections(void)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		return 0;
+	}
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	getrlimit(RLIMIT_NOFILE, &limit);
+	if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur / 2 > UINT_MAX) {
+		return UINT_MAX;
+	}
+	return limit.rlim_cur < BENCH_SPARE_FDS ? 0 : (limit.rlim_cur - BENCH_SPARE_FDS) / 2;
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Only problems are worth reporting. */
+	log_set_level(LOG_WARN);
+	struct BenchArgs args;
+	if (bench_args_parse(argc, argv, &args) < 0) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+	if (args.help_message) {
+		print_help();
+		return EXIT_SUCCESS;
+	}
+	unsigned max = max_connections();
+	workload_queues_init(1);
+	pthread_t responder;
+	if (pthread_create(&responder, NULL, responder_entry_point, NULL) != 0) {
+		log_fatal("Couldn't spawn the responder thread.");
+		return EXIT_FAILURE;
+	}
+
+	int err = 0;
+	printf("%12s %12s %18s %16s\n",
+	       "connections",
+	       "events",
+	       "receiver-ns/event",
+	       "round-trip-us");
+	for (unsigned i = 0; i < args.connections_count && err == 0; i++) {
+		if (args.connections[i] > max) {
+			printf("%12u %12s (over the file descriptor limit, skipped)\n",
+			       args.connections[i],
+			       "-");
+			continue;
+		}
+		struct BenchResult result;
+		err = bench_run(args.connections[i], args.events_count, &result);
+		if (err == 0) {
+			printf("%12u %12u %18.0f %16.2f\n",
+			       args.connections[i],
+			       args.events_count,
+			       result.receiver_ns_per_event,
+			       result.round_trip_us);
+			fflush(stdout);
+		}
+	}
+
+	shutdown_hard();
+	workload_queues_cond_signal();
+	pthread_join(responder, NULL);
+	workload_queues_free();
+	slab_clear();
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
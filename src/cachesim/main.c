@@ -0,0 +1,510 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "blob.h"
+#include "config.h"
+#include "epoch.h"
+#include "htable.h"
+#include "logc/src/log.h"
+#include "slab.h"
+#include "trace.h"
+#include "utilities.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTSTRING "ht:z:s:n:m:r:o:p:f:b:i:a"
+
+/* Replayed operations all come from this client. */
+#define SIM_FD 1
+#define SIM_MAX_SETTINGS 64
+/* Same as the server's default. It doesn't affect hit ratios anyway. */
+#define SIM_INLINE_THRESHOLD_IN_BYTES 256
+
+#define DEFAULT_OPS_COUNT 1000000
+#define DEFAULT_ZIPF_ALPHA 0.99
+#define DEFAULT_SCAN_PERCENTAGE 10
+#define DEFAULT_MIN_SIZE 1024
+#define DEFAULT_MAX_SIZE 65536
+#define DEFAULT_MAX_FILES "1000"
+#define DEFAULT_MAX_STORAGE "128000000"
+
+void
+print_help(void)
+{
+	puts("Offline cache eviction policy simulator. It replays a trace against the");
+	puts("hash table of the file storage server, once for every combination of");
+	puts("policy and limits. Options:");
+	puts("");
+	puts("-h");
+	puts("    Prints this message and exits.");
+	puts("-t filename");
+	puts("    Replays the trace in `filename` (`-` for STDIN). Each line holds");
+	puts("    an operation (`get`, `set`, or `del`), a key, and a size in bytes.");
+	puts("    Files that `get` doesn't find are written, as clients would do.");
+	puts("-z keys,[alpha=0.99]");
+	puts("    Generates a trace of reads over `keys` Zipf-distributed keys.");
+	puts("-s keys,[percentage=10]");
+	puts("    Generates a trace that scans over `keys` keys, over and over again.");
+	puts("    Along with -z, it's the percentage of reads that belong to the scan.");
+	puts("-n ops");
+	puts("    Length of generated traces. 1000000 by default.");
+	puts("-m min,[max=min]");
+	puts("    Size range of files in generated traces. 1024,65536 by default.");
+	puts("-r seed");
+	puts("    Seed for generated traces. 1 by default.");
+	puts("-o filename");
+	puts("    Writes the trace to `filename` (`-` for STDOUT) and exits.");
+	puts("-p policy1[,policy2...]");
+	puts("    Cache eviction policies to simulate, by their name within");
+	puts("    configuration files. All of them by default.");
+	puts("-f n1[,n2...]");
+	puts("    Values of `max-files` to simulate. 1000 by default.");
+	puts("-b n1[,n2...]");
+	puts("    Values of `max-storage` to simulate. 128000000 by default.");
+	puts("-i chained|swiss");
+	puts("    Hash table backend. `chained` by default.");
+	puts("-a");
+	puts("    Enables the admission filter.");
+}
+
+struct SimArgs
+{
+	const char *trace_path;
+	const char *output_path;
+	struct TraceGenerator generator;
+	enum CacheEvictionPolicy policies[CACHE_EVICTION_POLICIES_COUNT];
+	unsigned policies_count;
+	unsigned max_files[SIM_MAX_SETTINGS];
+	unsigned max_files_count;
+	size_t max_storage[SIM_MAX_SETTINGS];
+	unsigned max_storage_count;
+	enum HTableBackend htable_backend;
+	bool admission_filter;
+	bool help_message;
+};
+
+struct SimResult
+{
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long long hit_bytes;
+	unsigned long long requested_bytes;
+	unsigned long evictions;
+	double seconds;
+};
+
+/* Parses a non-negative decimal number that fits in `max`. Returns 0 on
+ * success, -1 otherwise. */
+static int
+parse_number(const char *s, unsigned long long max, unsigned long long *val)
+{
+	char *end = NULL;
+	if (!s || s[0] == '\0' || s[0] == '-') {
+		return -1;
+	}
+	/* `strtoull` saturates silently, except for `errno`. */
+	errno = 0;
+	*val = strtoull(s, &end, 10);
+	return *end == '\0' && errno != ERANGE && *val <= max ? 0 : -1;
+}
+
+static int
+parse_double(const char *s, double *val)
+{
+	char *end = NULL;
+	if (!s || s[0] == '\0') {
+		return -1;
+	}
+	*val = strtod(s, &end);
+	return *end == '\0' ? 0 : -1;
+}
+
+/* Parses a comma-separated list of positive numbers into `list`. Returns 0 on
+ * success, -1 otherwise. */
+static int
+parse_number_list(char *s, unsigned list[SIM_MAX_SETTINGS], unsigned *count)
+{
+	*count = 0;
+	char *saveptr = NULL;
+	for (char *n = strtok_r(s, ",", &saveptr); n; n = strtok_r(NULL, ",", &saveptr)) {
+		unsigned long long val = 0;
+		if (*count == SIM_MAX_SETTINGS || parse_number(n, UINT_MAX, &val) < 0 || val == 0) {
+			return -1;
+		}
+		list[(*count)++] = val;
+	}
+	return *count > 0 ? 0 : -1;
+}
+
+/* Same as `parse_number_list`, but for sizes in bytes, which can go well past
+ * 4GiB. */
+static int
+parse_size_list(char *s, size_t list[SIM_MAX_SETTINGS], unsigned *count)
+{
+	*count = 0;
+	char *saveptr = NULL;
+	for (char *n = strtok_r(s, ",", &saveptr); n; n = strtok_r(NULL, ",", &saveptr)) {
+		unsigned long long val = 0;
+		if (*count == SIM_MAX_SETTINGS || parse_number(n, SIZE_MAX, &val) < 0 || val == 0) {
+			return -1;
+		}
+		list[(*count)++] = val;
+	}
+	return *count > 0 ? 0 : -1;
+}
+
+static int
+parse_policies(char *s, struct SimArgs *args)
+{
+	args->policies_count = 0;
+	char *saveptr = NULL;
+	for (char *name = strtok_r(s, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		if (args->policies_count == CACHE_EVICTION_POLICIES_COUNT ||
+		    config_parse_cache_eviction_policy(name,
+		                                       &args->policies[args->policies_count]) < 0) {
+			return -1;
+		}
+		args->policies_count++;
+	}
+	return args->policies_count > 0 ? 0 : -1;
+}
+
+/* Parses `a[,b]` into two numbers, leaving `*b` untouched if it's missing. */
+static int
+parse_number_pair(char *s, unsigned long long *a, unsigned long long *b)
+{
+	char *saveptr = NULL;
+	char *first = strtok_r(s, ",", &saveptr);
+	char *second = strtok_r(NULL, ",", &saveptr);
+	if (parse_number(first, ULLONG_MAX, a) < 0 ||
+	    (second && parse_number(second, ULLONG_MAX, b) < 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Fills in `args` from the command line. Returns 0 on success, -1 on bad
+ * options, after logging them. */
+static int
+sim_args_parse(int argc, char **argv, struct SimArgs *args)
+{
+	memset(args, 0, sizeof(struct SimArgs));
+	args->generator.ops_count = DEFAULT_OPS_COUNT;
+	args->generator.zipf_alpha = DEFAULT_ZIPF_ALPHA;
+	args->generator.scan_percentage = DEFAULT_SCAN_PERCENTAGE;
+	args->generator.min_size = DEFAULT_MIN_SIZE;
+	args->generator.max_size = DEFAULT_MAX_SIZE;
+	args->generator.seed = 1;
+	for (int i = 0; i < CACHE_EVICTION_POLICIES_COUNT; i++) {
+		args->policies[i] = i;
+	}
+	args->policies_count = CACHE_EVICTION_POLICIES_COUNT;
+	char default_max_files[] = DEFAULT_MAX_FILES;
+	char default_max_storage[] = DEFAULT_MAX_STORAGE;
+	parse_number_list(default_max_files, args->max_files, &args->max_files_count);
+	parse_size_list(default_max_storage, args->max_storage, &args->max_storage_count);
+	args->htable_backend = HTABLE_BACKEND_CHAINED;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, OPTSTRING)) != -1) {
+		unsigned long long a = 0;
+		unsigned long long b = 0;
+		double alpha = 0.0;
+		int err = 0;
+		switch (c) {
+			case 'h':
+				args->help_message = true;
+				break;
+			case 't':
+				args->trace_path = optarg;
+				break;
+			case 'z': {
+				char *saveptr = NULL;
+				char *alpha_s = NULL;
+				err = parse_number(strtok_r(optarg, ",", &saveptr), SIZE_MAX, &a);
+				alpha_s = strtok_r(NULL, ",", &saveptr);
+				if (err == 0 && alpha_s) {
+					err = parse_double(alpha_s, &alpha);
+					args->generator.zipf_alpha = alpha;
+				}
+				args->generator.zipf_keys_count = a;
+				err = err < 0 || a == 0 || args->generator.zipf_alpha < 0.0 ? -1 : 0;
+				break;
+			}
+			case 's':
+				b = args->generator.scan_percentage;
+				err = parse_number_pair(optarg, &a, &b);
+				args->generator.scan_keys_count = a;
+				args->generator.scan_percentage = b;
+				err = err < 0 || a == 0 || b > 100 ? -1 : 0;
+				break;
+			case 'n':
+				err = parse_number(optarg, SIZE_MAX, &a);
+				args->generator.ops_count = a;
+				break;
+			case 'm':
+				b = ULLONG_MAX;
+				err = parse_number_pair(optarg, &a, &b);
+				if (b == ULLONG_MAX) {
+					b = a;
+				}
+				args->generator.min_size = a;
+				args->generator.max_size = b;
+				err = err < 0 || a > b || b > UINT_MAX ? -1 : 0;
+				break;
+			case 'r':
+				err = parse_number(optarg, UINT64_MAX, &a);
+				args->generator.seed = a;
+				break;
+			case 'o':
+				args->output_path = optarg;
+				break;
+			case 'p':
+				err = parse_policies(optarg, args);
+				break;
+			case 'f':
+				err = parse_number_list(optarg, args->max_files, &args->max_files_count);
+				break;
+			case 'b':
+				err = parse_size_list(optarg, args->max_storage, &args->max_storage_count);
+				break;
+			case 'i':
+				if (strcmp(optarg, "chained") == 0) {
+					args->htable_backend = HTABLE_BACKEND_CHAINED;
+				} else if (strcmp(optarg, "swiss") == 0) {
+					args->htable_backend = HTABLE_BACKEND_SWISS;
+				} else {
+					err = -1;
+				}
+				break;
+			case 'a':
+				args->admission_filter = true;
+				break;
+			default:
+				return -1;
+		}
+		if (err < 0) {
+			log_fatal("Bad argument for option '%c'.", c);
+			return -1;
+		}
+	}
+	if (args->help_message) {
+		return 0;
+	}
+	bool generate =
+	  args->generator.zipf_keys_count > 0 || args->generator.scan_keys_count > 0;
+	if (generate == (args->trace_path != NULL)) {
+		log_fatal("Either a trace file or a synthetic trace must be given.");
+		return -1;
+	}
+	return 0;
+}
+
+/* Writes `size` bytes of `contents` into the file `key`, creating it first if
+ * needed. The file isn't left open, since open files are never evicted. */
+static void
+sim_write(struct HTable *htable,
+          const struct HTableKey *key,
+          const char *contents,
+          size_t size)
+{
+	bool created =
+	  htable_open_or_create_file(htable, key, SIM_FD, true, false) == HTABLE_ERR_OK;
+	struct File *evicted = NULL;
+	unsigned evicted_count = 0;
+	htable_replace_file_contents(htable, key, contents, size, &evicted, &evicted_count);
+	htable_free_evicted(evicted, evicted_count);
+	if (created) {
+		htable_close_file(htable, key, SIM_FD);
+	}
+}
+
+static void
+simulate(const struct Trace *trace,
+         const struct HTableKey *keys,
+         const char *contents,
+         const struct Config *config,
+         struct SimResult *result)
+{
+	memset(result, 0, sizeof(struct SimResult));
+	struct HTable *htable = htable_create(1, config);
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < trace->count; i++) {
+		const struct TraceOp *op = &trace->ops[i];
+		switch (op->kind) {
+			case TRACE_OP_GET: {
+				struct Blob *blob = htable_pin_file(htable, &keys[i]);
+				result->requested_bytes += op->size;
+				if (blob) {
+					result->hits++;
+					result->hit_bytes += op->size;
+					blob_unref(blob);
+				} else {
+					result->misses++;
+					sim_write(htable, &keys[i], contents, op->size);
+				}
+				break;
+			}
+			case TRACE_OP_SET:
+				sim_write(htable, &keys[i], contents, op->size);
+				break;
+			case TRACE_OP_DEL:
+				htable_remove_file(htable, &keys[i], SIM_FD);
+				break;
+			default:
+				assert(false);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	struct HTableStats stats;
+	htable_stats_snapshot(htable, &stats);
+	result->evictions = stats.historical_num_evictions;
+	htable_free(htable);
+}
+
+static void
+print_result(enum CacheEvictionPolicy policy,
+             const struct Config *config,
+             const struct SimResult *result,
+             size_t ops_count)
+{
+	unsigned long reads = result->hits + result->misses;
+	printf("%-16s %12u %14zu %9.2f%% %13.2f%% %12lu %12.0f\n",
+	       config_cache_eviction_policy_name(policy),
+	       config->max_files,
+	       config->max_storage_in_bytes,
+	       reads > 0 ? 100.0 * result->hits / reads : 0.0,
+	       result->requested_bytes > 0
+	         ? 100.0 * result->hit_bytes / result->requested_bytes
+	         : 0.0,
+	       result->evictions,
+	       result->seconds > 0 ? ops_count / result->seconds : 0.0);
+	fflush(stdout);
+}
+
+static struct Trace *
+load_trace(const struct SimArgs *args)
+{
+	if (!args->trace_path) {
+		return trace_generate(&args->generator);
+	}
+	if (strcmp(args->trace_path, "-") == 0) {
+		return trace_read(stdin);
+	}
+	FILE *f = fopen(args->trace_path, "r");
+	if (!f) {
+		log_fatal("Couldn't open the trace file '%s'.", args->trace_path);
+		return NULL;
+	}
+	struct Trace *trace = trace_read(f);
+	fclose(f);
+	return trace;
+}
+
+static int
+save_trace(const struct Trace *trace, const char *path)
+{
+	if (strcmp(path, "-") == 0) {
+		return trace_write(trace, stdout);
+	}
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		log_fatal("Couldn't open the output file '%s'.", path);
+		return -1;
+	}
+	int err = trace_write(trace, f);
+	if (fclose(f) != 0) {
+		err = -1;
+	}
+	return err;
+}
+
+static void
+run_simulations(const struct SimArgs *args, const struct Trace *trace)
+{
+	/* Keys are hashed once and for all, and contents are all the same. */
+	struct HTableKey *keys = xmalloc(sizeof(struct HTableKey) * (trace->count + 1));
+	size_t max_size = 1;
+	for (size_t i = 0; i < trace->count; i++) {
+		keys[i] = htable_key(trace->ops[i].key, strlen(trace->ops[i].key));
+		if (trace->ops[i].size > max_size) {
+			max_size = trace->ops[i].size;
+		}
+	}
+	char *contents = xmalloc(max_size);
+	memset(contents, 'x', max_size);
+
+	struct Config config;
+	memset(&config, 0, sizeof(struct Config));
+	config.htable_backend = args->htable_backend;
+	config.inline_threshold_in_bytes = SIM_INLINE_THRESHOLD_IN_BYTES;
+	config.admission_filter = args->admission_filter;
+	printf("%-16s %12s %14s %10s %14s %12s %12s\n",
+	       "policy",
+	       "max-files",
+	       "max-storage",
+	       "hit-ratio",
+	       "byte-hit-ratio",
+	       "evictions",
+	       "ops/s");
+	for (unsigned p = 0; p < args->policies_count; p++) {
+		for (unsigned f = 0; f < args->max_files_count; f++) {
+			for (unsigned b = 0; b < args->max_storage_count; b++) {
+				config.cache_eviction_policy = args->policies[p];
+				config.max_files = args->max_files[f];
+				config.max_storage_in_bytes = args->max_storage[b];
+				struct SimResult result;
+				simulate(trace, keys, contents, &config, &result);
+				print_result(args->policies[p], &config, &result, trace->count);
+			}
+		}
+	}
+	free(contents);
+	free(keys);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* Only problems are worth reporting. */
+	log_set_level(LOG_WARN);
+	struct SimArgs args;
+	if (sim_args_parse(argc, argv, &args) < 0) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+	if (args.help_message) {
+		print_help();
+		return EXIT_SUCCESS;
+	}
+	struct Trace *trace = load_trace(&args);
+	if (!trace) {
+		return EXIT_FAILURE;
+	}
+	int err = 0;
+	if (args.output_path) {
+		err = save_trace(trace, args.output_path);
+		if (err < 0) {
+			log_fatal("Couldn't write the trace.");
+		}
+	} else {
+		epoch_reclaimer_spawn();
+		run_simulations(&args, trace);
+		epoch_reclaimer_join();
+		blob_pool_clear();
+		slab_clear();
+	}
+	trace_free(trace);
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
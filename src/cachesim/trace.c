@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "logc/src/log.h"
+#include "utilities.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_INITIAL_CAPACITY 1024
+#define TRACE_KEY_MAX_LEN 64
+
+static struct Trace *
+trace_create(void)
+{
+	struct Trace *trace = xmalloc(sizeof(struct Trace));
+	trace->capacity = TRACE_INITIAL_CAPACITY;
+	trace->count = 0;
+	trace->ops = xmalloc(sizeof(struct TraceOp) * trace->capacity);
+	return trace;
+}
+
+/* Appends an operation to `trace`, with a copy of `key`. */
+static void
+trace_push(struct Trace *trace, enum TraceOpKind kind, const char *key, size_t size)
+{
+	size_t key_len = strlen(key);
+	char *key_copy = xmalloc(key_len + 1);
+	memcpy(key_copy, key, key_len + 1);
+	if (trace->count == trace->capacity) {
+		trace->capacity *= 2;
+		trace->ops = xrealloc(trace->ops, sizeof(struct TraceOp) * trace->capacity);
+	}
+	trace->ops[trace->count].kind = kind;
+	trace->ops[trace->count].key = key_copy;
+	trace->ops[trace->count].size = size;
+	trace->count++;
+}
+
+void
+trace_free(struct Trace *trace)
+{
+	if (!trace) {
+		return;
+	}
+	for (size_t i = 0; i < trace->count; i++) {
+		free(trace->ops[i].key);
+	}
+	free(trace->ops);
+	free(trace);
+}
+
+/************ TRACE FILES ***********/
+
+static const char *const trace_op_names[] = {
+	[TRACE_OP_GET] = "get",
+	[TRACE_OP_SET] = "set",
+	[TRACE_OP_DEL] = "del",
+};
+
+static int
+trace_parse_op_kind(const char *name, enum TraceOpKind *kind)
+{
+	for (unsigned i = 0; i < sizeof(trace_op_names) / sizeof(trace_op_names[0]); i++) {
+		if (strcmp(name, trace_op_names[i]) == 0) {
+			*kind = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Parses a single line of a trace file into `trace`. Returns 0 on success
+ * (including lines with no operation), -1 if the line is malformed. */
+static int
+trace_parse_line(struct Trace *trace, char *line)
+{
+	const char *delims = " \t\r\n";
+	char *saveptr = NULL;
+	char *op = strtok_r(line, delims, &saveptr);
+	if (!op || op[0] == '#') {
+		return 0;
+	}
+	char *key = strtok_r(NULL, delims, &saveptr);
+	char *size_s = strtok_r(NULL, delims, &saveptr);
+	enum TraceOpKind kind = TRACE_OP_GET;
+	if (!key || trace_parse_op_kind(op, &kind) < 0 || (!size_s && kind != TRACE_OP_DEL) ||
+	    strtok_r(NULL, delims, &saveptr)) {
+		return -1;
+	}
+	size_t size = 0;
+	if (size_s) {
+		char *end = NULL;
+		unsigned long long val = strtoull(size_s, &end, 10);
+		if (*end != '\0' || size_s[0] == '-') {
+			return -1;
+		}
+		size = val;
+	}
+	trace_push(trace, kind, key, size);
+	return 0;
+}
+
+struct Trace *
+trace_read(FILE *f)
+{
+	struct Trace *trace = trace_create();
+	char *line = NULL;
+	size_t line_capacity = 0;
+	size_t line_i = 0;
+	while (getline(&line, &line_capacity, f) >= 0) {
+		line_i++;
+		if (trace_parse_line(trace, line) < 0) {
+			log_error("Malformed trace at line %zu.", line_i);
+			free(line);
+			trace_free(trace);
+			return NULL;
+		}
+	}
+	free(line);
+	if (ferror(f)) {
+		log_error("Couldn't read the trace.");
+		trace_free(trace);
+		return NULL;
+	}
+	return trace;
+}
+
+int
+trace_write(const struct Trace *trace, FILE *f)
+{
+	for (size_t i = 0; i < trace->count; i++) {
+		const struct TraceOp *op = &trace->ops[i];
+		if (fprintf(f, "%s %s %zu\n", trace_op_names[op->kind], op->key, op->size) < 0) {
+			return -1;
+		}
+	}
+	return fflush(f) == 0 ? 0 : -1;
+}
+
+/************ SYNTHETIC TRACES ***********/
+
+/* SplitMix64. Synthetic traces only depend on the seed. */
+static uint64_t
+trace_rand(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+/* Returns a random number within [0, 1). */
+static double
+trace_rand_unit(uint64_t *state)
+{
+	return (trace_rand(state) >> 11) * (1.0 / (UINT64_C(1) << 53));
+}
+
+/* Returns the size of the key with the given index within its set. It's the
+ * same every time. */
+static size_t
+trace_key_size(const struct TraceGenerator *generator, uint64_t key_i, bool scan)
+{
+	uint64_t state = generator->seed ^ (key_i * 2 + scan);
+	return generator->min_size +
+	       trace_rand(&state) % (generator->max_size - generator->min_size + 1);
+}
+
+/* Returns the cumulative distribution of the Zipf-distributed keys, where the
+ * `i`-th most popular key is read with probability proportional to
+ * `1 / (i + 1)^alpha`. */
+static double *
+trace_zipf_cdf(size_t keys_count, double alpha)
+{
+	double *cdf = xmalloc(sizeof(double) * keys_count);
+	double sum = 0.0;
+	for (size_t i = 0; i < keys_count; i++) {
+		sum += 1.0 / pow((double)(i + 1), alpha);
+		cdf[i] = sum;
+	}
+	for (size_t i = 0; i < keys_count; i++) {
+		cdf[i] /= sum;
+	}
+	return cdf;
+}
+
+/* Returns the index of the first entry of `cdf` that's not less than `x`. */
+static size_t
+trace_zipf_search(const double *cdf, size_t keys_count, double x)
+{
+	size_t low = 0;
+	size_t high = keys_count - 1;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (cdf[mid] < x) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+struct Trace *
+trace_generate(const struct TraceGenerator *generator)
+{
+	assert(generator->zipf_keys_count > 0 || generator->scan_keys_count > 0);
+	assert(generator->min_size <= generator->max_size);
+	struct Trace *trace = trace_create();
+	double *cdf = NULL;
+	if (generator->zipf_keys_count > 0) {
+		cdf = trace_zipf_cdf(generator->zipf_keys_count, generator->zipf_alpha);
+	}
+	/* Scans don't make sense without keys to scan, and vice versa. */
+	unsigned scan_percentage = generator->scan_keys_count == 0 ? 0
+	                           : generator->zipf_keys_count == 0
+	                             ? 100
+	                             : generator->scan_percentage;
+	uint64_t state = generator->seed;
+	uint64_t scan_i = 0;
+	for (size_t i = 0; i < generator->ops_count; i++) {
+		char key[TRACE_KEY_MAX_LEN];
+		size_t size = 0;
+		if (trace_rand(&state) % 100 < scan_percentage) {
+			snprintf(key, sizeof(key), "/scan/%" PRIu64, scan_i);
+			size = trace_key_size(generator, scan_i, true);
+			scan_i = (scan_i + 1) % generator->scan_keys_count;
+		} else {
+			size_t key_i =
+			  trace_zipf_search(cdf, generator->zipf_keys_count, trace_rand_unit(&state));
+			snprintf(key, sizeof(key), "/zipf/%zu", key_i);
+			size = trace_key_size(generator, key_i, false);
+		}
+		trace_push(trace, TRACE_OP_GET, key, size);
+	}
+	free(cdf);
+	return trace;
+}
@@ -0,0 +1,73 @@
+#ifndef SOL_CACHESIM_TRACE
+#define SOL_CACHESIM_TRACE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum TraceOpKind
+{
+	/* Reads the file, which is written if it's missing. */
+	TRACE_OP_GET,
+	/* Writes the file, whether or not it's there already. */
+	TRACE_OP_SET,
+	/* Removes the file. */
+	TRACE_OP_DEL,
+};
+
+struct TraceOp
+{
+	enum TraceOpKind kind;
+	/* NUL-terminated, and owned by the trace. */
+	char *key;
+	/* Size of the file contents. Ignored by `TRACE_OP_DEL`. */
+	size_t size;
+};
+
+/* A sequence of operations to replay against the hash table. */
+struct Trace
+{
+	struct TraceOp *ops;
+	size_t count;
+	size_t capacity;
+};
+
+/* Settings for synthetic traces. Reads of Zipf-distributed keys are mixed with
+ * reads of a separate set of keys, in order and over and over again, as done by
+ * scans. Every key always has the same size, picked uniformly at random. */
+struct TraceGenerator
+{
+	size_t ops_count;
+	/* No Zipf-distributed reads if zero. */
+	size_t zipf_keys_count;
+	double zipf_alpha;
+	/* No scans if zero. */
+	size_t scan_keys_count;
+	/* Percentage of operations that belong to the scan. */
+	unsigned scan_percentage;
+	size_t min_size;
+	size_t max_size;
+	uint64_t seed;
+};
+
+/* Reads a trace from `f`. Each line holds one operation, as `get`, `set`, or
+ * `del` followed by the key and then the size in bytes (optional for `del`),
+ * all separated by whitespace. Empty lines and lines starting with `#` are
+ * skipped. Returns NULL on malformed traces, after logging the offending
+ * line. */
+struct Trace *
+trace_read(FILE *f);
+
+/* Returns a new synthetic trace as described by `generator`. */
+struct Trace *
+trace_generate(const struct TraceGenerator *generator);
+
+/* Writes `trace` to `f`, in the format read by `trace_read`. Returns 0 on
+ * success, -1 on I/O errors. */
+int
+trace_write(const struct Trace *trace, FILE *f);
+
+void
+trace_free(struct Trace *trace);
+
+#endif
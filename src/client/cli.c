@@ -9,7 +9,7 @@
 #include <string.h>
 #include <unistd.h>
 
-#define OPTSTRING "hf:w:n:W:D:r:Rd:t:l:u:c:p:Z:z:"
+#define OPTSTRING "hf:w:n:W:D:r:Rd:t:l:u:P:U:c:p:Z:z:"
 
 void
 cli_args_add_action(struct CliArgs *cli_args, struct Action action)
@@ -173,6 +173,40 @@ cli_args_add_action_unlock(struct CliArgs *cli_args, char *arg)
 	cli_args_add_action(cli_args, action);
 }
 
+void
+cli_args_add_action_pin(struct CliArgs *cli_args, char *arg)
+{
+	assert(cli_args);
+	if (!arg) {
+		cli_args->err = CLIENT_ERR_MISSING_ARG;
+		return;
+	}
+	struct Action action;
+	action.type = 'P';
+	action.arg_s1 = arg;
+	action.arg_s2 = NULL;
+	action.arg_i = 0;
+	action.next = NULL;
+	cli_args_add_action(cli_args, action);
+}
+
+void
+cli_args_add_action_unpin(struct CliArgs *cli_args, char *arg)
+{
+	assert(cli_args);
+	if (!arg) {
+		cli_args->err = CLIENT_ERR_MISSING_ARG;
+		return;
+	}
+	struct Action action;
+	action.type = 'U';
+	action.arg_s1 = arg;
+	action.arg_s2 = NULL;
+	action.arg_i = 0;
+	action.next = NULL;
+	cli_args_add_action(cli_args, action);
+}
+
 void
 cli_args_add_action_remove(struct CliArgs *cli_args, char *arg)
 {
@@ -310,6 +344,12 @@ cli_args_parse(int argc, char **argv)
 			case 'u':
 				cli_args_add_action_unlock(cli_args, optarg);
 				break;
+			case 'P':
+				cli_args_add_action_pin(cli_args, optarg);
+				break;
+			case 'U':
+				cli_args_add_action_unpin(cli_args, optarg);
+				break;
 			case 'c':
 				cli_args_add_action_remove(cli_args, optarg);
 				break;
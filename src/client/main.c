@@ -42,6 +42,10 @@ print_help(void)
 	puts("    Locks some files.");
 	puts("-u file1[,file2]");
 	puts("    Unlocks some files.");
+	puts("-P file1[,file2]");
+	puts("    Pins some files, so that the server never evicts them.");
+	puts("-U file1[,file2]");
+	puts("    Unpins some files.");
 	puts("-c file1[,file2]");
 	puts("    Removes some files from the server.");
 	puts("-p");
@@ -272,6 +272,10 @@ run_action(struct Action *action)
 			return run_some_action_over_list_of_files(action, lockFile, "lockFile");
 		case 'u':
 			return run_some_action_over_list_of_files(action, unlockFile, "unlockFile");
+		case 'P':
+			return run_some_action_over_list_of_files(action, pinFile, "pinFile");
+		case 'U':
+			return run_some_action_over_list_of_files(action, unpinFile, "unpinFile");
 		case 'c':
 			return run_some_action_over_list_of_files(action, removeFile, "removeFile");
 		case 't':
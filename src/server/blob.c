@@ -0,0 +1,737 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "blob.h"
+#include "epoch.h"
+#include "global_state.h"
+#include "lz4/lib/lz4.h"
+#include "server_utilities.h"
+#include "slab.h"
+#include "utilities.h"
+#include "xxHash/xxhash.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+/* How many free chunks we keep around for reuse at most. */
+#define BLOB_POOL_MAX_CHUNKS 1024
+
+/* How many chunks we hand over to the kernel with a single `writev`. */
+#define BLOB_WRITE_BATCH 64
+
+/* Interned blobs are indexed by digest within a few independently locked
+ * shards, each one a chained hash table. */
+#define BLOB_INTERN_SHARDS 64
+#define BLOB_INTERN_MIN_BUCKETS 64
+
+/* Compressing smaller blobs isn't worth the CPU time. */
+#define BLOB_COMPRESSION_MIN_SIZE 512
+
+/* Before compressing a whole blob, we first try with this many bytes at its
+ * start and give up unless they shrink by at least 1/8. */
+#define BLOB_COMPRESSION_PROBE_SIZE BLOB_CHUNK_SIZE
+
+#define ON_MUTEX_ERR(err) ON_ERR((err), "Unexpected mutex error within the blob store.")
+
+struct BlobInternShard
+{
+	pthread_mutex_t guard;
+	/* A power of two. */
+	size_t buckets_count;
+	size_t count;
+	struct Blob **buckets;
+};
+
+static pthread_mutex_t pool_guard = PTHREAD_MUTEX_INITIALIZER;
+static struct BlobChunk *pool = NULL;
+static unsigned pool_count = 0;
+
+static size_t inline_threshold = 0;
+
+static struct BlobCompressionStats compression_stats;
+
+static struct BlobInternShard intern_shards[BLOB_INTERN_SHARDS];
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+void
+blob_set_inline_threshold(size_t length_in_bytes)
+{
+	inline_threshold = length_in_bytes;
+}
+
+static struct BlobChunk *
+chunk_alloc(void)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&pool_guard));
+	struct BlobChunk *chunk = pool;
+	if (chunk) {
+		pool = chunk->next;
+		pool_count--;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&pool_guard));
+	if (!chunk) {
+		chunk = xmalloc(sizeof(struct BlobChunk));
+	}
+	chunk->next = NULL;
+	return chunk;
+}
+
+/* Gives `chunk` and all those after it back to the pool. */
+static void
+chunk_free_list(struct BlobChunk *chunk)
+{
+	while (chunk) {
+		struct BlobChunk *next = chunk->next;
+		ON_MUTEX_ERR(pthread_mutex_lock(&pool_guard));
+		bool keep = pool_count < BLOB_POOL_MAX_CHUNKS;
+		if (keep) {
+			chunk->next = pool;
+			pool = chunk;
+			pool_count++;
+		}
+		ON_MUTEX_ERR(pthread_mutex_unlock(&pool_guard));
+		if (!keep) {
+			free(chunk);
+		}
+		chunk = next;
+	}
+}
+
+void
+blob_pool_clear(void)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&pool_guard));
+	while (pool) {
+		struct BlobChunk *next = pool->next;
+		free(pool);
+		pool = next;
+	}
+	pool_count = 0;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&pool_guard));
+
+	for (unsigned i = 0; i < BLOB_INTERN_SHARDS; i++) {
+		struct BlobInternShard *shard = &intern_shards[i];
+		free(shard->buckets);
+		shard->buckets = NULL;
+		shard->buckets_count = 0;
+		shard->count = 0;
+	}
+}
+
+static struct BlobRope *
+rope_create(void)
+{
+	struct BlobRope *rope = xmalloc(sizeof(struct BlobRope));
+	rope->refcount = 1;
+	rope->length_in_bytes = 0;
+	rope->head = NULL;
+	rope->tail = NULL;
+	return rope;
+}
+
+static void
+rope_unref(struct BlobRope *rope)
+{
+	if (__atomic_sub_fetch(&rope->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		chunk_free_list(rope->head);
+		free(rope);
+	}
+}
+
+/* Copies `data` at the end of `rope`, which must be exactly `offset` bytes
+ * long, and only writable by the caller. */
+static void
+rope_write(struct BlobRope *rope, size_t offset, const void *data, size_t length_in_bytes)
+{
+	const char *src = data;
+	/* The tail chunk might have some room left. */
+	size_t used = offset % BLOB_CHUNK_SIZE;
+	if (offset > 0 && used == 0) {
+		used = BLOB_CHUNK_SIZE;
+	}
+	while (length_in_bytes > 0) {
+		if (!rope->tail || used == BLOB_CHUNK_SIZE) {
+			struct BlobChunk *chunk = chunk_alloc();
+			/* Readers of older blobs might be looking at the links, but never at
+			 * what they point to. */
+			if (rope->tail) {
+				EPOCH_STORE(rope->tail->next, chunk);
+			} else {
+				EPOCH_STORE(rope->head, chunk);
+			}
+			rope->tail = chunk;
+			used = 0;
+		}
+		size_t n = BLOB_CHUNK_SIZE - used;
+		if (n > length_in_bytes) {
+			n = length_in_bytes;
+		}
+		memcpy(rope->tail->data + used, src, n);
+		used += n;
+		src += n;
+		length_in_bytes -= n;
+	}
+}
+
+/* Copies the first `length_in_bytes` bytes of `rope` to the end of `dest`. */
+static void
+rope_copy(struct BlobRope *dest, const struct BlobRope *rope, size_t length_in_bytes)
+{
+	size_t offset = dest->length_in_bytes;
+	for (const struct BlobChunk *chunk = EPOCH_LOAD(rope->head); length_in_bytes > 0;
+	     chunk = EPOCH_LOAD(chunk->next)) {
+		size_t n = length_in_bytes < BLOB_CHUNK_SIZE ? length_in_bytes : BLOB_CHUNK_SIZE;
+		rope_write(dest, offset, chunk->data, n);
+		offset += n;
+		length_in_bytes -= n;
+	}
+	dest->length_in_bytes = offset;
+}
+
+static struct Blob *
+blob_alloc(struct BlobRope *rope, size_t length_in_bytes)
+{
+	struct Blob *blob = slab_alloc(sizeof(struct Blob));
+	blob->refcount = 1;
+	blob->holders = 0;
+	blob->length_in_bytes = length_in_bytes;
+	blob->is_interned = false;
+	blob->compressed_length_in_bytes = 0;
+	blob->rope = rope;
+	return blob;
+}
+
+static struct Blob *
+blob_alloc_inline(size_t length_in_bytes)
+{
+	struct Blob *blob = slab_alloc(sizeof(struct Blob) + length_in_bytes);
+	blob->refcount = 1;
+	blob->holders = 0;
+	blob->length_in_bytes = length_in_bytes;
+	blob->is_interned = false;
+	blob->compressed_length_in_bytes = 0;
+	blob->rope = NULL;
+	return blob;
+}
+
+static void
+intern_init(void)
+{
+	for (unsigned i = 0; i < BLOB_INTERN_SHARDS; i++) {
+		ON_MUTEX_ERR(pthread_mutex_init(&intern_shards[i].guard, NULL));
+		intern_shards[i].buckets_count = 0;
+		intern_shards[i].count = 0;
+		intern_shards[i].buckets = NULL;
+	}
+}
+
+static struct BlobInternShard *
+intern_shard(const uint64_t digest[2])
+{
+	ON_ERR(pthread_once(&intern_once, intern_init),
+	       "Unexpected error during blob store initialization.");
+	return &intern_shards[digest[1] % BLOB_INTERN_SHARDS];
+}
+
+/* Returns a new reference to some live interned blob with the given digest and
+ * length, or NULL. The shard lock must be held. */
+static struct Blob *
+intern_find_locked(struct BlobInternShard *shard, const uint64_t digest[2], size_t length)
+{
+	if (shard->buckets_count == 0) {
+		return NULL;
+	}
+	struct Blob *blob = shard->buckets[digest[0] & (shard->buckets_count - 1)];
+	for (; blob; blob = blob->intern_next) {
+		/* Blobs stay here for a while after their last reference is gone. */
+		if (blob->digest[0] == digest[0] && blob->digest[1] == digest[1] &&
+		    blob->length_in_bytes == length && blob_try_ref(blob)) {
+			return blob;
+		}
+	}
+	return NULL;
+}
+
+static void
+intern_insert_locked(struct BlobInternShard *shard, struct Blob *blob)
+{
+	if (shard->count >= shard->buckets_count) {
+		size_t count = shard->buckets_count ? shard->buckets_count * 2 : BLOB_INTERN_MIN_BUCKETS;
+		struct Blob **buckets = xmalloc(sizeof(struct Blob *) * count);
+		memset(buckets, 0, sizeof(struct Blob *) * count);
+		for (size_t i = 0; i < shard->buckets_count; i++) {
+			struct Blob *current = shard->buckets[i];
+			while (current) {
+				struct Blob *next = current->intern_next;
+				struct Blob **bucket = &buckets[current->digest[0] & (count - 1)];
+				current->intern_next = *bucket;
+				*bucket = current;
+				current = next;
+			}
+		}
+		free(shard->buckets);
+		shard->buckets = buckets;
+		shard->buckets_count = count;
+	}
+	struct Blob **bucket = &shard->buckets[blob->digest[0] & (shard->buckets_count - 1)];
+	blob->intern_next = *bucket;
+	*bucket = blob;
+	blob->is_interned = true;
+	shard->count++;
+}
+
+static void
+intern_remove(struct Blob *blob)
+{
+	struct BlobInternShard *shard = intern_shard(blob->digest);
+	ON_MUTEX_ERR(pthread_mutex_lock(&shard->guard));
+	struct Blob **ptr = &shard->buckets[blob->digest[0] & (shard->buckets_count - 1)];
+	while (*ptr != blob) {
+		ptr = &(*ptr)->intern_next;
+	}
+	*ptr = blob->intern_next;
+	shard->count--;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&shard->guard));
+}
+
+static uint64_t
+thread_cpu_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns a buffer with the contents of a compressed blob, to be freed by the
+ * caller. */
+static char *
+blob_decompress(const struct Blob *blob)
+{
+	char *buffer = xmalloc(blob->length_in_bytes);
+	uint64_t start = thread_cpu_time_ns();
+	int length = LZ4_decompress_safe(blob->data,
+	                                 buffer,
+	                                 (int)blob->compressed_length_in_bytes,
+	                                 (int)blob->length_in_bytes);
+	__atomic_fetch_add(&compression_stats.decompression_ns,
+	                   thread_cpu_time_ns() - start,
+	                   __ATOMIC_RELAXED);
+	ON_ERR(length != (int)blob->length_in_bytes, "Corrupted compressed file contents.");
+	return buffer;
+}
+
+/* Digests might collide, so we must make sure. */
+static bool
+blob_has_contents(const struct Blob *blob, const void *data, size_t length_in_bytes)
+{
+	if (blob->length_in_bytes != length_in_bytes) {
+		return false;
+	} else if (blob->compressed_length_in_bytes > 0) {
+		char *buffer = blob_decompress(blob);
+		bool equal = memcmp(buffer, data, length_in_bytes) == 0;
+		free(buffer);
+		return equal;
+	} else if (!blob->rope) {
+		return memcmp(blob->data, data, length_in_bytes) == 0;
+	}
+	const char *ptr = data;
+	const struct BlobChunk *chunk = EPOCH_LOAD(blob->rope->head);
+	while (length_in_bytes > 0) {
+		size_t n = length_in_bytes < BLOB_CHUNK_SIZE ? length_in_bytes : BLOB_CHUNK_SIZE;
+		if (memcmp(chunk->data, ptr, n) != 0) {
+			return false;
+		}
+		ptr += n;
+		length_in_bytes -= n;
+		chunk = EPOCH_LOAD(chunk->next);
+	}
+	return true;
+}
+
+static void
+blob_free(void *ptr)
+{
+	struct Blob *blob = ptr;
+	if (blob->is_interned) {
+		intern_remove(blob);
+	}
+	if (blob->rope) {
+		rope_unref(blob->rope);
+		slab_free(blob, sizeof(struct Blob));
+	} else {
+		slab_free(blob, sizeof(struct Blob) + blob_storage_size(blob));
+	}
+}
+
+struct Blob *
+blob_create(const void *data, size_t length_in_bytes)
+{
+	if (length_in_bytes <= inline_threshold) {
+		struct Blob *blob = blob_alloc_inline(length_in_bytes);
+		if (length_in_bytes > 0) {
+			memcpy(blob->data, data, length_in_bytes);
+		}
+		return blob;
+	}
+	struct BlobRope *rope = rope_create();
+	rope_write(rope, 0, data, length_in_bytes);
+	rope->length_in_bytes = length_in_bytes;
+	return blob_alloc(rope, length_in_bytes);
+}
+
+/* Most formats that are already compressed can be told apart by their first
+ * few bytes. */
+static bool
+looks_compressed(const unsigned char *data, size_t length_in_bytes)
+{
+	static const struct
+	{
+		size_t offset;
+		size_t length;
+		const char *magic;
+	} signatures[] = {
+		{ 0, 3, "\xFF\xD8\xFF" },             /* JPEG */
+		{ 0, 8, "\x89PNG\r\n\x1A\n" },        /* PNG */
+		{ 0, 4, "GIF8" },                     /* GIF */
+		{ 0, 4, "PK\x03\x04" },               /* ZIP, and all that's based on it */
+		{ 0, 2, "\x1F\x8B" },                 /* gzip */
+		{ 0, 4, "\x28\xB5\x2F\xFD" },         /* Zstandard */
+		{ 0, 6, "\xFD" "7zXZ\x00" },           /* xz */
+		{ 0, 3, "BZh" },                      /* bzip2 */
+		{ 0, 6, "7z\xBC\xAF\x27\x1C" },       /* 7-Zip */
+		{ 0, 4, "\x04\x22\x4D\x18" },         /* LZ4 */
+		{ 4, 4, "ftyp" },                     /* MP4, MOV, HEIF */
+		{ 8, 4, "WEBP" },                     /* WebP */
+	};
+	for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++) {
+		if (length_in_bytes >= signatures[i].offset + signatures[i].length &&
+		    memcmp(data + signatures[i].offset, signatures[i].magic, signatures[i].length) ==
+		      0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Compresses `data` into `dest`, failing if it doesn't fit within `capacity`
+ * bytes. Returns the compressed size, or 0. */
+static size_t
+compress(const void *data, size_t length_in_bytes, char *dest, size_t capacity)
+{
+	uint64_t start = thread_cpu_time_ns();
+	int length = LZ4_compress_default(data, dest, (int)length_in_bytes, (int)capacity);
+	__atomic_fetch_add(
+	  &compression_stats.compression_ns, thread_cpu_time_ns() - start, __ATOMIC_RELAXED);
+	return length > 0 ? (size_t)length : 0;
+}
+
+struct Blob *
+blob_create_compressed(const void *data, size_t length_in_bytes)
+{
+	if (length_in_bytes < BLOB_COMPRESSION_MIN_SIZE) {
+		return blob_create(data, length_in_bytes);
+	} else if (length_in_bytes > LZ4_MAX_INPUT_SIZE || looks_compressed(data, length_in_bytes)) {
+		__atomic_fetch_add(&compression_stats.skipped_count, 1, __ATOMIC_RELAXED);
+		return blob_create(data, length_in_bytes);
+	}
+
+	/* Compressed contents must save at least 1/8 of the space, so they never
+	 * need more room than that; if they do, LZ4 simply gives up. */
+	if (length_in_bytes > BLOB_COMPRESSION_PROBE_SIZE) {
+		char probe[BLOB_COMPRESSION_PROBE_SIZE];
+		size_t capacity = BLOB_COMPRESSION_PROBE_SIZE - BLOB_COMPRESSION_PROBE_SIZE / 8;
+		if (compress(data, BLOB_COMPRESSION_PROBE_SIZE, probe, capacity) == 0) {
+			__atomic_fetch_add(&compression_stats.skipped_count, 1, __ATOMIC_RELAXED);
+			return blob_create(data, length_in_bytes);
+		}
+	}
+	size_t capacity = length_in_bytes - length_in_bytes / 8;
+	char *buffer = xmalloc(capacity);
+	size_t compressed_length = compress(data, length_in_bytes, buffer, capacity);
+	if (compressed_length == 0) {
+		free(buffer);
+		__atomic_fetch_add(&compression_stats.skipped_count, 1, __ATOMIC_RELAXED);
+		return blob_create(data, length_in_bytes);
+	}
+
+	struct Blob *blob = blob_alloc_inline(compressed_length);
+	memcpy(blob->data, buffer, compressed_length);
+	blob->length_in_bytes = length_in_bytes;
+	blob->compressed_length_in_bytes = compressed_length;
+	free(buffer);
+	__atomic_fetch_add(&compression_stats.raw_bytes, length_in_bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&compression_stats.compressed_bytes, compressed_length, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&compression_stats.compressed_count, 1, __ATOMIC_RELAXED);
+	return blob;
+}
+
+/* Returns a buffer with the contents of any blob, to be freed by the
+ * caller. */
+static char *
+blob_flatten(const struct Blob *blob)
+{
+	if (blob->compressed_length_in_bytes > 0) {
+		return blob_decompress(blob);
+	}
+	char *buffer = xmalloc(blob->length_in_bytes > 0 ? blob->length_in_bytes : 1);
+	if (!blob->rope) {
+		memcpy(buffer, blob->data, blob->length_in_bytes);
+		return buffer;
+	}
+	const struct BlobChunk *chunk = EPOCH_LOAD(blob->rope->head);
+	for (size_t offset = 0; offset < blob->length_in_bytes; offset += BLOB_CHUNK_SIZE) {
+		size_t left = blob->length_in_bytes - offset;
+		memcpy(buffer + offset, chunk->data, left < BLOB_CHUNK_SIZE ? left : BLOB_CHUNK_SIZE);
+		chunk = EPOCH_LOAD(chunk->next);
+	}
+	return buffer;
+}
+
+struct Blob *
+blob_compressed(struct Blob *blob)
+{
+	if (blob->compressed_length_in_bytes > 0 ||
+	    blob->length_in_bytes < BLOB_COMPRESSION_MIN_SIZE) {
+		blob_ref(blob);
+		return blob;
+	}
+	char *buffer = blob_flatten(blob);
+	struct Blob *new = blob_create_compressed(buffer, blob->length_in_bytes);
+	free(buffer);
+	if (new->compressed_length_in_bytes == 0) {
+		/* No point in keeping a second copy around. */
+		blob_unref(new);
+		blob_ref(blob);
+		return blob;
+	}
+	return new;
+}
+
+struct Blob *
+blob_uncompressed(struct Blob *blob)
+{
+	if (blob->compressed_length_in_bytes == 0) {
+		blob_ref(blob);
+		return blob;
+	}
+	char *buffer = blob_decompress(blob);
+	struct Blob *new = blob_create(buffer, blob->length_in_bytes);
+	free(buffer);
+	return new;
+}
+
+static struct Blob *
+blob_create_with(const void *data, size_t length_in_bytes, bool compress)
+{
+	return compress ? blob_create_compressed(data, length_in_bytes)
+	                : blob_create(data, length_in_bytes);
+}
+
+struct Blob *
+blob_intern(const void *data, size_t length_in_bytes, bool compress)
+{
+	XXH128_hash_t hash = XXH3_128bits(data, length_in_bytes);
+	uint64_t digest[2] = { hash.low64, hash.high64 };
+	struct BlobInternShard *shard = intern_shard(digest);
+
+	ON_MUTEX_ERR(pthread_mutex_lock(&shard->guard));
+	struct Blob *blob = intern_find_locked(shard, digest, length_in_bytes);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&shard->guard));
+	if (blob && blob_has_contents(blob, data, length_in_bytes)) {
+		return blob;
+	} else if (blob) {
+		/* A collision: the new blob simply won't be shared. */
+		blob_unref(blob);
+		return blob_create_with(data, length_in_bytes, compress);
+	}
+
+	/* Copy outside of the lock, then check again. */
+	struct Blob *new = blob_create_with(data, length_in_bytes, compress);
+	new->digest[0] = digest[0];
+	new->digest[1] = digest[1];
+	ON_MUTEX_ERR(pthread_mutex_lock(&shard->guard));
+	blob = intern_find_locked(shard, digest, length_in_bytes);
+	if (!blob) {
+		intern_insert_locked(shard, new);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&shard->guard));
+	if (!blob) {
+		return new;
+	} else if (blob_has_contents(blob, data, length_in_bytes)) {
+		blob_unref(new);
+		return blob;
+	} else {
+		blob_unref(blob);
+		return new;
+	}
+}
+
+struct Blob *
+blob_append(struct Blob *blob, const void *data, size_t length_in_bytes)
+{
+	size_t offset = blob->length_in_bytes;
+	if (!blob->rope) {
+		/* Inline blobs are small enough to be copied. Compressed ones aren't, but
+		 * files that are being appended to aren't worth compressing anyway. */
+		char *decompressed = NULL;
+		const char *old = blob->data;
+		if (blob->compressed_length_in_bytes > 0) {
+			decompressed = blob_decompress(blob);
+			old = decompressed;
+		}
+		struct Blob *new = NULL;
+		if (offset + length_in_bytes <= inline_threshold) {
+			new = blob_alloc_inline(offset + length_in_bytes);
+			memcpy(new->data, old, offset);
+			if (length_in_bytes > 0) {
+				memcpy(new->data + offset, data, length_in_bytes);
+			}
+		} else {
+			struct BlobRope *new_rope = rope_create();
+			rope_write(new_rope, 0, old, offset);
+			rope_write(new_rope, offset, data, length_in_bytes);
+			new_rope->length_in_bytes = offset + length_in_bytes;
+			new = blob_alloc(new_rope, new_rope->length_in_bytes);
+		}
+		free(decompressed);
+		return new;
+	}
+
+	struct BlobRope *rope = blob->rope;
+	/* Whoever moves the end of the rope first gets to write there. */
+	size_t expected = offset;
+	if (__atomic_compare_exchange_n(&rope->length_in_bytes,
+	                                &expected,
+	                                offset + length_in_bytes,
+	                                false,
+	                                __ATOMIC_ACQ_REL,
+	                                __ATOMIC_RELAXED)) {
+		rope_write(rope, offset, data, length_in_bytes);
+		__atomic_fetch_add(&rope->refcount, 1, __ATOMIC_RELAXED);
+		return blob_alloc(rope, offset + length_in_bytes);
+	}
+
+	/* Somebody else already appended to the rope, so we need our own. */
+	struct BlobRope *new_rope = rope_create();
+	rope_copy(new_rope, rope, offset);
+	rope_write(new_rope, offset, data, length_in_bytes);
+	new_rope->length_in_bytes = offset + length_in_bytes;
+	return blob_alloc(new_rope, new_rope->length_in_bytes);
+}
+
+size_t
+blob_storage_size(const struct Blob *blob)
+{
+	return blob->compressed_length_in_bytes > 0 ? blob->compressed_length_in_bytes
+	                                            : blob->length_in_bytes;
+}
+
+int
+blob_write(int fd, const struct Blob *blob)
+{
+	if (blob->compressed_length_in_bytes > 0) {
+		char *buffer = blob_decompress(blob);
+		int result = write_bytes(fd, buffer, blob->length_in_bytes);
+		free(buffer);
+		return result;
+	} else if (!blob->rope) {
+		return blob->length_in_bytes > 0
+		         ? write_bytes(fd, blob->data, blob->length_in_bytes)
+		         : 1;
+	}
+	struct iovec iov[BLOB_WRITE_BATCH];
+	const struct BlobChunk *chunk = EPOCH_LOAD(blob->rope->head);
+	size_t left = blob->length_in_bytes;
+	while (left > 0) {
+		/* Gather the next few chunks. */
+		int iovcnt = 0;
+		while (left > 0 && iovcnt < BLOB_WRITE_BATCH) {
+			size_t n = left < BLOB_CHUNK_SIZE ? left : BLOB_CHUNK_SIZE;
+			iov[iovcnt].iov_base = (void *)chunk->data;
+			iov[iovcnt].iov_len = n;
+			iovcnt++;
+			left -= n;
+			chunk = EPOCH_LOAD(chunk->next);
+		}
+		/* And send them over, taking care of short writes. */
+		struct iovec *next = iov;
+		while (iovcnt > 0) {
+			ssize_t r = writev(fd, next, iovcnt);
+			if (r == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			while (iovcnt > 0 && (size_t)r >= next->iov_len) {
+				r -= next->iov_len;
+				next++;
+				iovcnt--;
+			}
+			if (iovcnt > 0) {
+				next->iov_base = (char *)next->iov_base + r;
+				next->iov_len -= r;
+			}
+		}
+	}
+	return 1;
+}
+
+void
+blob_compression_stats(struct BlobCompressionStats *stats)
+{
+	stats->raw_bytes = __atomic_load_n(&compression_stats.raw_bytes, __ATOMIC_RELAXED);
+	stats->compressed_bytes =
+	  __atomic_load_n(&compression_stats.compressed_bytes, __ATOMIC_RELAXED);
+	stats->compressed_count =
+	  __atomic_load_n(&compression_stats.compressed_count, __ATOMIC_RELAXED);
+	stats->skipped_count = __atomic_load_n(&compression_stats.skipped_count, __ATOMIC_RELAXED);
+	stats->compression_ns =
+	  __atomic_load_n(&compression_stats.compression_ns, __ATOMIC_RELAXED);
+	stats->decompression_ns =
+	  __atomic_load_n(&compression_stats.decompression_ns, __ATOMIC_RELAXED);
+}
+
+bool
+blob_hold(struct Blob *blob)
+{
+	return __atomic_fetch_add(&blob->holders, 1, __ATOMIC_RELAXED) == 0;
+}
+
+bool
+blob_release(struct Blob *blob)
+{
+	return __atomic_sub_fetch(&blob->holders, 1, __ATOMIC_RELAXED) == 0;
+}
+
+void
+blob_ref(struct Blob *blob)
+{
+	__atomic_fetch_add(&blob->refcount, 1, __ATOMIC_RELAXED);
+}
+
+bool
+blob_try_ref(struct Blob *blob)
+{
+	unsigned refcount = __atomic_load_n(&blob->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0) {
+			return false;
+		}
+	} while (!__atomic_compare_exchange_n(
+	  &blob->refcount, &refcount, refcount + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	return true;
+}
+
+void
+blob_unref(struct Blob *blob)
+{
+	if (!blob) {
+		return;
+	}
+	if (__atomic_sub_fetch(&blob->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		/* Somebody might be about to call `blob_try_ref` on it. */
+		epoch_retire(blob, blob_free);
+	}
+}
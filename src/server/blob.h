@@ -0,0 +1,149 @@
+#ifndef SOL_SERVER_BLOB
+#define SOL_SERVER_BLOB
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* How many bytes of file contents fit in a single chunk. */
+#define BLOB_CHUNK_SIZE 4096
+
+/* File contents are stored as a list of fixed-size chunks, so that appending
+ * never needs to copy what's already there. */
+struct BlobChunk
+{
+	struct BlobChunk *next;
+	char data[BLOB_CHUNK_SIZE];
+};
+
+/* The chunks behind one or more blobs. Successive appends to the same file all
+ * share the same rope, each one seeing a longer prefix of it. */
+struct BlobRope
+{
+	unsigned refcount;
+	/* How many bytes were ever appended. */
+	size_t length_in_bytes;
+	struct BlobChunk *head;
+	struct BlobChunk *tail;
+};
+
+/* Immutable, reference-counted file contents. Writers never modify a blob once
+ * it's been created: they build a new one and swap it in, so that whoever holds
+ * a reference to the old one can keep using it without any lock. */
+struct Blob
+{
+	unsigned refcount;
+	/* How many files refer to this blob. See `blob_hold`. */
+	unsigned holders;
+	size_t length_in_bytes;
+	/* Only set for interned blobs. See `blob_intern`. */
+	bool is_interned;
+	uint64_t digest[2];
+	struct Blob *intern_next;
+	/* Compressed blobs keep this many bytes of LZ4 data in `data`, and
+	 * `length_in_bytes` is their size once decompressed. Zero for all others. */
+	size_t compressed_length_in_bytes;
+	/* Only the first `length_in_bytes` bytes of `rope` belong to this blob. Small
+	 * blobs don't have a rope, and keep their contents in `data` instead. */
+	struct BlobRope *rope;
+	char data[];
+};
+
+/* Sets the size up to which blobs store their contents inline. Meant to be
+ * called once, before creating any blob. */
+void
+blob_set_inline_threshold(size_t length_in_bytes);
+
+struct BlobCompressionStats
+{
+	/* Sizes before and after compression of all blobs that were compressed. */
+	size_t raw_bytes;
+	size_t compressed_bytes;
+	size_t compressed_count;
+	/* Blobs that were stored as they are because they didn't look compressible. */
+	size_t skipped_count;
+	/* CPU time spent within the codec. */
+	uint64_t compression_ns;
+	uint64_t decompression_ns;
+};
+
+/* Creates a new blob with a copy of `data` and a reference count of 1. */
+struct Blob *
+blob_create(const void *data, size_t length_in_bytes);
+
+/* Just like `blob_create`, but stores `data` compressed if that saves enough
+ * space. Contents that are too small or that look already compressed (e.g.
+ * JPEG images or ZIP archives) are stored as they are without trying too
+ * hard. Compressed blobs are transparently decompressed when read. */
+struct Blob *
+blob_create_compressed(const void *data, size_t length_in_bytes);
+
+/* Returns a new reference to a compressed blob with the same contents as
+ * `blob`, or to `blob` itself if it's compressed already or if compressing it
+ * doesn't save enough space. */
+struct Blob *
+blob_compressed(struct Blob *blob);
+
+/* Returns a new reference to an uncompressed blob with the same contents as
+ * `blob`, which might be `blob` itself. */
+struct Blob *
+blob_uncompressed(struct Blob *blob);
+
+/* Just like `blob_create` (or `blob_create_compressed` if `compress` is set),
+ * but if there already is a blob with the same contents that was created by
+ * `blob_intern`, it returns a new reference to that instead. Contents are
+ * identified by their XXH3-128 digest. */
+struct Blob *
+blob_intern(const void *data, size_t length_in_bytes, bool compress);
+
+/* How many bytes of storage the contents of `blob` take up. */
+size_t
+blob_storage_size(const struct Blob *blob);
+
+/* Creates a new blob with the contents of `blob` followed by those of `data`,
+ * and a reference count of 1. `blob` is left untouched. This only copies `data`,
+ * unless `blob` is inline or somebody already appended something else to it. */
+struct Blob *
+blob_append(struct Blob *blob, const void *data, size_t length_in_bytes);
+
+/* Writes all contents of `blob` to `fd` with scatter/gather I/O, decompressing
+ * them first if needed. Returns 1 on success and -1 on failure, like
+ * `write_bytes`. */
+int
+blob_write(int fd, const struct Blob *blob);
+
+/* Records that one more file refers to `blob`. Returns true if it's the first
+ * one, i.e. if `blob` just started taking up storage space. */
+bool
+blob_hold(struct Blob *blob);
+
+/* Undoes `blob_hold`. Returns true if no file refers to `blob` anymore. */
+bool
+blob_release(struct Blob *blob);
+
+/* Acquires a new reference to `blob`, on which the caller must already hold
+ * one. */
+void
+blob_ref(struct Blob *blob);
+
+/* Tries to acquire a reference to `blob`, which the caller might have just read
+ * from some shared location within an epoch (see `epoch.h`). Fails if `blob`
+ * is about to be reclaimed, in which case the caller should read the shared
+ * location again. */
+bool
+blob_try_ref(struct Blob *blob);
+
+/* Drops a reference to `blob`. The last one to go retires it. */
+void
+blob_unref(struct Blob *blob);
+
+/* Thread-safe. */
+void
+blob_compression_stats(struct BlobCompressionStats *stats);
+
+/* Frees all chunks that are kept around for reuse, as well as the index of
+ * interned blobs. All blobs must be gone already. */
+void
+blob_pool_clear(void);
+
+#endif
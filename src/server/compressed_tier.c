@@ -0,0 +1,269 @@
+#include "compressed_tier.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#define COMPRESSED_TIER_MIN_BUCKETS 64
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error within the compressed tier.")
+
+struct CompressedTierEntry
+{
+	struct CompressedTierEntry *hash_next;
+	/* Entries form a FIFO, from the oldest to the newest. */
+	struct CompressedTierEntry *older;
+	struct CompressedTierEntry *newer;
+	/* NUL-terminated, for whoever gets the entry as an evicted file. */
+	char *key;
+	size_t key_len;
+	uint64_t hash;
+	struct Blob *contents;
+};
+
+struct CompressedTier
+{
+	size_t capacity_in_bytes;
+	pthread_mutex_t guard;
+	/* A power of two. */
+	size_t buckets_count;
+	struct CompressedTierEntry **buckets;
+	struct CompressedTierEntry *oldest;
+	struct CompressedTierEntry *newest;
+	/* Only modified under `guard`, but read without it. */
+	size_t items_count;
+	size_t space_in_bytes;
+	long unsigned stores;
+	long unsigned promotions;
+	long unsigned overflows;
+};
+
+struct CompressedTier *
+compressed_tier_create(size_t capacity_in_bytes)
+{
+	struct CompressedTier *tier = xmalloc(sizeof(struct CompressedTier));
+	tier->capacity_in_bytes = capacity_in_bytes;
+	ON_MUTEX_ERR(pthread_mutex_init(&tier->guard, NULL));
+	tier->buckets_count = COMPRESSED_TIER_MIN_BUCKETS;
+	tier->buckets = xmalloc(sizeof(struct CompressedTierEntry *) * tier->buckets_count);
+	memset(tier->buckets, 0, sizeof(struct CompressedTierEntry *) * tier->buckets_count);
+	tier->oldest = NULL;
+	tier->newest = NULL;
+	tier->items_count = 0;
+	tier->space_in_bytes = 0;
+	tier->stores = 0;
+	tier->promotions = 0;
+	tier->overflows = 0;
+	return tier;
+}
+
+static void
+entry_free(struct CompressedTierEntry *entry)
+{
+	free(entry->key);
+	blob_unref(entry->contents);
+	free(entry);
+}
+
+void
+compressed_tier_free(struct CompressedTier *tier)
+{
+	if (!tier) {
+		return;
+	}
+	struct CompressedTierEntry *entry = tier->oldest;
+	while (entry) {
+		struct CompressedTierEntry *next = entry->newer;
+		entry_free(entry);
+		entry = next;
+	}
+	free(tier->buckets);
+	ON_MUTEX_ERR(pthread_mutex_destroy(&tier->guard));
+	free(tier);
+}
+
+static struct CompressedTierEntry **
+tier_bucket(struct CompressedTier *tier, uint64_t hash)
+{
+	return &tier->buckets[hash & (tier->buckets_count - 1)];
+}
+
+/* Doubles the number of buckets, so that chains stay short. */
+static void
+tier_grow_locked(struct CompressedTier *tier)
+{
+	struct CompressedTierEntry **old = tier->buckets;
+	size_t old_count = tier->buckets_count;
+	tier->buckets_count *= 2;
+	tier->buckets = xmalloc(sizeof(struct CompressedTierEntry *) * tier->buckets_count);
+	memset(tier->buckets, 0, sizeof(struct CompressedTierEntry *) * tier->buckets_count);
+	for (size_t i = 0; i < old_count; i++) {
+		struct CompressedTierEntry *entry = old[i];
+		while (entry) {
+			struct CompressedTierEntry *next = entry->hash_next;
+			struct CompressedTierEntry **bucket = tier_bucket(tier, entry->hash);
+			entry->hash_next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	free(old);
+}
+
+/* Unlinks and returns the entry with path `key`, or NULL. */
+static struct CompressedTierEntry *
+tier_remove_locked(struct CompressedTier *tier, const struct HTableKey *key)
+{
+	struct CompressedTierEntry **ptr = tier_bucket(tier, key->hash);
+	while (*ptr && ((*ptr)->hash != key->hash || (*ptr)->key_len != key->len ||
+	                memcmp((*ptr)->key, key->ptr, key->len) != 0)) {
+		ptr = &(*ptr)->hash_next;
+	}
+	struct CompressedTierEntry *entry = *ptr;
+	if (!entry) {
+		return NULL;
+	}
+	*ptr = entry->hash_next;
+	if (entry->older) {
+		entry->older->newer = entry->newer;
+	} else {
+		tier->oldest = entry->newer;
+	}
+	if (entry->newer) {
+		entry->newer->older = entry->older;
+	} else {
+		tier->newest = entry->older;
+	}
+	__atomic_fetch_sub(&tier->items_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(
+	  &tier->space_in_bytes, blob_storage_size(entry->contents), __ATOMIC_RELAXED);
+	return entry;
+}
+
+static void
+tier_push_locked(struct CompressedTier *tier, struct CompressedTierEntry *entry)
+{
+	struct CompressedTierEntry **bucket = tier_bucket(tier, entry->hash);
+	entry->hash_next = *bucket;
+	*bucket = entry;
+	entry->older = tier->newest;
+	entry->newer = NULL;
+	if (tier->newest) {
+		tier->newest->newer = entry;
+	} else {
+		tier->oldest = entry;
+	}
+	tier->newest = entry;
+	__atomic_fetch_add(&tier->items_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(
+	  &tier->space_in_bytes, blob_storage_size(entry->contents), __ATOMIC_RELAXED);
+	if (tier->items_count > tier->buckets_count) {
+		tier_grow_locked(tier);
+	}
+}
+
+void
+compressed_tier_store(struct CompressedTier *tier,
+                      const struct HTableKey *key,
+                      struct Blob *contents,
+                      struct File **overflow,
+                      unsigned *overflow_count)
+{
+	/* Compress outside of the lock. */
+	struct CompressedTierEntry *entry = xmalloc(sizeof(struct CompressedTierEntry));
+	entry->key = buf_to_str(key->ptr, key->len);
+	entry->key_len = key->len;
+	entry->hash = key->hash;
+	entry->contents = blob_compressed(contents);
+
+	/* Overflowing entries are chained through `newer` until we're done. */
+	struct CompressedTierEntry *victims = NULL;
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct CompressedTierEntry *stale = tier_remove_locked(tier, key);
+	if (blob_storage_size(entry->contents) > tier->capacity_in_bytes) {
+		entry->newer = NULL;
+		victims = entry;
+	} else {
+		tier_push_locked(tier, entry);
+		__atomic_fetch_add(&tier->stores, 1, __ATOMIC_RELAXED);
+		while (tier->space_in_bytes > tier->capacity_in_bytes) {
+			struct CompressedTierEntry *oldest = tier->oldest;
+			struct HTableKey oldest_key = {
+				.ptr = oldest->key, .len = oldest->key_len, .hash = oldest->hash
+			};
+			tier_remove_locked(tier, &oldest_key);
+			oldest->newer = victims;
+			victims = oldest;
+		}
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	if (stale) {
+		entry_free(stale);
+	}
+
+	/* The tier's copies of the key and the contents go to the caller. */
+	while (victims) {
+		struct CompressedTierEntry *next = victims->newer;
+		(*overflow_count)++;
+		*overflow = xrealloc(*overflow, sizeof(struct File) * *overflow_count);
+		struct File *file = &(*overflow)[*overflow_count - 1];
+		file->key = victims->key;
+		file->contents = victims->contents;
+		file->fd_owner = -1;
+		file->is_open = false;
+		file->is_locked = false;
+		file->is_pinned = false;
+		file->subs = NULL;
+		free(victims);
+		__atomic_fetch_add(&tier->overflows, 1, __ATOMIC_RELAXED);
+		victims = next;
+	}
+}
+
+struct Blob *
+compressed_tier_take(struct CompressedTier *tier, const struct HTableKey *key)
+{
+	if (__atomic_load_n(&tier->items_count, __ATOMIC_RELAXED) == 0) {
+		return NULL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct CompressedTierEntry *entry = tier_remove_locked(tier, key);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	if (!entry) {
+		return NULL;
+	}
+	struct Blob *contents = entry->contents;
+	free(entry->key);
+	free(entry);
+	__atomic_fetch_add(&tier->promotions, 1, __ATOMIC_RELAXED);
+	return contents;
+}
+
+bool
+compressed_tier_drop(struct CompressedTier *tier, const struct HTableKey *key)
+{
+	if (__atomic_load_n(&tier->items_count, __ATOMIC_RELAXED) == 0) {
+		return false;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct CompressedTierEntry *entry = tier_remove_locked(tier, key);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	if (!entry) {
+		return false;
+	}
+	entry_free(entry);
+	return true;
+}
+
+void
+compressed_tier_stats(const struct CompressedTier *tier, struct CompressedTierStats *stats)
+{
+	stats->items_count = __atomic_load_n(&tier->items_count, __ATOMIC_RELAXED);
+	stats->space_in_bytes = __atomic_load_n(&tier->space_in_bytes, __ATOMIC_RELAXED);
+	stats->stores = __atomic_load_n(&tier->stores, __ATOMIC_RELAXED);
+	stats->promotions = __atomic_load_n(&tier->promotions, __ATOMIC_RELAXED);
+	stats->overflows = __atomic_load_n(&tier->overflows, __ATOMIC_RELAXED);
+}
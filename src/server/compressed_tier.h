@@ -0,0 +1,56 @@
+#ifndef SOL_SERVER_COMPRESSED_TIER
+#define SOL_SERVER_COMPRESSED_TIER
+
+#include "blob.h"
+#include "htable.h"
+#include <stdlib.h>
+
+/* A capped area for the contents of files that were just evicted from the hash
+ * table, kept compressed in memory (in the style of zswap). Files only leave
+ * the server for good once the tier overflows, oldest first, and they can be
+ * taken back in the meantime. Thread-safe. */
+struct CompressedTier;
+
+struct CompressedTierStats
+{
+	size_t items_count;
+	/* Contents that are shared with other files count in full. */
+	size_t space_in_bytes;
+	long unsigned stores;
+	long unsigned promotions;
+	long unsigned overflows;
+};
+
+/* Creates an empty tier that holds up to `capacity_in_bytes` bytes of
+ * (compressed) file contents. */
+struct CompressedTier *
+compressed_tier_create(size_t capacity_in_bytes);
+
+/* Deletes `tier` and all files within it. */
+void
+compressed_tier_free(struct CompressedTier *tier);
+
+/* Stores a compressed copy of `contents` as the file with path `key`, in place
+ * of any older copy. Files that don't fit anymore, this one included, are
+ * appended to `overflow` just like `htable_evict_files` does. */
+void
+compressed_tier_store(struct CompressedTier *tier,
+                      const struct HTableKey *key,
+                      struct Blob *contents,
+                      struct File **overflow,
+                      unsigned *overflow_count);
+
+/* Removes the file with path `key` from `tier` and returns its contents, which
+ * the caller must `blob_unref`. Returns NULL if there's no such file. */
+struct Blob *
+compressed_tier_take(struct CompressedTier *tier, const struct HTableKey *key);
+
+/* Just like `compressed_tier_take`, but throws the contents away. Returns
+ * true if there was such a file. */
+bool
+compressed_tier_drop(struct CompressedTier *tier, const struct HTableKey *key);
+
+void
+compressed_tier_stats(const struct CompressedTier *tier, struct CompressedTierStats *stats);
+
+#endif
@@ -1,4 +1,5 @@
 #include "config.h"
+#include "blob.h"
 #include "global_state.h"
 #include "tomlc99/toml.h"
 #include "utilities.h"
@@ -7,6 +8,36 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Most small files fit in a few cache lines at this size. */
+#define DEFAULT_INLINE_THRESHOLD_IN_BYTES 256
+
+static const char *const cache_eviction_policy_names[CACHE_EVICTION_POLICIES_COUNT] = {
+	[CACHE_EVICTION_POLICY_FIFO] = "fifo",
+	[CACHE_EVICTION_POLICY_SEGMENTED_FIFO] = "segmented-fifo",
+	[CACHE_EVICTION_POLICY_LRU] = "lru",
+	[CACHE_EVICTION_POLICY_CLOCK] = "clock",
+	[CACHE_EVICTION_POLICY_S3_FIFO] = "s3-fifo",
+	[CACHE_EVICTION_POLICY_GDSF] = "gdsf",
+};
+
+int
+config_parse_cache_eviction_policy(const char *name, enum CacheEvictionPolicy *policy)
+{
+	for (int i = 0; i < CACHE_EVICTION_POLICIES_COUNT; i++) {
+		if (strcmp(name, cache_eviction_policy_names[i]) == 0) {
+			*policy = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *
+config_cache_eviction_policy_name(enum CacheEvictionPolicy policy)
+{
+	return cache_eviction_policy_names[policy];
+}
+
 struct Config *
 config_parse_file(char abs_path[])
 {
@@ -51,17 +82,108 @@ config_parse_file(char abs_path[])
 	config->max_storage_in_bytes = param_max_storage.u.i;
 	config->num_workers = param_num_workers.u.i;
 	config->socket_filepath = param_socket_filepath.u.s;
-	if (strcmp(param_cache_eviction_policy.u.s, "fifo") == 0) {
-		config->cache_eviction_policy = CACHE_EVICTION_POLICY_FIFO;
-	} else if (strcmp(param_cache_eviction_policy.u.s, "segmented-fifo") == 0) {
-		config->cache_eviction_policy = CACHE_EVICTION_POLICY_SEGMENTED_FIFO;
-	} else {
+	if (config_parse_cache_eviction_policy(param_cache_eviction_policy.u.s,
+	                                       &config->cache_eviction_policy) < 0) {
 		free(param_socket_filepath.u.s);
 		free(param_cache_eviction_policy.u.s);
 		free(param_log_filepath.u.s);
 		glog_fatal("Invalid cache eviction policy.");
 		goto err;
 	}
+	/* Optional; defaults to the chained hash table. */
+	toml_datum_t param_htable_backend = toml_string_in(toml_table, "htable-backend");
+	config->htable_backend = HTABLE_BACKEND_CHAINED;
+	if (param_htable_backend.ok) {
+		if (strcmp(param_htable_backend.u.s, "chained") == 0) {
+			config->htable_backend = HTABLE_BACKEND_CHAINED;
+		} else if (strcmp(param_htable_backend.u.s, "swiss") == 0) {
+			config->htable_backend = HTABLE_BACKEND_SWISS;
+		} else {
+			free(param_socket_filepath.u.s);
+			free(param_cache_eviction_policy.u.s);
+			free(param_log_filepath.u.s);
+			free(param_htable_backend.u.s);
+			glog_fatal("Invalid hash table backend.");
+			goto err;
+		}
+		free(param_htable_backend.u.s);
+	}
+	/* Optional. Inline contents never make sense past the size of a chunk. */
+	toml_datum_t param_inline_threshold = toml_int_in(toml_table, "inline-threshold");
+	config->inline_threshold_in_bytes = DEFAULT_INLINE_THRESHOLD_IN_BYTES;
+	if (param_inline_threshold.ok) {
+		if (param_inline_threshold.u.i < 0 ||
+		    param_inline_threshold.u.i > BLOB_CHUNK_SIZE) {
+			free(param_socket_filepath.u.s);
+			free(param_cache_eviction_policy.u.s);
+			free(param_log_filepath.u.s);
+			glog_fatal("Invalid inline threshold.");
+			goto err;
+		}
+		config->inline_threshold_in_bytes = param_inline_threshold.u.i;
+	}
+	/* Optional; disabled by default. */
+	toml_datum_t param_deduplication = toml_bool_in(toml_table, "deduplication");
+	config->deduplication = param_deduplication.ok && param_deduplication.u.b;
+	toml_datum_t param_compression = toml_bool_in(toml_table, "compression");
+	config->compression = param_compression.ok && param_compression.u.b;
+	toml_datum_t param_admission_filter = toml_bool_in(toml_table, "admission-filter");
+	config->admission_filter = param_admission_filter.ok && param_admission_filter.u.b;
+	/* Optional; files are only evicted by writers if watermarks are missing. */
+	toml_datum_t param_low_watermark = toml_int_in(toml_table, "eviction-low-watermark");
+	toml_datum_t param_high_watermark = toml_int_in(toml_table, "eviction-high-watermark");
+	config->background_eviction = param_low_watermark.ok || param_high_watermark.ok;
+	if (config->background_eviction) {
+		if (!param_low_watermark.ok || !param_high_watermark.ok ||
+		    param_low_watermark.u.i < 1 ||
+		    param_low_watermark.u.i > param_high_watermark.u.i ||
+		    param_high_watermark.u.i > 100) {
+			free(param_socket_filepath.u.s);
+			free(param_cache_eviction_policy.u.s);
+			free(param_log_filepath.u.s);
+			glog_fatal("Invalid eviction watermarks.");
+			goto err;
+		}
+		config->eviction_low_watermark = param_low_watermark.u.i;
+		config->eviction_high_watermark = param_high_watermark.u.i;
+	}
+	/* Optional; evicted files leave the server right away by default. */
+	toml_datum_t param_compressed_tier = toml_int_in(toml_table, "compressed-tier");
+	config->compressed_tier_in_bytes = 0;
+	if (param_compressed_tier.ok) {
+		if (param_compressed_tier.u.i < 0) {
+			free(param_socket_filepath.u.s);
+			free(param_cache_eviction_policy.u.s);
+			free(param_log_filepath.u.s);
+			glog_fatal("Invalid compressed tier size.");
+			goto err;
+		}
+		config->compressed_tier_in_bytes = param_compressed_tier.u.i;
+	}
+	/* Optional, but both or neither. */
+	toml_datum_t param_spill_directory = toml_string_in(toml_table, "spill-directory");
+	toml_datum_t param_spill_max_size = toml_int_in(toml_table, "spill-max-size");
+	config->spill_directory = NULL;
+	config->spill_max_size_in_bytes = 0;
+	if (param_spill_directory.ok || param_spill_max_size.ok) {
+		if (!param_spill_directory.ok || !param_spill_max_size.ok ||
+		    param_spill_max_size.u.i < 1) {
+			free(param_socket_filepath.u.s);
+			free(param_cache_eviction_policy.u.s);
+			free(param_log_filepath.u.s);
+			free(param_spill_directory.u.s);
+			glog_fatal("Invalid spill tier settings.");
+			goto err;
+		}
+		config->spill_directory = param_spill_directory.u.s;
+		config->spill_max_size_in_bytes = param_spill_max_size.u.i;
+	}
+	/* Optional; evicted files go back to writers by default. */
+	toml_datum_t param_eviction_spool = toml_string_in(toml_table, "eviction-spool");
+	config->eviction_spool_directory = NULL;
+	if (param_eviction_spool.ok) {
+		config->eviction_spool_directory = param_eviction_spool.u.s;
+	}
 	config->log_filepath = param_log_filepath.u.s;
 	config->log_f = fopen(config->socket_filepath, "a");
 	config->err = 0;
@@ -89,5 +211,7 @@ config_free(struct Config *config)
 	}
 	free(config->socket_filepath);
 	free(config->log_filepath);
+	free(config->spill_directory);
+	free(config->eviction_spool_directory);
 	free(config);
 }
@@ -1,23 +1,70 @@
 #ifndef SOL_SERVER_CONFIG
 #define SOL_SERVER_CONFIG
 
+#include <stdbool.h>
 #include <stdio.h>
 
 enum CacheEvictionPolicy
 {
 	CACHE_EVICTION_POLICY_FIFO,
 	CACHE_EVICTION_POLICY_SEGMENTED_FIFO,
+	/* Least recently used. */
+	CACHE_EVICTION_POLICY_LRU,
+	/* Second chance, with a reference bit per file. */
+	CACHE_EVICTION_POLICY_CLOCK,
+	/* A small probationary FIFO, a main FIFO, and a ghost FIFO. */
+	CACHE_EVICTION_POLICY_S3_FIFO,
+	/* GreedyDual-Size-Frequency, which favors small and popular files. */
+	CACHE_EVICTION_POLICY_GDSF,
+};
+
+#define CACHE_EVICTION_POLICIES_COUNT (CACHE_EVICTION_POLICY_GDSF + 1)
+
+/* The data structure that indexes files within the hash table. */
+enum HTableBackend
+{
+	/* Separate chaining. */
+	HTABLE_BACKEND_CHAINED,
+	/* Open addressing, in the style of a Swiss table. */
+	HTABLE_BACKEND_SWISS,
 };
 
 /* Server configuration settings. */
 struct Config
 {
 	unsigned max_files;
-	unsigned max_storage_in_bytes;
+	size_t max_storage_in_bytes;
 	unsigned num_workers;
 	char *socket_filepath;
 	char *log_filepath;
 	enum CacheEvictionPolicy cache_eviction_policy;
+	enum HTableBackend htable_backend;
+	/* Files up to this size are stored inline, without any chunk. */
+	unsigned inline_threshold_in_bytes;
+	/* Whether files with identical contents share them. */
+	bool deduplication;
+	/* Whether file contents are compressed, whenever that's worth it. */
+	bool compression;
+	/* Whether new files must be more popular than eviction victims to stay. */
+	bool admission_filter;
+	/* Whether files are evicted by a background thread, which starts once usage
+	 * goes past the high watermark and stops at the low watermark. Both are
+	 * percentages of `max_files` and `max_storage_in_bytes`. Evicted files go to
+	 * the eviction spool, so it's ignored without one. */
+	bool background_eviction;
+	unsigned eviction_low_watermark;
+	unsigned eviction_high_watermark;
+	/* How many bytes of compressed contents evicted files can keep taking up
+	 * before they actually leave the server. Zero disables the tier. */
+	size_t compressed_tier_in_bytes;
+	/* Where files that would otherwise leave the server are kept on disk, or
+	 * NULL to disable the spill tier. It holds up to `spill_max_size_in_bytes`
+	 * bytes of files. */
+	char *spill_directory;
+	size_t spill_max_size_in_bytes;
+	/* Where evicted files are written instead of being sent back to the writer,
+	 * which then only learns how many there were. NULL to send them back. */
+	char *eviction_spool_directory;
 	FILE *log_f;
 	/* Set to `-1` in case of decoding or deserialization errors, `0` on success. */
 	int err;
@@ -28,6 +75,15 @@ struct Config
 struct Config *
 config_parse_file(char abs_path[]);
 
+/* Writes the cache eviction policy called `name` within configuration files
+ * into `policy`. Returns 0 on success, -1 if there's no such policy. */
+int
+config_parse_cache_eviction_policy(const char *name, enum CacheEvictionPolicy *policy);
+
+/* Returns the name of `policy` within configuration files. */
+const char *
+config_cache_eviction_policy_name(enum CacheEvictionPolicy policy);
+
 /* Frees all memory used by `config` after `config_parse_file`. It also closes
  * the log file, if present and open. */
 void
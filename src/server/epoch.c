@@ -0,0 +1,267 @@
+#include "epoch.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* How often the reclaimer tries to advance the global epoch. */
+#define EPOCH_RECLAIM_INTERVAL_MSEC 10
+/* Threads collect retired memory on their own, and only take the global lock
+ * once per critical section, or for this many items. */
+#define EPOCH_RETIRE_BATCH_SIZE 64
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error during memory reclamation.")
+
+struct EpochRetired
+{
+	void *ptr;
+	void (*destructor)(void *);
+};
+
+struct EpochBatch
+{
+	struct EpochRetired retired[EPOCH_RETIRE_BATCH_SIZE];
+	unsigned count;
+	/* The global epoch when the batch went to the global list, which is never
+	 * earlier than any retirement within it; a safe stand-in for all of them. */
+	uint64_t epoch;
+	struct EpochBatch *next;
+};
+
+/* Per-thread state. Once registered, records are never freed until shutdown. */
+struct EpochRecord
+{
+	/* The epoch observed when entering the outermost critical section, shifted
+	 * left by one; the lowest bit is set while within a critical section. */
+	uint64_t state;
+	/* Memory retired by this thread that the reclaimer doesn't know about yet.
+	 * Only touched by the thread itself, until shutdown. */
+	struct EpochBatch *batch;
+	struct EpochRecord *next;
+};
+
+static uint64_t global_epoch = 0;
+
+static pthread_mutex_t records_guard = PTHREAD_MUTEX_INITIALIZER;
+static struct EpochRecord *records = NULL;
+
+/* Retired memory, oldest first. Epochs are non-decreasing along the list. */
+static pthread_mutex_t retired_guard = PTHREAD_MUTEX_INITIALIZER;
+static struct EpochBatch *retired_head = NULL;
+static struct EpochBatch *retired_last = NULL;
+
+static pthread_t reclaimer;
+static bool reclaimer_is_running = false;
+static bool reclaimer_stop = false;
+
+static __thread struct EpochRecord *thread_record = NULL;
+static __thread unsigned thread_nesting = 0;
+
+static struct EpochRecord *
+epoch_record(void)
+{
+	if (!thread_record) {
+		struct EpochRecord *record = xmalloc(sizeof(struct EpochRecord));
+		record->state = 0;
+		record->batch = NULL;
+		ON_MUTEX_ERR(pthread_mutex_lock(&records_guard));
+		record->next = records;
+		records = record;
+		ON_MUTEX_ERR(pthread_mutex_unlock(&records_guard));
+		thread_record = record;
+	}
+	return thread_record;
+}
+
+void
+epoch_enter(void)
+{
+	if (thread_nesting++ > 0) {
+		return;
+	}
+	struct EpochRecord *record = epoch_record();
+	uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	while (true) {
+		__atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+		/* The reclaimer might have advanced the epoch before seeing our record. */
+		uint64_t current = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+		if (current == epoch) {
+			break;
+		}
+		epoch = current;
+	}
+}
+
+/* Hands the batch of `record` over to the reclaimer. */
+static void
+epoch_flush(struct EpochRecord *record)
+{
+	struct EpochBatch *batch = record->batch;
+	record->batch = NULL;
+	batch->next = NULL;
+	ON_MUTEX_ERR(pthread_mutex_lock(&retired_guard));
+	/* Reading the epoch under the lock keeps the list sorted. */
+	batch->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	if (retired_last) {
+		retired_last->next = batch;
+	} else {
+		retired_head = batch;
+	}
+	retired_last = batch;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&retired_guard));
+}
+
+void
+epoch_exit(void)
+{
+	if (--thread_nesting > 0) {
+		return;
+	}
+	__atomic_store_n(&thread_record->state, 0, __ATOMIC_RELEASE);
+	/* The thread might block for good after this, e.g. on its workload queue, so
+	 * whatever it retired goes to the reclaimer right away. */
+	if (thread_record->batch) {
+		epoch_flush(thread_record);
+	}
+}
+
+void
+epoch_retire(void *ptr, void (*destructor)(void *))
+{
+	if (!ptr) {
+		return;
+	}
+	struct EpochRecord *record = epoch_record();
+	struct EpochBatch *batch = record->batch;
+	if (!batch) {
+		batch = xmalloc(sizeof(struct EpochBatch));
+		batch->count = 0;
+		record->batch = batch;
+	}
+	batch->retired[batch->count].ptr = ptr;
+	batch->retired[batch->count].destructor = destructor;
+	/* Outside of critical sections, there's no `epoch_exit` to flush it later. */
+	if (++batch->count == EPOCH_RETIRE_BATCH_SIZE || thread_nesting == 0) {
+		epoch_flush(record);
+	}
+}
+
+/* Advances the global epoch if all threads within a critical section have
+ * observed the current one. Returns the (possibly new) global epoch. */
+static uint64_t
+epoch_try_advance(void)
+{
+	uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	ON_MUTEX_ERR(pthread_mutex_lock(&records_guard));
+	for (struct EpochRecord *record = records; record; record = record->next) {
+		uint64_t state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+		if ((state & 1) && (state >> 1) != epoch) {
+			ON_MUTEX_ERR(pthread_mutex_unlock(&records_guard));
+			return epoch;
+		}
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&records_guard));
+	/* Only the reclaimer advances the epoch, so there's no race here. */
+	__atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+	return epoch + 1;
+}
+
+/* Frees all retired memory from epochs strictly before `epoch`. */
+static void
+epoch_free_retired_before(uint64_t epoch)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&retired_guard));
+	struct EpochBatch *head = retired_head;
+	struct EpochBatch *last = NULL;
+	while (retired_head && retired_head->epoch < epoch) {
+		last = retired_head;
+		retired_head = retired_head->next;
+	}
+	if (!retired_head) {
+		retired_last = NULL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&retired_guard));
+
+	/* Destructors run outside of the lock. */
+	if (!last) {
+		return;
+	}
+	last->next = NULL;
+	while (head) {
+		struct EpochBatch *next = head->next;
+		for (unsigned i = 0; i < head->count; i++) {
+			head->retired[i].destructor(head->retired[i].ptr);
+		}
+		free(head);
+		head = next;
+	}
+	/* Destructors might have retired some more memory, e.g. blobs of items. */
+	if (thread_record && thread_record->batch) {
+		epoch_flush(thread_record);
+	}
+}
+
+static void *
+epoch_reclaimer_entry_point(void *args)
+{
+	UNUSED(args);
+	while (!__atomic_load_n(&reclaimer_stop, __ATOMIC_ACQUIRE)) {
+		wait_msec(EPOCH_RECLAIM_INTERVAL_MSEC);
+		/* Readers might still be looking at anything that was retired during the
+		 * previous epoch, but not before that. */
+		uint64_t epoch = epoch_try_advance();
+		if (epoch >= 1) {
+			epoch_free_retired_before(epoch - 1);
+		}
+	}
+	return NULL;
+}
+
+void
+epoch_reclaimer_spawn(void)
+{
+	reclaimer_stop = false;
+	int err = pthread_create(&reclaimer, NULL, epoch_reclaimer_entry_point, NULL);
+	if (err) {
+		glog_fatal("Unexpected `pthread_create` error code %d when spawning the memory "
+		           "reclaimer.",
+		           err);
+		exit(EXIT_FAILURE);
+	}
+	reclaimer_is_running = true;
+}
+
+void
+epoch_reclaimer_join(void)
+{
+	if (reclaimer_is_running) {
+		__atomic_store_n(&reclaimer_stop, true, __ATOMIC_RELEASE);
+		ON_MUTEX_ERR(pthread_join(reclaimer, NULL));
+		reclaimer_is_running = false;
+	}
+	/* Other threads are done, so their batches are up for grabs. Destructors
+	 * retire more memory in turn, which ends up within our own batch. */
+	ON_MUTEX_ERR(pthread_mutex_lock(&records_guard));
+	for (struct EpochRecord *record = records; record; record = record->next) {
+		if (record->batch) {
+			epoch_flush(record);
+		}
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&records_guard));
+	while (__atomic_load_n(&retired_head, __ATOMIC_RELAXED)) {
+		epoch_free_retired_before(UINT64_MAX);
+	}
+
+	ON_MUTEX_ERR(pthread_mutex_lock(&records_guard));
+	while (records) {
+		struct EpochRecord *next = records->next;
+		free(records);
+		records = next;
+	}
+	thread_record = NULL;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&records_guard));
+}
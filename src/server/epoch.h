@@ -0,0 +1,44 @@
+#ifndef SOL_SERVER_EPOCH
+#define SOL_SERVER_EPOCH
+
+/* Epoch-based memory reclamation, a flavor of RCU (read-copy-update).
+ *
+ * Readers enclose lock-free accesses to shared data structures within
+ * `epoch_enter` and `epoch_exit`. Writers never free memory that readers might
+ * still be looking at: they unlink it and then hand it over to `epoch_retire`,
+ * and a background reclaimer frees it as soon as all readers that might have
+ * seen it are gone. */
+
+/* Loads a pointer (or any other word-sized value) published by `EPOCH_STORE`. */
+#define EPOCH_LOAD(ptr) __atomic_load_n(&(ptr), __ATOMIC_ACQUIRE)
+
+/* Publishes `val` to lock-free readers. All memory writes that precede this
+ * are visible to readers that `EPOCH_LOAD` the new value. */
+#define EPOCH_STORE(ptr, val) __atomic_store_n(&(ptr), (val), __ATOMIC_RELEASE)
+
+/* Marks the beginning of a read-side critical section for the calling thread.
+ * Critical sections can be nested. */
+void
+epoch_enter(void);
+
+/* Marks the end of a read-side critical section for the calling thread. */
+void
+epoch_exit(void);
+
+/* Schedules `ptr` to be freed with `destructor` once no thread can possibly be
+ * accessing it anymore. Thread-safe. Within critical sections, each thread
+ * hands its retired memory over to the reclaimer in batches, at the latest when
+ * the outermost one ends. */
+void
+epoch_retire(void *ptr, void (*destructor)(void *));
+
+/* Spawns the background reclaimer thread. */
+void
+epoch_reclaimer_spawn(void);
+
+/* Stops the background reclaimer thread and immediately frees all retired
+ * memory. No thread must be within a critical section at this point. */
+void
+epoch_reclaimer_join(void);
+
+#endif
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "eviction_spool.h"
+#include "blob.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Queued files still take up memory, so writers wait for the disk past this
+ * many bytes. */
+#define EVICTION_SPOOL_MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+#define ON_MUTEX_ERR(err) ON_ERR((err), "Unexpected mutex error within the eviction spool.")
+
+/* All files evicted by a single request, written in order. */
+struct EvictionSpoolBatch
+{
+	struct File *files;
+	unsigned count;
+	size_t size_in_bytes;
+	struct EvictionSpoolBatch *next;
+};
+
+struct EvictionSpool
+{
+	char *directory;
+	pthread_mutex_t guard;
+	pthread_cond_t writer_cond;
+	/* Signaled whenever some queued bytes are written. */
+	pthread_cond_t space_cond;
+	pthread_t writer;
+	bool writer_stop;
+	struct EvictionSpoolBatch *queue_head;
+	struct EvictionSpoolBatch *queue_tail;
+	/* Only modified under `guard`, but read without it. */
+	size_t queued_count;
+	size_t queued_bytes;
+	long unsigned spooled;
+	long unsigned failures;
+	/* Only touched by the writer. */
+	long unsigned next_temp_id;
+};
+
+static void *
+eviction_spool_writer_entry_point(void *args);
+
+/* Returns the path of the spooled copy of `key`. Slashes (and percent signs)
+ * are percent-encoded, so that distinct keys never share a file. */
+static char *
+spool_path(const struct EvictionSpool *spool, const char *key)
+{
+	size_t dir_len = strlen(spool->directory);
+	char *path = xmalloc(dir_len + 1 + strlen(key) * 3 + 1);
+	strcpy(path, spool->directory);
+	char *ptr = path + dir_len;
+	*ptr++ = '/';
+	for (; *key; key++) {
+		if (*key == '/' || *key == '%') {
+			ptr += sprintf(ptr, "%%%02X", (unsigned char)*key);
+		} else {
+			*ptr++ = *key;
+		}
+	}
+	*ptr = '\0';
+	return path;
+}
+
+/* Writes `file` to a temporary file first and then renames it, so that
+ * consumers never see partial contents. Newer copies replace older ones. */
+static int
+spool_write_file(struct EvictionSpool *spool, const struct File *file)
+{
+	char *temp_path = xmalloc(strlen(spool->directory) + 48);
+	sprintf(temp_path, "%s/.spool-%lu.tmp", spool->directory, spool->next_temp_id++);
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		free(temp_path);
+		return -1;
+	}
+	int err = blob_write(fd, file->contents);
+	if (close(fd) < 0) {
+		err = -1;
+	}
+	if (err >= 0) {
+		char *path = spool_path(spool, file->key);
+		err = rename(temp_path, path);
+		free(path);
+	}
+	if (err < 0) {
+		unlink(temp_path);
+	}
+	free(temp_path);
+	return err;
+}
+
+/************ PUBLIC API ***********/
+
+struct EvictionSpool *
+eviction_spool_create(const char *directory)
+{
+	if (mkdir(directory, 0700) < 0 && errno != EEXIST) {
+		glog_error(
+		  "Couldn't create the eviction spool '%s' (errno %d).", directory, errno);
+		return NULL;
+	}
+	struct EvictionSpool *spool = xmalloc(sizeof(struct EvictionSpool));
+	spool->directory = buf_to_str(directory, strlen(directory));
+	ON_MUTEX_ERR(pthread_mutex_init(&spool->guard, NULL));
+	ON_MUTEX_ERR(pthread_cond_init(&spool->writer_cond, NULL));
+	ON_MUTEX_ERR(pthread_cond_init(&spool->space_cond, NULL));
+	spool->writer_stop = false;
+	spool->queue_head = NULL;
+	spool->queue_tail = NULL;
+	spool->queued_count = 0;
+	spool->queued_bytes = 0;
+	spool->spooled = 0;
+	spool->failures = 0;
+	spool->next_temp_id = 0;
+	int err =
+	  pthread_create(&spool->writer, NULL, eviction_spool_writer_entry_point, spool);
+	if (err) {
+		glog_error("Unexpected `pthread_create` error code %d when spawning the eviction "
+		           "spool writer.",
+		           err);
+		ON_MUTEX_ERR(pthread_cond_destroy(&spool->space_cond));
+		ON_MUTEX_ERR(pthread_cond_destroy(&spool->writer_cond));
+		ON_MUTEX_ERR(pthread_mutex_destroy(&spool->guard));
+		free(spool->directory);
+		free(spool);
+		return NULL;
+	}
+	return spool;
+}
+
+void
+eviction_spool_free(struct EvictionSpool *spool)
+{
+	if (!spool) {
+		return;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&spool->guard));
+	spool->writer_stop = true;
+	ON_MUTEX_ERR(pthread_cond_signal(&spool->writer_cond));
+	ON_MUTEX_ERR(pthread_mutex_unlock(&spool->guard));
+	ON_MUTEX_ERR(pthread_join(spool->writer, NULL));
+	ON_MUTEX_ERR(pthread_cond_destroy(&spool->space_cond));
+	ON_MUTEX_ERR(pthread_cond_destroy(&spool->writer_cond));
+	ON_MUTEX_ERR(pthread_mutex_destroy(&spool->guard));
+	free(spool->directory);
+	free(spool);
+}
+
+void
+eviction_spool_push(struct EvictionSpool *spool, struct File *files, unsigned count)
+{
+	if (count == 0) {
+		free(files);
+		return;
+	}
+	struct EvictionSpoolBatch *batch = xmalloc(sizeof(struct EvictionSpoolBatch));
+	batch->files = files;
+	batch->count = count;
+	batch->size_in_bytes = 0;
+	batch->next = NULL;
+	for (unsigned i = 0; i < count; i++) {
+		batch->size_in_bytes += files[i].contents->length_in_bytes;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&spool->guard));
+	/* A single batch always goes through, no matter how big. */
+	while (spool->queued_bytes > 0 &&
+	       spool->queued_bytes + batch->size_in_bytes > EVICTION_SPOOL_MAX_QUEUED_BYTES) {
+		ON_MUTEX_ERR(pthread_cond_wait(&spool->space_cond, &spool->guard));
+	}
+	if (spool->queue_tail) {
+		spool->queue_tail->next = batch;
+	} else {
+		spool->queue_head = batch;
+	}
+	spool->queue_tail = batch;
+	__atomic_fetch_add(&spool->queued_count, count, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&spool->queued_bytes, batch->size_in_bytes, __ATOMIC_RELAXED);
+	ON_MUTEX_ERR(pthread_cond_signal(&spool->writer_cond));
+	ON_MUTEX_ERR(pthread_mutex_unlock(&spool->guard));
+}
+
+void
+eviction_spool_stats(const struct EvictionSpool *spool, struct EvictionSpoolStats *stats)
+{
+	stats->queued_count = __atomic_load_n(&spool->queued_count, __ATOMIC_RELAXED);
+	stats->queued_bytes = __atomic_load_n(&spool->queued_bytes, __ATOMIC_RELAXED);
+	stats->spooled = __atomic_load_n(&spool->spooled, __ATOMIC_RELAXED);
+	stats->failures = __atomic_load_n(&spool->failures, __ATOMIC_RELAXED);
+}
+
+/************ WRITER ***********/
+
+/* Writes the oldest batch outside of the lock, then frees it. */
+static void
+writer_flush_one_locked(struct EvictionSpool *spool)
+{
+	struct EvictionSpoolBatch *batch = spool->queue_head;
+	spool->queue_head = batch->next;
+	if (!spool->queue_head) {
+		spool->queue_tail = NULL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&spool->guard));
+	for (unsigned i = 0; i < batch->count; i++) {
+		if (spool_write_file(spool, &batch->files[i]) < 0) {
+			glog_error("Couldn't write the evicted file '%s' to the spool (errno %d). "
+			           "It's lost.",
+			           batch->files[i].key,
+			           errno);
+			__atomic_fetch_add(&spool->failures, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_add(&spool->spooled, 1, __ATOMIC_RELAXED);
+		}
+	}
+	htable_free_evicted(batch->files, batch->count);
+	ON_MUTEX_ERR(pthread_mutex_lock(&spool->guard));
+	__atomic_fetch_sub(&spool->queued_count, batch->count, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&spool->queued_bytes, batch->size_in_bytes, __ATOMIC_RELAXED);
+	free(batch);
+	ON_MUTEX_ERR(pthread_cond_broadcast(&spool->space_cond));
+}
+
+static void *
+eviction_spool_writer_entry_point(void *args)
+{
+	struct EvictionSpool *spool = args;
+	ON_MUTEX_ERR(pthread_mutex_lock(&spool->guard));
+	/* Evicted files exist nowhere else, so the queue is drained before exiting. */
+	while (spool->queue_head || !spool->writer_stop) {
+		if (!spool->queue_head) {
+			ON_MUTEX_ERR(pthread_cond_wait(&spool->writer_cond, &spool->guard));
+			continue;
+		}
+		writer_flush_one_locked(spool);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&spool->guard));
+	return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef SOL_SERVER_EVICTION_SPOOL
+#define SOL_SERVER_EVICTION_SPOOL
+
+#include "htable.h"
+#include <stdlib.h>
+
+/* A server-side destination for evicted files, so that writers don't have to
+ * wait for them to be sent over. A background thread writes each file to its
+ * own file within a directory, named after its percent-encoded path, where
+ * some other process can pick it up. Thread-safe. */
+struct EvictionSpool;
+
+struct EvictionSpoolStats
+{
+	/* Files that are still waiting for the background thread. */
+	size_t queued_count;
+	size_t queued_bytes;
+	long unsigned spooled;
+	long unsigned failures;
+};
+
+/* Creates an empty spool that writes files within `directory`, which is
+ * created if missing. Returns NULL on system errors. */
+struct EvictionSpool *
+eviction_spool_create(const char *directory);
+
+/* Writes all files that are still queued, then stops the background thread and
+ * deletes `spool`. */
+void
+eviction_spool_free(struct EvictionSpool *spool);
+
+/* Queues `count` evicted files for `spool`, which takes over `files` as they
+ * come out of `htable_evict_files`. It blocks while too many bytes are already
+ * waiting for the disk. */
+void
+eviction_spool_push(struct EvictionSpool *spool, struct File *files, unsigned count);
+
+void
+eviction_spool_stats(const struct EvictionSpool *spool, struct EvictionSpoolStats *stats);
+
+#endif
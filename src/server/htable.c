@@ -1,10 +1,21 @@
 #include "htable.h"
+#include "blob.h"
+#include "compressed_tier.h"
 #include "config.h"
+#include "epoch.h"
+#include "eviction_spool.h"
 #include "global_state.h"
+#include "htable_index.h"
+#include "htable_policy.h"
 #include "server_utilities.h"
+#include "sketch.h"
+#include "slab.h"
+#include "spill_tier.h"
 #include "utilities.h"
 #include "xxHash/xxhash.h"
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,80 +23,223 @@
 
 #define XXHASH_SEED 0
 
+/* Statistics are split into a few shards, so that workers never contend on the
+ * same cache line. Threads are assigned to shards in a round-robin fashion. */
+#define HTABLE_STATS_SHARDS 32
+
+/* The background evictor releases `eviction_guard` after this many files, so
+ * that writers past the hard limits don't wait for long. */
+#define HTABLE_EVICTOR_BATCH_SIZE 32
+
+/* The admission window holds this fraction of the maximum number of files. */
+#define HTABLE_ADMISSION_WINDOW_FRACTION 100
+
 #define ON_MUTEX_ERR(err)                                                                  \
 	ON_ERR((err), "Unexpected mutex error during hash table internal manipulation.")
 
+/* Poor man's `_Static_assert`, which C99 doesn't have. */
+typedef char htable_item_fits_three_cache_lines[sizeof(struct HTableItem) <= 192 ? 1 : -1];
+
 struct Fifo;
 
-struct Fifo *
+static struct Fifo *
 fifo_create(struct HTable *htable);
 
-void
+static void
 fifo_free(struct Fifo *fifo);
 
-void
-fifo_add_file(struct Fifo *fifo, const char *key);
+static void
+fifo_add_file(struct Fifo *fifo, const struct HTableKey *key);
 
-enum HTableError
+static void
+htable_window_graduate(struct HTable *htable, const struct HTableStats *stats);
+
+static enum HTableError
 htable_evict_files(struct HTable *htable, struct File **evicted, unsigned *evicted_count);
 
-struct HTableItem
-{
-	struct File file;
-	struct HTableItem *next;
-	struct HTableItem *prev;
-};
+static void
+htable_evictor_spawn(struct HTable *htable, const struct Config *config);
+
+static void
+htable_evictor_join(struct HTable *htable);
 
-struct HTableBucket
+/* Counters within a shard are deltas, so they can temporarily go below zero
+ * when, e.g., a file is created on a shard and removed on another. Only their
+ * sum over all shards is meaningful. */
+struct HTableStatsShard
 {
-	pthread_mutex_t guard;
-	struct HTableItem *head;
-	struct HTableItem *last;
-};
+	int64_t items_count;
+	int64_t open_count;
+	int64_t spared_count;
+	int64_t space_in_bytes;
+	uint64_t num_evictions;
+	uint64_t read_hits;
+	uint64_t read_misses;
+	uint64_t admission_rejections;
+} __attribute__((aligned(64)));
 
 struct HTable
 {
 	/* Settings. */
 	size_t max_items_count;
 	size_t max_space_in_bytes;
-	enum CacheEvictionPolicy policy;
-	struct Fifo *fifo;
+	bool deduplication;
+	bool compression;
+	const struct HTablePolicyOps *policy_ops;
+	void *policy;
+	/* Only set if the admission filter is enabled. Newly created files enter
+	 * the cache through `window`, in FIFO order, and then have to beat
+	 * eviction victims in popularity (as estimated by `sketch`) to stay. */
+	struct Sketch *sketch;
+	struct Fifo *window;
+	size_t window_count;
+	size_t window_capacity;
+	/* Only set if the compressed tier is enabled. Eviction victims go there
+	 * first, and only overflowing ones are handed to writers. */
+	struct CompressedTier *tier;
+	/* Only set if the spill tier is enabled. Files that would otherwise leave
+	 * the server go there, and they only do once it overflows. */
+	struct SpillTier *spill;
+	/* Only set if evicted files are spooled. Writers push their own victims,
+	 * and those evicted without a writer go straight there. */
+	struct EvictionSpool *spool;
 	/* Internal data. */
-	pthread_mutex_t stats_guard;
-	struct HTableStats stats;
-	size_t buckets_count;
-	struct HTableBucket *buckets;
+	struct HTableStatsShard stats[HTABLE_STATS_SHARDS];
+	size_t historical_max_items_count;
+	size_t historical_max_space_in_bytes;
+	/* Only one thread at a time runs the cache replacement policy. */
+	pthread_mutex_t eviction_guard;
+	/* Only used if background eviction is enabled. The evictor sleeps on
+	 * `evictor_cond` until writers go past the high watermarks, which are in
+	 * number of files and bytes just like the hard limits. Files it evicts go
+	 * to the spool, so it only runs if there's one. */
+	bool evictor_is_running;
+	size_t high_watermark_items_count;
+	size_t high_watermark_space_in_bytes;
+	size_t low_watermark_items_count;
+	size_t low_watermark_space_in_bytes;
+	pthread_t evictor;
+	pthread_mutex_t evictor_guard;
+	pthread_cond_t evictor_cond;
+	bool evictor_wanted;
+	bool evictor_stop;
+	const struct HTableIndexOps *ops;
+	void *index;
 };
 
+static unsigned stats_shards_assigned = 0;
+static __thread struct HTableStatsShard *thread_stats_shard_cache = NULL;
+static __thread const struct HTable *thread_stats_shard_owner = NULL;
+static __thread unsigned thread_stats_shard_i = HTABLE_STATS_SHARDS;
+
+static void
+subscribers_free(struct Subscriber *sub)
+{
+	while (sub) {
+		struct Subscriber *next = sub->next;
+		slab_free(sub, sizeof(struct Subscriber));
+		sub = next;
+	}
+}
+
+void
+htable_item_free(void *ptr)
+{
+	struct HTableItem *item = ptr;
+	blob_unref(item->file.contents);
+	if (item->file.key != item->key_inline) {
+		slab_free(item->file.key, item->key_len + 1);
+	}
+	subscribers_free(item->file.subs);
+	slab_free(item, sizeof(struct HTableItem));
+}
+
 struct HTable *
 htable_create(size_t buckets, const struct Config *config)
 {
 	assert(buckets > 0);
 	struct HTable *htable = xmalloc(sizeof(struct HTable));
-	ON_MUTEX_ERR(pthread_mutex_init(&htable->stats_guard, NULL));
+	ON_MUTEX_ERR(pthread_mutex_init(&htable->eviction_guard, NULL));
 
 	htable->max_items_count = config->max_files;
 	htable->max_space_in_bytes = config->max_storage_in_bytes;
-	htable->policy = config->cache_eviction_policy;
-
-	/* We only create a FIFO if the cache eviction policy says to. */
-	htable->fifo = NULL;
-	if (htable->policy == CACHE_EVICTION_POLICY_FIFO) {
-		htable->fifo = fifo_create(htable);
-	}
-
-	htable->stats.items_count = 0;
-	htable->stats.open_count = 0;
-	htable->stats.total_space_in_bytes = 0;
-	htable->stats.historical_max_items_count = 0;
-	htable->stats.historical_max_space_in_bytes = 0;
-	htable->stats.historical_num_evictions = 0;
-	htable->buckets_count = buckets;
-	htable->buckets = xmalloc(sizeof(struct HTableBucket) * buckets);
-	for (size_t i = 0; i < buckets; i++) {
-		htable->buckets[i].head = NULL;
-		htable->buckets[i].last = NULL;
-		ON_MUTEX_ERR(pthread_mutex_init(&htable->buckets[i].guard, NULL));
+	htable->deduplication = config->deduplication;
+	htable->compression = config->compression;
+	blob_set_inline_threshold(config->inline_threshold_in_bytes);
+
+	htable->sketch = NULL;
+	htable->window = NULL;
+	htable->window_count = 0;
+	htable->window_capacity = htable->max_items_count / HTABLE_ADMISSION_WINDOW_FRACTION;
+	if (htable->window_capacity == 0) {
+		htable->window_capacity = 1;
+	}
+	if (config->admission_filter) {
+		htable->sketch = sketch_create(htable->max_items_count);
+		htable->window = fifo_create(htable);
+	}
+	htable->tier = NULL;
+	if (config->compressed_tier_in_bytes > 0) {
+		htable->tier = compressed_tier_create(config->compressed_tier_in_bytes);
+	}
+	htable->spill = NULL;
+	if (config->spill_directory) {
+		htable->spill =
+		  spill_tier_create(config->spill_directory, config->spill_max_size_in_bytes);
+		if (!htable->spill) {
+			glog_fatal("Couldn't set up the spill tier.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	htable->spool = NULL;
+	if (config->eviction_spool_directory) {
+		htable->spool = eviction_spool_create(config->eviction_spool_directory);
+		if (!htable->spool) {
+			glog_fatal("Couldn't set up the eviction spool.");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memset(htable->stats, 0, sizeof(htable->stats));
+	htable->historical_max_items_count = 0;
+	htable->historical_max_space_in_bytes = 0;
+
+	if (config->htable_backend == HTABLE_BACKEND_SWISS) {
+		htable->ops = &htable_swiss_ops;
+	} else {
+		htable->ops = &htable_chained_ops;
+	}
+	htable->index = htable->ops->create(buckets);
+	switch (config->cache_eviction_policy) {
+	case CACHE_EVICTION_POLICY_SEGMENTED_FIFO:
+		htable->policy_ops = &policy_segmented_fifo_ops;
+		break;
+	case CACHE_EVICTION_POLICY_LRU:
+		htable->policy_ops = &policy_lru_ops;
+		break;
+	case CACHE_EVICTION_POLICY_CLOCK:
+		htable->policy_ops = &policy_clock_ops;
+		break;
+	case CACHE_EVICTION_POLICY_S3_FIFO:
+		htable->policy_ops = &policy_s3fifo_ops;
+		break;
+	case CACHE_EVICTION_POLICY_GDSF:
+		htable->policy_ops = &policy_gdsf_ops;
+		break;
+	default:
+		htable->policy_ops = &policy_fifo_ops;
+		break;
+	}
+	htable->policy = htable->policy_ops->create(htable, htable->max_items_count);
+
+	ON_MUTEX_ERR(pthread_mutex_init(&htable->evictor_guard, NULL));
+	htable->evictor_is_running = false;
+	if (config->background_eviction && !htable->spool) {
+		/* Writers only get back the files that their own writes evict. */
+		glog_warn("Background eviction needs an eviction spool. Files will be evicted "
+		          "during writes instead.");
+	} else if (config->background_eviction) {
+		htable_evictor_spawn(htable, config);
 	}
 	return htable;
 }
@@ -96,66 +250,186 @@ htable_free(struct HTable *htable)
 	if (!htable) {
 		return;
 	}
-	for (size_t i = 0; i < htable->buckets_count; i++) {
-		struct HTableItem *item = htable->buckets[i].head;
-		while (item) {
-			free(item->file.contents);
-			free(item->file.key);
-			struct Subscriber *sub = item->file.subs;
-			while (sub) {
-				struct Subscriber *next = sub->next;
-				free(sub);
-				sub = next;
-			}
-			struct HTableItem *next = item->next;
-			free(item);
-			item = next;
-		}
-	}
-	ON_MUTEX_ERR(pthread_mutex_destroy(&htable->stats_guard));
+	htable_evictor_join(htable);
+	/* Evicted files that are still queued get written first. */
+	eviction_spool_free(htable->spool);
+	ON_MUTEX_ERR(pthread_mutex_destroy(&htable->evictor_guard));
+	htable->ops->free(htable->index);
+	ON_MUTEX_ERR(pthread_mutex_destroy(&htable->eviction_guard));
 	glog_info(
 	  "Destroying the hash table at %p. Its maximum size was %zu bytes and %zu items.",
 	  htable,
-	  htable->stats.historical_max_space_in_bytes,
-	  htable->stats.historical_max_items_count);
-	free(htable->buckets);
-	fifo_free(htable->fifo);
+	  htable->historical_max_space_in_bytes,
+	  htable->historical_max_items_count);
+	htable->policy_ops->free(htable->policy);
+	fifo_free(htable->window);
+	sketch_free(htable->sketch);
+	compressed_tier_free(htable->tier);
+	spill_tier_free(htable->spill);
 	free(htable);
 }
 
 /************ INTERNAL HTABLE UTILITIES ***********/
 
-/* Returns a pointer to the bucket within `htable` that contains `key`, if
- * present at all. */
-static struct HTableBucket *
-htable_bucket_ptr(struct HTable *htable, const char *key)
+struct HTableKey
+htable_key(const void *ptr, size_t len)
 {
-	uint64_t hash = XXH64(key, strlen(key), XXHASH_SEED);
-	return &htable->buckets[hash % htable->buckets_count];
+	struct HTableKey key;
+	key.ptr = ptr;
+	key.len = len;
+	key.hash = XXH64(ptr, len, XXHASH_SEED);
+	return key;
 }
 
-/* Locks the bucket within `htable` that contains `key` and returns a pointer to
- * its associated item, if present. Returns NULL for unsuccessful searches. The
- * bucket must be unlocked after this call. */
-struct HTableItem *
-htable_fetch_item(struct HTable *htable, const char *key)
+/* Returns the statistics shard of the calling thread. */
+static struct HTableStatsShard *
+htable_stats_shard(struct HTable *htable)
 {
-	struct HTableBucket *bucket = htable_bucket_ptr(htable, key);
-	ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
-	struct HTableItem *item = bucket->head;
-	while (item) {
-		assert(item->file.key);
-		if (strcmp(item->file.key, key) == 0) {
-			return item;
+	if (thread_stats_shard_owner != htable) {
+		if (thread_stats_shard_i == HTABLE_STATS_SHARDS) {
+			thread_stats_shard_i =
+			  __atomic_fetch_add(&stats_shards_assigned, 1, __ATOMIC_RELAXED) %
+			  HTABLE_STATS_SHARDS;
 		}
-		item = item->next;
+		thread_stats_shard_cache = &htable->stats[thread_stats_shard_i];
+		thread_stats_shard_owner = htable;
 	}
-	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
-	return NULL;
+	return thread_stats_shard_cache;
+}
+
+/* Counters are only ever aggregated, so there's no need for any ordering
+ * guarantees. */
+static void
+stats_add(int64_t *counter, int64_t delta)
+{
+	__atomic_fetch_add(counter, delta, __ATOMIC_RELAXED);
+}
+
+/* Locks the portion of the index of `htable` that is responsible for `hash`. It
+ * must be unlocked with `htable_unlock`. */
+static void
+htable_lock(struct HTable *htable, uint64_t hash)
+{
+	/* Keeps the index from freeing its internals under our feet. */
+	epoch_enter();
+	htable->ops->lock(htable->index, hash);
+}
+
+static void
+htable_unlock(struct HTable *htable, uint64_t hash)
+{
+	htable->ops->unlock(htable->index, hash);
+	epoch_exit();
+}
+
+/* Files might share their contents, which only count once towards the storage
+ * limit: the first file to refer to them pays for all. These return how much
+ * storage space changes when a file starts or stops referring to `blob`. */
+static int64_t
+space_hold(struct Blob *blob)
+{
+	return blob_hold(blob) ? (int64_t)blob_storage_size(blob) : 0;
+}
+
+static int64_t
+space_release(struct Blob *blob)
+{
+	return blob_release(blob) ? -(int64_t)blob_storage_size(blob) : 0;
+}
+
+/* Replaces the contents of `item`, which must be locked, with `blob`.
+ * Whoever pinned the old contents can keep using them. Returns the change in
+ * storage space. */
+static int64_t
+item_set_contents(struct HTableItem *item, struct Blob *blob)
+{
+	struct Blob *old = item->file.contents;
+	int64_t delta = space_hold(blob) + space_release(old);
+	EPOCH_STORE(item->file.contents, blob);
+	blob_unref(old);
+	return delta;
+}
+
+/* Acquires a reference to the contents of `item` without locking it.
+ * The caller must be within an epoch. */
+static struct Blob *
+item_pin_contents(struct HTableItem *item)
+{
+	while (true) {
+		struct Blob *blob = EPOCH_LOAD(item->file.contents);
+		/* It only fails if a writer has just replaced it, so reading it again
+		 * will give us the new one. */
+		if (blob_try_ref(blob)) {
+			return blob;
+		}
+	}
+}
+
+/* Records an access to `item` for the cache eviction policy. The caller must be
+ * within an epoch, but `item` needn't be locked. */
+static void
+htable_touch_item(struct HTable *htable, struct HTableItem *item)
+{
+	if (htable->sketch) {
+		sketch_increment(htable->sketch, item->hash);
+	}
+	htable->policy_ops->on_access(htable->policy, item);
+}
+
+/* Same as `htable_touch_item`, but for writes to `item`, which must be
+ * locked. */
+static void
+htable_update_item(struct HTable *htable, struct HTableItem *item)
+{
+	if (htable->sketch) {
+		sketch_increment(htable->sketch, item->hash);
+	}
+	htable->policy_ops->on_update(htable->policy, item);
+}
+
+/* Returns a new item for the file with path `key` and the given contents, which
+ * it takes over. The file is closed, unlocked, and not in `htable` yet. */
+static struct HTableItem *
+htable_item_create(const struct HTableKey *key, struct Blob *contents)
+{
+	struct HTableItem *item = slab_alloc(sizeof(struct HTableItem));
+	item->file.fd_owner = -1;
+	item->file.is_locked = false;
+	item->file.is_open = false;
+	item->file.is_pinned = false;
+	/* We keep it NUL-terminated for convenience. */
+	if (key->len < HTABLE_INLINE_KEY_SIZE) {
+		memcpy(item->key_inline, key->ptr, key->len);
+		item->key_inline[key->len] = '\0';
+		item->file.key = item->key_inline;
+	} else {
+		item->file.key = slab_strndup(key->ptr, key->len);
+	}
+	item->key_len = key->len;
+	item->file.contents = contents;
+	item->file.subs = NULL;
+	item->hash = key->hash;
+	memset(&item->policy, 0, sizeof(item->policy));
+	return item;
+}
+
+/* Locks the portion of `htable` that contains `key` and returns a pointer to its
+ * associated item, if present. Returns NULL for unsuccessful searches, in which
+ * case nothing is locked. Otherwise, `htable_unlock(htable, item->hash)` must
+ * be called afterwards. */
+static struct HTableItem *
+htable_fetch_item(struct HTable *htable, const struct HTableKey *key)
+{
+	htable_lock(htable, key->hash);
+	struct HTableItem *item = htable->ops->find_locked(htable->index, key);
+	if (!item) {
+		htable_unlock(htable, key->hash);
+	}
+	return item;
 }
 
 struct File *
-htable_fetch_file(struct HTable *htable, const char *key)
+htable_fetch_file(struct HTable *htable, const struct HTableKey *key)
 {
 	struct HTableItem *node = htable_fetch_item(htable, key);
 	if (!node) {
@@ -164,46 +438,143 @@ htable_fetch_file(struct HTable *htable, const char *key)
 	return &node->file;
 }
 
-/* Frees the bucket within `htable` that contains `key`. */
 void
-htable_release_file(struct HTable *htable, const char *key)
+htable_release_file(struct HTable *htable, const struct HTableKey *key)
 {
-	struct HTableBucket *bucket = htable_bucket_ptr(htable, key);
-	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+	htable_unlock(htable, key->hash);
 }
 
-void
-htable_stats_lock(struct HTable *htable)
+/************ LOCK-FREE READS ***********/
+
+static struct Blob *
+htable_promote_file(
+  struct HTable *htable, const struct HTableKey *key, bool open, int fd, bool lock);
+
+struct Blob *
+htable_pin_file(struct HTable *htable, const struct HTableKey *key)
 {
-	ON_MUTEX_ERR(pthread_mutex_lock(&htable->stats_guard));
+	struct Blob *blob = NULL;
+	epoch_enter();
+	struct HTableItem *item = htable->ops->find(htable->index, key);
+	if (item) {
+		blob = item_pin_contents(item);
+		htable_touch_item(htable, item);
+	}
+	epoch_exit();
+	if (!blob && (htable->tier || htable->spill)) {
+		blob = htable_promote_file(htable, key, false, -1, false);
+	}
+	struct HTableStatsShard *shard = htable_stats_shard(htable);
+	__atomic_fetch_add(blob ? &shard->read_hits : &shard->read_misses, 1, __ATOMIC_RELAXED);
+	return blob;
 }
 
-void
-htable_stats_unlock(struct HTable *htable)
+/* Gives the index of `htable` a chance to grow or shrink. It's meant to be
+ * called after every operation that changes the number of items, and it must be
+ * called without holding any lock. */
+static void
+htable_maintain(struct HTable *htable)
 {
-	ON_MUTEX_ERR(pthread_mutex_unlock(&htable->stats_guard));
+	struct HTableStats stats;
+	htable_stats_snapshot(htable, &stats);
+	htable->ops->maintain(htable->index, stats.items_count);
+}
+
+/* Atomically raises `*max` to `val`, unless it's already higher. */
+static void
+stats_update_max(size_t *max, size_t val)
+{
+	size_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while (val > current &&
+	       !__atomic_compare_exchange_n(
+	         max, &current, val, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/* Aggregates all shards into `stats` and records any new historical maxima.
+ * Historical maxima are thus only as accurate as the sampling, which happens
+ * after every operation that might grow the hash table. */
+static void
+htable_stats_sample(struct HTable *htable, struct HTableStats *stats)
+{
+	htable_stats_snapshot(htable, stats);
+	stats_update_max(&htable->historical_max_items_count, stats->items_count);
+	stats_update_max(&htable->historical_max_space_in_bytes, stats->total_space_in_bytes);
 }
 
 /************ HIGH LEVEL APIS ***********/
 
-const struct HTableStats *
-htable_stats(const struct HTable *htable)
+void
+htable_stats_snapshot(const struct HTable *htable, struct HTableStats *stats)
 {
-	return &htable->stats;
+	int64_t items_count = 0;
+	int64_t open_count = 0;
+	int64_t spared_count = 0;
+	int64_t space_in_bytes = 0;
+	uint64_t num_evictions = 0;
+	uint64_t read_hits = 0;
+	uint64_t read_misses = 0;
+	uint64_t admission_rejections = 0;
+	for (unsigned i = 0; i < HTABLE_STATS_SHARDS; i++) {
+		const struct HTableStatsShard *shard = &htable->stats[i];
+		items_count += __atomic_load_n(&shard->items_count, __ATOMIC_RELAXED);
+		open_count += __atomic_load_n(&shard->open_count, __ATOMIC_RELAXED);
+		spared_count += __atomic_load_n(&shard->spared_count, __ATOMIC_RELAXED);
+		space_in_bytes += __atomic_load_n(&shard->space_in_bytes, __ATOMIC_RELAXED);
+		num_evictions += __atomic_load_n(&shard->num_evictions, __ATOMIC_RELAXED);
+		read_hits += __atomic_load_n(&shard->read_hits, __ATOMIC_RELAXED);
+		read_misses += __atomic_load_n(&shard->read_misses, __ATOMIC_RELAXED);
+		admission_rejections +=
+		  __atomic_load_n(&shard->admission_rejections, __ATOMIC_RELAXED);
+	}
+	/* Shards are read one after the other while other threads keep updating
+	 * them, so sums might be briefly off (even below zero). */
+	stats->items_count = items_count > 0 ? (size_t)items_count : 0;
+	stats->open_count = open_count > 0 ? (size_t)open_count : 0;
+	stats->spared_count = spared_count > 0 ? (size_t)spared_count : 0;
+	stats->total_space_in_bytes = space_in_bytes > 0 ? (size_t)space_in_bytes : 0;
+	stats->historical_num_evictions = num_evictions;
+	stats->read_hits = read_hits;
+	stats->read_misses = read_misses;
+	stats->admission_rejections = admission_rejections;
+	stats->historical_max_items_count =
+	  __atomic_load_n(&htable->historical_max_items_count, __ATOMIC_RELAXED);
+	stats->historical_max_space_in_bytes =
+	  __atomic_load_n(&htable->historical_max_space_in_bytes, __ATOMIC_RELAXED);
+	struct CompressedTierStats tier = { 0 };
+	if (htable->tier) {
+		compressed_tier_stats(htable->tier, &tier);
+	}
+	stats->tier_items_count = tier.items_count;
+	stats->tier_space_in_bytes = tier.space_in_bytes;
+	stats->tier_promotions = tier.promotions;
+	stats->tier_overflows = tier.overflows;
+	struct SpillTierStats spill = { 0 };
+	if (htable->spill) {
+		spill_tier_stats(htable->spill, &spill);
+	}
+	stats->spill_items_count = spill.items_count;
+	stats->spill_space_in_bytes = spill.space_in_bytes;
+	stats->spill_promotions = spill.promotions;
+	stats->spill_overflows = spill.overflows;
 }
 
 enum HTableError
-htable_lock_file(struct HTable *htable, const char *key, int fd)
+htable_lock_file(struct HTable *htable, const struct HTableKey *key, int fd)
 {
 	struct File *file = htable_fetch_file(htable, key);
 	if (!file) {
 		return HTABLE_ERR_FILE_NOT_FOUND;
 	} else if (file->is_locked) {
-		struct Subscriber *sub = xmalloc(sizeof(struct Subscriber));
+		bool was_spared = htable_file_is_spared(file);
+		struct Subscriber *sub = slab_alloc(sizeof(struct Subscriber));
 		sub->fd = fd;
 		sub->next = file->subs;
 		file->subs = sub;
 		htable_release_file(htable, key);
+		if (!was_spared) {
+			stats_add(&htable_stats_shard(htable)->spared_count, 1);
+		}
 		return HTABLE_ERR_OK_WAIT;
 	} else {
 		/* It looks like the file is not currently locked. */
@@ -216,7 +587,7 @@ htable_lock_file(struct HTable *htable, const char *key, int fd)
 }
 
 enum HTableError
-htable_unlock_file(struct HTable *htable, const char *key, int fd, int *new_owner_of_lock)
+htable_unlock_file(struct HTable *htable, const struct HTableKey *key, int fd, int *new_owner_of_lock)
 {
 	*new_owner_of_lock = -1;
 	struct File *file = htable_fetch_file(htable, key);
@@ -232,23 +603,66 @@ htable_unlock_file(struct HTable *htable, const char *key, int fd, int *new_owne
 		file->is_locked = false;
 
 		struct Subscriber *sub = file->subs;
+		bool is_unspared = false;
 		if (sub) {
 			file->subs = sub->next;
 			file->is_locked = true;
 			file->fd_owner = sub->fd;
 			*new_owner_of_lock = sub->fd;
-			free(sub);
+			slab_free(sub, sizeof(struct Subscriber));
+			is_unspared = !htable_file_is_spared(file);
 		}
 
 		htable_release_file(htable, key);
+		if (is_unspared) {
+			stats_add(&htable_stats_shard(htable)->spared_count, -1);
+		}
 		return HTABLE_ERR_OK;
 	}
 }
 
 enum HTableError
-htable_open_file(struct HTable *htable, const char *key, int fd, bool lock)
+htable_set_file_pinned(struct HTable *htable,
+                       const struct HTableKey *key,
+                       int fd,
+                       bool pinned)
 {
 	struct File *file = htable_fetch_file(htable, key);
+	if (!file) {
+		return HTABLE_ERR_FILE_NOT_FOUND;
+	} else if (file->is_locked && file->fd_owner != fd) {
+		htable_release_file(htable, key);
+		return HTABLE_ERR_CANT_PIN;
+	} else if (file->is_pinned == pinned) {
+		htable_release_file(htable, key);
+		return pinned ? HTABLE_ERR_ALREADY_PINNED : HTABLE_ERR_ALREADY_UNPINNED;
+	} else {
+		bool was_spared = htable_file_is_spared(file);
+		file->is_pinned = pinned;
+		bool is_spared = htable_file_is_spared(file);
+		htable_release_file(htable, key);
+
+		if (was_spared != is_spared) {
+			stats_add(&htable_stats_shard(htable)->spared_count, pinned ? 1 : -1);
+		}
+
+		return HTABLE_ERR_OK;
+	}
+}
+
+static enum HTableError
+htable_open_file(struct HTable *htable, const struct HTableKey *key, int fd, bool lock)
+{
+	struct File *file = htable_fetch_file(htable, key);
+	if (!file && (htable->tier || htable->spill)) {
+		struct Blob *contents = htable_promote_file(htable, key, true, fd, lock);
+		if (contents) {
+			blob_unref(contents);
+			return HTABLE_ERR_OK;
+		}
+		/* It might have been created again in the meantime. */
+		file = htable_fetch_file(htable, key);
+	}
 	if (!file) {
 		return HTABLE_ERR_FILE_NOT_FOUND;
 	} else if (file->is_open) {
@@ -258,68 +672,137 @@ htable_open_file(struct HTable *htable, const char *key, int fd, bool lock)
 		htable_release_file(htable, key);
 		return HTABLE_ERR_CANT_OPEN;
 	} else {
+		bool was_spared = htable_file_is_spared(file);
 		file->is_open = true;
 		file->is_locked = lock;
 		file->fd_owner = fd;
 		htable_release_file(htable, key);
 
-		htable_stats_lock(htable);
-		htable->stats.open_count++;
-		htable_stats_unlock(htable);
+		struct HTableStatsShard *shard = htable_stats_shard(htable);
+		stats_add(&shard->open_count, 1);
+		if (!was_spared) {
+			stats_add(&shard->spared_count, 1);
+		}
 
 		return HTABLE_ERR_OK;
 	}
 }
 
-enum HTableError
-htable_create_file(struct HTable *htable, const char *key, int fd, bool lock)
+static enum HTableError
+htable_create_file(struct HTable *htable, const struct HTableKey *key, int fd, bool lock)
 {
-	if (htable_fetch_item(htable, key)) {
-		htable_release_file(htable, key);
+	/* The lookup and the insertion must happen under the same lock, otherwise
+	 * two clients might both create the same file. */
+	htable_lock(htable, key->hash);
+	if (htable->ops->find_locked(htable->index, key)) {
+		htable_unlock(htable, key->hash);
 		return HTABLE_ERR_ALREADY_CREATED;
 	}
 
-	struct HTableBucket *bucket = htable_bucket_ptr(htable, key);
-	struct HTableItem *item = xmalloc(sizeof(struct HTableItem));
-
+	struct HTableItem *item = htable_item_create(key, blob_create(NULL, 0));
 	item->file.fd_owner = fd;
 	item->file.is_locked = lock;
 	item->file.is_open = true;
-	item->file.key = xmalloc(strlen(key) + 1);
-	strcpy(item->file.key, key);
-	item->file.length_in_bytes = 0;
-	item->file.contents = NULL;
-	item->file.subs = NULL;
-	item->next = bucket->head;
-	item->prev = NULL;
-
-	ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
-	if (bucket->head) {
-		bucket->head->prev = item;
+	space_hold(item->file.contents);
+	htable->ops->insert(htable->index, item);
+	/* Items must enter the cache eviction policy under the same lock, or they
+	 * might be removed in between. */
+	htable->policy_ops->on_insert(htable->policy, item);
+	htable_unlock(htable, key->hash);
+
+	/* Any older copy within the lower tiers is stale now. */
+	if (htable->tier) {
+		compressed_tier_drop(htable->tier, key);
 	}
-	if (!bucket->last) {
-		bucket->last = item;
+	if (htable->spill) {
+		spill_tier_drop(htable->spill, key);
 	}
-	bucket->head = item;
-	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+	if (htable->window) {
+		sketch_increment(htable->sketch, key->hash);
+		fifo_add_file(htable->window, key);
+		__atomic_fetch_add(&htable->window_count, 1, __ATOMIC_RELAXED);
+	}
+	struct HTableStatsShard *shard = htable_stats_shard(htable);
+	stats_add(&shard->open_count, 1);
+	stats_add(&shard->spared_count, 1);
+	stats_add(&shard->items_count, 1);
 
-	htable_stats_lock(htable);
-	htable->stats.open_count++;
-	htable->stats.items_count++;
-	if (htable->stats.items_count > htable->stats.historical_max_items_count) {
-		htable->stats.historical_max_items_count = htable->stats.items_count;
+	struct HTableStats stats;
+	htable_stats_sample(htable, &stats);
+	if (htable->window) {
+		htable_window_graduate(htable, &stats);
 	}
-	if (htable->policy == CACHE_EVICTION_POLICY_FIFO) {
-		fifo_add_file(htable->fifo, key);
+	htable->ops->maintain(htable->index, stats.items_count);
+	return HTABLE_ERR_OK;
+}
+
+static void
+htable_evict_for_promotion(struct HTable *htable);
+
+/* Moves the file with path `key` from the compressed tier or the spill tier
+ * back into `htable`, opened by `fd` if `open` is set, and returns a new
+ * reference to its contents. Returns NULL if neither tier has it, or if the file
+ * was created again in the meantime, in which case the old copy is simply
+ * dropped. */
+static struct Blob *
+htable_promote_file(
+  struct HTable *htable, const struct HTableKey *key, bool open, int fd, bool lock)
+{
+	struct Blob *blob = NULL;
+	if (htable->tier) {
+		blob = compressed_tier_take(htable->tier, key);
+	}
+	if (!blob && htable->spill) {
+		blob = spill_tier_take(htable->spill, key, htable->compression);
+	}
+	if (!blob) {
+		return NULL;
+	} else if (!htable->compression) {
+		/* Reads would otherwise pay for decompression every time. */
+		struct Blob *stored = blob;
+		blob = blob_uncompressed(stored);
+		blob_unref(stored);
 	}
-	htable_stats_unlock(htable);
 
-	return HTABLE_ERR_OK;
+	htable_lock(htable, key->hash);
+	if (htable->ops->find_locked(htable->index, key)) {
+		htable_unlock(htable, key->hash);
+		blob_unref(blob);
+		return NULL;
+	}
+	struct HTableItem *item = htable_item_create(key, blob);
+	if (open) {
+		/* Open files are spared, so it can't be evicted again right away. */
+		item->file.is_open = true;
+		item->file.is_locked = lock;
+		item->file.fd_owner = fd;
+	}
+	int64_t space_delta = space_hold(blob);
+	blob_ref(blob);
+	htable->ops->insert(htable->index, item);
+	htable->policy_ops->on_insert(htable->policy, item);
+	htable_unlock(htable, key->hash);
+
+	struct HTableStatsShard *shard = htable_stats_shard(htable);
+	if (open) {
+		stats_add(&shard->open_count, 1);
+		stats_add(&shard->spared_count, 1);
+	}
+	stats_add(&shard->items_count, 1);
+	stats_add(&shard->space_in_bytes, space_delta);
+	struct HTableStats stats;
+	htable_stats_sample(htable, &stats);
+	if (stats.items_count > htable->max_items_count ||
+	    stats.total_space_in_bytes > htable->max_space_in_bytes) {
+		htable_evict_for_promotion(htable);
+	}
+	htable->ops->maintain(htable->index, stats.items_count);
+	return blob;
 }
 
 enum HTableError
 htable_open_or_create_file(struct HTable *htable,
-                           const char *key,
+                           const struct HTableKey *key,
                            int fd,
                            bool create,
                            bool lock)
@@ -332,7 +815,7 @@ htable_open_or_create_file(struct HTable *htable,
 }
 
 enum HTableError
-htable_close_file(struct HTable *htable, const char *key, int fd)
+htable_close_file(struct HTable *htable, const struct HTableKey *key, int fd)
 {
 	struct File *file = htable_fetch_file(htable, key);
 	if (!file) {
@@ -345,85 +828,87 @@ htable_close_file(struct HTable *htable, const char *key, int fd)
 		return HTABLE_ERR_CANT_CLOSE;
 	} else {
 		file->is_open = false;
+		bool is_spared = htable_file_is_spared(file);
 		htable_release_file(htable, key);
 
-		htable_stats_lock(htable);
-		htable->stats.open_count--;
-		htable_stats_unlock(htable);
+		struct HTableStatsShard *shard = htable_stats_shard(htable);
+		stats_add(&shard->open_count, -1);
+		if (!is_spared) {
+			stats_add(&shard->spared_count, -1);
+		}
 
 		return HTABLE_ERR_OK;
 	}
 }
 
 enum HTableError
-htable_remove_file(struct HTable *htable, const char *key, int fd)
+htable_remove_file(struct HTable *htable, const struct HTableKey *key, int fd)
 {
+	/* Whatever copy the lower tiers have is either the file itself or stale. */
+	bool dropped = htable->tier && compressed_tier_drop(htable->tier, key);
+	dropped |= htable->spill && spill_tier_drop(htable->spill, key);
 	struct HTableItem *node = htable_fetch_item(htable, key);
 	if (!node) {
-		return HTABLE_ERR_FILE_NOT_FOUND;
+		return dropped ? HTABLE_ERR_OK : HTABLE_ERR_FILE_NOT_FOUND;
 	} else if (node->file.is_locked && node->file.fd_owner != fd && fd != -1) {
-		htable_release_file(htable, key);
+		htable_unlock(htable, node->hash);
 		return HTABLE_ERR_OK;
 	}
 
-	struct HTableBucket *bucket = htable_bucket_ptr(htable, key);
-	/* Chain together the previous and next nodes within the bucket's linked
-	 * list. */
-	if (node->prev) {
-		node->prev->next = node->next;
-	} else {
-		bucket->head = node->next;
-	}
-	if (node->next) {
-		node->next->prev = node->prev;
-	} else {
-		bucket->last = node->prev;
-	}
+	htable->ops->remove(htable->index, node);
+	htable->policy_ops->on_remove(htable->policy, node);
+	htable_unlock(htable, node->hash);
 
-	size_t size_in_bytes = node->file.length_in_bytes;
-	/* Free stuff. */
-	free(node->file.key);
-	free(node->file.contents);
-	free(node);
+	int64_t space_delta = space_release(node->file.contents);
+	bool is_open = node->file.is_open;
+	bool is_spared = htable_item_is_spared(node);
+	/* Lock-free readers might still be looking at it. */
+	epoch_retire(node, htable_item_free);
 
-	htable_release_file(htable, key);
+	struct HTableStatsShard *shard = htable_stats_shard(htable);
+	if (is_open) {
+		stats_add(&shard->open_count, -1);
+	}
+	if (is_spared) {
+		stats_add(&shard->spared_count, -1);
+	}
+	stats_add(&shard->items_count, -1);
+	stats_add(&shard->space_in_bytes, space_delta);
 
-	htable_stats_lock(htable);
-	htable->stats.open_count--;
-	htable->stats.items_count--;
-	htable->stats.total_space_in_bytes -= size_in_bytes;
-	htable_stats_unlock(htable);
+	htable_maintain(htable);
 	return HTABLE_ERR_OK;
 }
 
 enum HTableError
 htable_replace_file_contents(struct HTable *htable,
-                             const char *key,
+                             const struct HTableKey *key,
                              const void *contents,
                              size_t size_in_bytes,
                              struct File **evicted,
                              unsigned *evicted_count)
 {
-	struct File *file = htable_fetch_file(htable, key);
-	if (!file) {
+	/* Copy outside of the lock. */
+	struct Blob *blob = NULL;
+	if (htable->deduplication) {
+		blob = blob_intern(contents, size_in_bytes, htable->compression);
+	} else if (htable->compression) {
+		blob = blob_create_compressed(contents, size_in_bytes);
+	} else {
+		blob = blob_create(contents, size_in_bytes);
+	}
+
+	struct HTableItem *item = htable_fetch_item(htable, key);
+	if (!item) {
+		blob_unref(blob);
 		return HTABLE_ERR_FILE_NOT_FOUND;
 	}
 
-	size_t old_size_in_bytes = file->length_in_bytes;
-	file->length_in_bytes = size_in_bytes;
-	file->contents = xrealloc(file->contents, file->length_in_bytes);
-	memcpy(file->contents, contents, file->length_in_bytes);
-	file->length_in_bytes = size_in_bytes;
+	int64_t space_delta = item_set_contents(item, blob);
+	htable_update_item(htable, item);
 
-	htable_release_file(htable, key);
+	htable_unlock(htable, item->hash);
 
-	htable_stats_lock(htable);
-	htable->stats.total_space_in_bytes += size_in_bytes;
-	htable->stats.total_space_in_bytes -= old_size_in_bytes;
-	if (htable->stats.total_space_in_bytes > htable->stats.historical_max_space_in_bytes) {
-		htable->stats.historical_max_space_in_bytes = htable->stats.total_space_in_bytes;
-	}
-	htable_stats_unlock(htable);
+	stats_add(&htable_stats_shard(htable)->space_in_bytes, space_delta);
 
 	/* We finally evict files if necessary. */
 	return htable_evict_files(htable, evicted, evicted_count);
@@ -431,31 +916,26 @@ htable_replace_file_contents(struct HTable *htable,
 
 enum HTableError
 htable_append_to_file_contents(struct HTable *htable,
-                               const char *key,
+                               const struct HTableKey *key,
                                const void *contents,
                                size_t size_in_bytes,
                                struct File **evicted,
                                unsigned *evicted_count)
 {
-	struct File *file = htable_fetch_file(htable, key);
-	if (!file) {
+	struct HTableItem *item = htable_fetch_item(htable, key);
+	if (!item) {
 		return HTABLE_ERR_FILE_NOT_FOUND;
 	}
 
-	file->length_in_bytes += size_in_bytes;
-	file->contents = xrealloc(file->contents, file->length_in_bytes);
-	memcpy((char *)file->contents + file->length_in_bytes - size_in_bytes,
-	       contents,
-	       size_in_bytes);
+	/* Somebody might be streaming the current contents, but appending only
+	 * writes past their end. */
+	int64_t space_delta =
+	  item_set_contents(item, blob_append(item->file.contents, contents, size_in_bytes));
+	htable_update_item(htable, item);
 
-	htable_release_file(htable, key);
+	htable_unlock(htable, item->hash);
 
-	htable_stats_lock(htable);
-	htable->stats.total_space_in_bytes += size_in_bytes;
-	if (htable->stats.total_space_in_bytes > htable->stats.historical_max_space_in_bytes) {
-		htable->stats.historical_max_space_in_bytes = htable->stats.total_space_in_bytes;
-	}
-	htable_stats_unlock(htable);
+	stats_add(&htable_stats_shard(htable)->space_in_bytes, space_delta);
 
 	return htable_evict_files(htable, evicted, evicted_count);
 }
@@ -467,8 +947,9 @@ struct HTableVisitor
 	struct HTable *htable;
 	unsigned max_visits;
 	unsigned visits;
-	size_t bucket_i;
-	struct HTableItem *next;
+	struct HTableCursor cursor;
+	/* What `htable_visitor_next` hands out. Its contents are pinned. */
+	struct File snapshot;
 };
 
 struct HTableVisitor *
@@ -479,11 +960,10 @@ htable_visit(struct HTable *htable, unsigned max_visits)
 	visitor->htable = htable;
 	visitor->max_visits = max_visits;
 	visitor->visits = 0;
-	visitor->bucket_i = 0;
-	struct HTableBucket *bucket = &htable->buckets[0];
-	visitor->next = bucket->head;
-	/* Lock the first bucket. */
-	ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
+	visitor->snapshot.contents = NULL;
+	/* Items are never locked during the visit. */
+	epoch_enter();
+	htable->ops->visit_begin(htable->index, &visitor->cursor);
 	return visitor;
 }
 
@@ -492,60 +972,63 @@ htable_visitor_next(struct HTableVisitor *visitor)
 {
 	assert(visitor);
 	struct HTable *htable = visitor->htable;
-	struct HTableBucket *bucket = &htable->buckets[visitor->bucket_i];
 
 	/* Check if we have visited enough items already. */
 	if (visitor->visits >= visitor->max_visits && visitor->max_visits != 0) {
 		/* The visit is complete. */
-		ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
 		return NULL;
 	}
 
-	if (visitor->next) {
-		visitor->visits++;
-		visitor->next = visitor->next->next;
-		return &visitor->next->file;
-	}
+	blob_unref(visitor->snapshot.contents);
+	visitor->snapshot.contents = NULL;
 
-	while (!visitor->next) {
-		ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
-		visitor->bucket_i++;
-		if (visitor->bucket_i == htable->buckets_count) {
-			/* No more buckets! */
-			return NULL;
-		}
-		bucket++;
-		ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
-		visitor->next = bucket->head;
+	struct HTableItem *item = htable->ops->visit_next(htable->index, &visitor->cursor);
+	if (!item) {
+		return NULL;
 	}
-
 	visitor->visits++;
-	return &visitor->next->file;
+	struct File *snapshot = &visitor->snapshot;
+	snapshot->key = item->file.key;
+	snapshot->contents = item_pin_contents(item);
+	return snapshot;
 }
 
 void
 htable_visitor_free(struct HTableVisitor *visitor)
 {
+	if (!visitor) {
+		return;
+	}
+	blob_unref(visitor->snapshot.contents);
+	visitor->htable->ops->visit_end(visitor->htable->index, &visitor->cursor);
+	epoch_exit();
 	free(visitor);
 }
 
-/************ EVICTION POLICIES ***********/
+/************ EVICTION ***********/
 
 struct FifoItem
 {
-	char *key;
-	struct FifoItem *prev;
+	/* Owns the memory at `key.ptr`. */
+	struct HTableKey key;
+	/* The item that was added right after this one. */
+	struct FifoItem *next;
 };
 
+/* A queue of keys in insertion order: new keys are added at `head`, and evicted
+ * from `last`. Only the admission window needs keys rather than items, since
+ * its files might be removed at any time. */
 struct Fifo
 {
 	struct HTable *htable;
 	pthread_mutex_t guard;
 	struct FifoItem *head;
 	struct FifoItem *last;
+	/* Can be read without the lock. */
+	size_t count;
 };
 
-struct Fifo *
+static struct Fifo *
 fifo_create(struct HTable *htable)
 {
 	struct Fifo *fifo = xmalloc(sizeof(struct Fifo));
@@ -553,154 +1036,463 @@ fifo_create(struct HTable *htable)
 	fifo->htable = htable;
 	fifo->head = NULL;
 	fifo->last = NULL;
+	fifo->count = 0;
 	return fifo;
 }
 
-void
+static void
+fifo_item_free(struct FifoItem *item)
+{
+	slab_free((char *)item->key.ptr, item->key.len);
+	slab_free(item, sizeof(struct FifoItem));
+}
+
+static void
 fifo_free(struct Fifo *fifo)
 {
 	if (!fifo) {
 		return;
 	}
 
-	struct FifoItem *head = fifo->head;
-	while (head) {
-		struct FifoItem *prev = head->prev;
-		free(head->key);
-		free(head);
-		head = prev;
+	struct FifoItem *item = fifo->last;
+	while (item) {
+		struct FifoItem *next = item->next;
+		fifo_item_free(item);
+		item = next;
 	}
+	ON_MUTEX_ERR(pthread_mutex_destroy(&fifo->guard));
 	free(fifo);
 }
 
-void
-fifo_add_file(struct Fifo *fifo, const char *key)
+/* Adds `item`, which might come from `fifo_evict` on some other queue, as the
+ * newest key of `fifo`. */
+static void
+fifo_push(struct Fifo *fifo, struct FifoItem *item)
 {
-	char *key_copy = xmalloc(strlen(key) + 1);
-	strcpy(key_copy, key);
-	struct FifoItem *item = xmalloc(sizeof(struct FifoItem));
-
-	item->key = key_copy;
-	item->prev = fifo->head;
+	item->next = NULL;
+	ON_MUTEX_ERR(pthread_mutex_lock(&fifo->guard));
+	if (fifo->head) {
+		fifo->head->next = item;
+	}
 	fifo->head = item;
 	if (!fifo->last) {
 		fifo->last = item;
 	}
+	__atomic_store_n(&fifo->count, fifo->count + 1, __ATOMIC_RELAXED);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&fifo->guard));
+}
+
+static void
+fifo_add_file(struct Fifo *fifo, const struct HTableKey *key)
+{
+	char *key_copy = slab_alloc(key->len);
+	memcpy(key_copy, key->ptr, key->len);
+	struct FifoItem *item = slab_alloc(sizeof(struct FifoItem));
+
+	item->key = *key;
+	item->key.ptr = key_copy;
+	fifo_push(fifo, item);
 }
 
-char *
+/* Removes the oldest key from `fifo` and returns it, or NULL if there's none.
+ * The caller must free both the item and its key. */
+static struct FifoItem *
 fifo_evict(struct Fifo *fifo)
 {
+	ON_MUTEX_ERR(pthread_mutex_lock(&fifo->guard));
 	struct FifoItem *last = fifo->last;
-	if (!last) {
-		return NULL;
-	} else {
-		fifo->last = last->prev;
-		char *key = last->key;
-		free(last);
-		return key;
+	if (last) {
+		fifo->last = last->next;
+		if (!fifo->last) {
+			fifo->head = NULL;
+		}
+		__atomic_store_n(&fifo->count, fifo->count - 1, __ATOMIC_RELAXED);
 	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&fifo->guard));
+	return last;
+}
+
+bool
+htable_evict_item(struct HTable *htable, struct HTableItem *item)
+{
+	struct HTableKey key = { .ptr = item->file.key, .len = item->key_len, .hash = item->hash };
+	htable_lock(htable, item->hash);
+	/* Some other file with the same key might have taken its place, too. */
+	bool found = htable->ops->find_locked(htable->index, &key) == item;
+	if (found && htable_item_is_spared(item)) {
+		/* It stays, so the policy must keep track of it again. */
+		htable->policy_ops->on_insert(htable->policy, item);
+		found = false;
+	} else if (found) {
+		htable->ops->remove(htable->index, item);
+	}
+	htable_unlock(htable, item->hash);
+	return found;
+}
+
+bool
+htable_has_victims(const struct HTable *htable)
+{
+	struct HTableStats stats;
+	htable_stats_snapshot(htable, &stats);
+	return stats.items_count > stats.spared_count;
 }
 
 struct HTableItem *
-htable_evict_single_file_fifo(struct HTable *htable)
+htable_evict_any(struct HTable *htable, uint64_t seed)
 {
-	char *key = fifo_evict(htable->fifo);
-	if (!key) {
-		return NULL;
+	return htable->ops->remove_any(htable->index, seed);
+}
+
+struct HTableItem *
+htable_evict_sweep(struct HTable *htable, uint64_t *hand)
+{
+	return htable->ops->sweep(htable->index, hand);
+}
+
+/* Files that leave the admission window while there's still room for them
+ * don't need to compete with anybody. */
+static void
+htable_window_graduate(struct HTable *htable, const struct HTableStats *stats)
+{
+	if (stats->items_count > htable->max_items_count ||
+	    stats->total_space_in_bytes > htable->max_space_in_bytes) {
+		return;
+	}
+	while (__atomic_load_n(&htable->window_count, __ATOMIC_RELAXED) > htable->window_capacity) {
+		struct FifoItem *fifo_item = fifo_evict(htable->window);
+		if (!fifo_item) {
+			break;
+		}
+		__atomic_fetch_sub(&htable->window_count, 1, __ATOMIC_RELAXED);
+		fifo_item_free(fifo_item);
 	}
+}
 
-	struct HTableBucket *bucket = htable_bucket_ptr(htable, key);
-	struct HTableItem *item = htable_fetch_item(htable, key);
-	if (!item) {
-		free(key);
-		return NULL;
+/* Puts `item`, which was just picked for eviction, back where it was. Returns
+ * false if some other file with the same key took its place in the meantime. */
+static bool
+htable_restore_item(struct HTable *htable, struct HTableItem *item)
+{
+	struct HTableKey key = { .ptr = item->file.key, .len = item->key_len, .hash = item->hash };
+	htable_lock(htable, item->hash);
+	bool restored = !htable->ops->find_locked(htable->index, &key);
+	if (restored) {
+		htable->ops->insert(htable->index, item);
+		htable->policy_ops->on_insert(htable->policy, item);
 	}
+	htable_unlock(htable, item->hash);
+	return restored;
+}
 
-	/* Chain together the previous and next nodes within the bucket's linked
-	 * list. */
-	if (item->prev) {
-		item->prev->next = item->next;
-	} else {
-		bucket->head = item->next;
+/* Once the admission window is full, its oldest file must compete with
+ * `victim`, which the cache eviction policy just removed from the index: the
+ * least popular of the two has to go. Returns the file to evict, or NULL if
+ * there's none after all because `victim` was put back and the other file is
+ * gone already. */
+static struct HTableItem *
+htable_admit(struct HTable *htable, struct HTableItem *victim)
+{
+	if (__atomic_load_n(&htable->window_count, __ATOMIC_RELAXED) <= htable->window_capacity) {
+		return victim;
 	}
-	if (item->next) {
-		item->next->prev = item->prev;
-	} else {
-		bucket->last = item->prev;
+	struct FifoItem *candidate_key = fifo_evict(htable->window);
+	if (!candidate_key) {
+		return victim;
+	}
+	__atomic_fetch_sub(&htable->window_count, 1, __ATOMIC_RELAXED);
+
+	/* Ties go to the victim, since one-off files are the most common. */
+	struct HTableItem *evicted = victim;
+	if (sketch_estimate(htable->sketch, candidate_key->key.hash) <=
+	      sketch_estimate(htable->sketch, victim->hash) &&
+	    htable_restore_item(htable, victim)) {
+		evicted = htable_fetch_item(htable, &candidate_key->key);
+		if (evicted && htable_item_is_spared(evicted)) {
+			htable_unlock(htable, evicted->hash);
+			evicted = NULL;
+		} else if (evicted) {
+			htable->ops->remove(htable->index, evicted);
+			htable->policy_ops->on_remove(htable->policy, evicted);
+			htable_unlock(htable, evicted->hash);
+		}
+		/* The candidate might have been the victim itself. */
+		if (evicted && evicted != victim) {
+			__atomic_fetch_add(
+			  &htable_stats_shard(htable)->admission_rejections, 1, __ATOMIC_RELAXED);
+		}
 	}
+	fifo_item_free(candidate_key);
+	return evicted;
+}
 
-	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
-	return item;
+/* Moves all evicted files from the `from`-th one on to the spill tier, which
+ * takes them over. Those that the spill tier has no room for take their place
+ * within `files`. */
+static void
+htable_spill_files(struct HTable *htable,
+                   struct File **files,
+                   unsigned from,
+                   unsigned *files_count)
+{
+	unsigned count = *files_count - from;
+	if (count == 0) {
+		return;
+	}
+	/* Overflowing files might be more than those that went in. */
+	struct File *spilled = xmalloc(sizeof(struct File) * count);
+	memcpy(spilled, &(*files)[from], sizeof(struct File) * count);
+	*files_count = from;
+	for (unsigned i = 0; i < count; i++) {
+		/* Victims are never spared, so nobody is waiting to lock them. */
+		assert(!spilled[i].subs);
+		spill_tier_store(htable->spill, &spilled[i], files, files_count);
+	}
+	free(spilled);
 }
 
-struct HTableItem *
-htable_evict_single_file_segmented_fifo(struct HTable *htable)
-{
-	assert(htable->stats.items_count);
-	while (htable->stats.items_count > 0) {
-		size_t i = rand() % htable->buckets_count;
-		struct HTableBucket *bucket = &htable->buckets[i];
-		ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
-		if (!bucket->last) {
-			assert(!bucket->head);
-			// The bucket is empty, so we can't evict anything. Let's try again.
-			ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
-			continue;
+/* Runs the cache replacement policy algorithm on `htable` until it holds at
+ * most `max_items_count` files and `max_space_in_bytes` bytes, or until `batch`
+ * files were evicted. Evicted files are appended to `evicted`, unless they fit
+ * in the compressed tier. Returns how many files left `htable` either way. The
+ * caller must hold `eviction_guard`. */
+static unsigned
+htable_evict_locked(struct HTable *htable,
+                    size_t max_items_count,
+                    size_t max_space_in_bytes,
+                    unsigned batch,
+                    struct File **evicted,
+                    unsigned *evicted_count)
+{
+	struct HTableStatsShard *shard = htable_stats_shard(htable);
+	struct HTableStats stats;
+	htable_stats_snapshot(htable, &stats);
+	unsigned count = 0;
+	while (count < batch && (stats.items_count > max_items_count ||
+	                         stats.total_space_in_bytes > max_space_in_bytes)) {
+		/* Victims might be concurrently removed and retired by others before
+		 * the policy gets to lock them. */
+		epoch_enter();
+		struct HTableItem *evicted_item = htable->policy_ops->pick_victim(htable->policy);
+		epoch_exit();
+		if (!evicted_item) {
+			/* All files were removed in the meantime, which frees space just as
+			 * well, or they're all spared, in which case the limits can't be
+			 * honored for now. */
+			break;
+		}
+		if (htable->window) {
+			evicted_item = htable_admit(htable, evicted_item);
+			if (!evicted_item) {
+				continue;
+			}
 		}
-		struct HTableItem *item = bucket->last;
-		bucket->last = item->prev;
-		if (bucket->last) {
-			bucket->last->next = NULL;
+
+		assert(!htable_file_is_spared(&evicted_item->file));
+
+		count++;
+		unsigned previous_count = *evicted_count;
+		if (htable->tier) {
+			/* Only files that the tier has no more room for leave the server. */
+			struct HTableKey key = { .ptr = evicted_item->file.key,
+				                     .len = evicted_item->key_len,
+				                     .hash = evicted_item->hash };
+			compressed_tier_store(
+			  htable->tier, &key, evicted_item->file.contents, evicted, evicted_count);
 		} else {
-			bucket->head = NULL;
+			(*evicted_count)++;
+			*evicted = xrealloc(*evicted, sizeof(struct File) * *evicted_count);
+			struct File *file_ptr = &(*evicted)[*evicted_count - 1];
+
+			/* Lock-free readers might still be looking at the item, so the caller
+			 * gets its own copy of the key and its own reference to the contents. */
+			*file_ptr = evicted_item->file;
+			file_ptr->key = buf_to_str(evicted_item->file.key, evicted_item->key_len);
+			blob_ref(file_ptr->contents);
+			/* Nobody can be waiting for it, since it wouldn't be a victim otherwise. */
+			assert(!file_ptr->subs);
+		}
+		if (htable->spill) {
+			htable_spill_files(htable, evicted, previous_count, evicted_count);
 		}
-		item->next = NULL;
-		item->prev = NULL;
-		ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
-		return item;
+
+		/* Update all stats. Open files are spared, so `open_count` stays the same. */
+		stats_add(&shard->items_count, -1);
+		stats_add(&shard->space_in_bytes, space_release(evicted_item->file.contents));
+		__atomic_fetch_add(
+		  &shard->num_evictions, *evicted_count - previous_count, __ATOMIC_RELAXED);
+
+		epoch_retire(evicted_item, htable_item_free);
+		htable_stats_snapshot(htable, &stats);
 	}
-	glog_fatal("Trying to evict a file from an empty cache. This is bug!");
-	exit(EXIT_FAILURE);
+	return count;
 }
 
 /* Runs the cache replacement policy algorithm on `htable` after some operation
  * that might trigger evictions. `evicted` and `evicted_count` will -after this
- * call- hold data about evicted files. */
-enum HTableError
+ * call- hold data about evicted files. With background eviction, the caller
+ * only evicts files itself past the hard limits. */
+static enum HTableError
 htable_evict_files(struct HTable *htable, struct File **evicted, unsigned *evicted_count)
 {
-	htable_stats_lock(htable);
-
 	*evicted = NULL;
 	*evicted_count = 0;
-	while (htable->stats.items_count > htable->max_items_count ||
-	       htable->stats.total_space_in_bytes > htable->max_space_in_bytes) {
 
-		(*evicted_count)++;
-		*evicted = xrealloc(*evicted, sizeof(struct File) * *evicted_count);
-		struct File *file_ptr = &(*evicted)[*evicted_count - 1];
-		struct HTableItem *evicted_item = NULL;
-
-		if (htable->policy == CACHE_EVICTION_POLICY_SEGMENTED_FIFO) {
-			evicted_item = htable_evict_single_file_segmented_fifo(htable);
-		} else {
-			evicted_item = htable_evict_single_file_fifo(htable);
+	/* The common case doesn't need any lock. */
+	struct HTableStats stats;
+	htable_stats_sample(htable, &stats);
+	if (htable->evictor_is_running) {
+		if (stats.items_count > htable->high_watermark_items_count ||
+		    stats.total_space_in_bytes > htable->high_watermark_space_in_bytes) {
+			ON_MUTEX_ERR(pthread_mutex_lock(&htable->evictor_guard));
+			htable->evictor_wanted = true;
+			ON_MUTEX_ERR(pthread_cond_signal(&htable->evictor_cond));
+			ON_MUTEX_ERR(pthread_mutex_unlock(&htable->evictor_guard));
 		}
+	}
+	if (stats.items_count <= htable->max_items_count &&
+	    stats.total_space_in_bytes <= htable->max_space_in_bytes) {
+		return HTABLE_ERR_OK;
+	}
 
-		*file_ptr = evicted_item->file;
+	ON_MUTEX_ERR(pthread_mutex_lock(&htable->eviction_guard));
+	unsigned count = htable_evict_locked(htable,
+	                                     htable->max_items_count,
+	                                     htable->max_space_in_bytes,
+	                                     UINT_MAX,
+	                                     evicted,
+	                                     evicted_count);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&htable->eviction_guard));
+	if (count > 0) {
+		htable_maintain(htable);
+	}
+	return HTABLE_ERR_OK;
+}
 
-		/* Update all stats. */
-		if (evicted_item->file.is_open) {
-			htable->stats.open_count--;
+/* Makes room for a file that was just promoted from the lower tiers, back into
+ * which other files go. Readers can't take the files that overflow them, so
+ * this only happens if the spool can. Otherwise `htable` stays past its limits
+ * until the next writer evicts files, rather than losing them. */
+static void
+htable_evict_for_promotion(struct HTable *htable)
+{
+	if (!htable->spool) {
+		return;
+	}
+	struct File *evicted = NULL;
+	unsigned evicted_count = 0;
+	ON_MUTEX_ERR(pthread_mutex_lock(&htable->eviction_guard));
+	htable_evict_locked(htable,
+	                    htable->max_items_count,
+	                    htable->max_space_in_bytes,
+	                    UINT_MAX,
+	                    &evicted,
+	                    &evicted_count);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&htable->eviction_guard));
+	eviction_spool_push(htable->spool, evicted, evicted_count);
+}
+
+/* Evicts files in batches until `htable` is below its low watermarks. */
+static void
+htable_evict_to_low_watermarks(struct HTable *htable)
+{
+	while (true) {
+		struct File *evicted = NULL;
+		unsigned evicted_count = 0;
+		ON_MUTEX_ERR(pthread_mutex_lock(&htable->eviction_guard));
+		unsigned count = htable_evict_locked(htable,
+		                                     htable->low_watermark_items_count,
+		                                     htable->low_watermark_space_in_bytes,
+		                                     HTABLE_EVICTOR_BATCH_SIZE,
+		                                     &evicted,
+		                                     &evicted_count);
+		ON_MUTEX_ERR(pthread_mutex_unlock(&htable->eviction_guard));
+		if (count == 0) {
+			return;
 		}
-		htable->stats.items_count--;
-		htable->stats.total_space_in_bytes -= file_ptr->length_in_bytes;
-		htable->stats.historical_num_evictions++;
+		eviction_spool_push(htable->spool, evicted, evicted_count);
+		htable_maintain(htable);
+	}
+}
 
-		free(evicted_item);
+static void *
+htable_evictor_entry_point(void *args)
+{
+	struct HTable *htable = args;
+	ON_MUTEX_ERR(pthread_mutex_lock(&htable->evictor_guard));
+	while (!htable->evictor_stop) {
+		if (!htable->evictor_wanted) {
+			ON_MUTEX_ERR(pthread_cond_wait(&htable->evictor_cond, &htable->evictor_guard));
+			continue;
+		}
+		htable->evictor_wanted = false;
+		ON_MUTEX_ERR(pthread_mutex_unlock(&htable->evictor_guard));
+		htable_evict_to_low_watermarks(htable);
+		ON_MUTEX_ERR(pthread_mutex_lock(&htable->evictor_guard));
 	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&htable->evictor_guard));
+	return NULL;
+}
 
-	htable_stats_unlock(htable);
-	return HTABLE_ERR_OK;
+/* Watermarks are rounded up, so that small limits don't end up at zero. */
+static size_t
+htable_watermark(size_t limit, unsigned percentage)
+{
+	return limit - limit * (100 - percentage) / 100;
+}
+
+static void
+htable_evictor_spawn(struct HTable *htable, const struct Config *config)
+{
+	htable->high_watermark_items_count =
+	  htable_watermark(htable->max_items_count, config->eviction_high_watermark);
+	htable->high_watermark_space_in_bytes =
+	  htable_watermark(htable->max_space_in_bytes, config->eviction_high_watermark);
+	htable->low_watermark_items_count =
+	  htable_watermark(htable->max_items_count, config->eviction_low_watermark);
+	htable->low_watermark_space_in_bytes =
+	  htable_watermark(htable->max_space_in_bytes, config->eviction_low_watermark);
+	ON_MUTEX_ERR(pthread_cond_init(&htable->evictor_cond, NULL));
+	htable->evictor_wanted = false;
+	htable->evictor_stop = false;
+	int err = pthread_create(&htable->evictor, NULL, htable_evictor_entry_point, htable);
+	if (err) {
+		glog_fatal("Unexpected `pthread_create` error code %d when spawning the evictor.",
+		           err);
+		exit(EXIT_FAILURE);
+	}
+	htable->evictor_is_running = true;
+}
+
+/* Stops the evictor, if any. */
+static void
+htable_evictor_join(struct HTable *htable)
+{
+	if (!htable->evictor_is_running) {
+		return;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&htable->evictor_guard));
+	htable->evictor_stop = true;
+	ON_MUTEX_ERR(pthread_cond_signal(&htable->evictor_cond));
+	ON_MUTEX_ERR(pthread_mutex_unlock(&htable->evictor_guard));
+	ON_MUTEX_ERR(pthread_join(htable->evictor, NULL));
+	htable->evictor_is_running = false;
+	ON_MUTEX_ERR(pthread_cond_destroy(&htable->evictor_cond));
+}
+
+struct EvictionSpool *
+htable_eviction_spool(const struct HTable *htable)
+{
+	return htable->spool;
+}
+
+void
+htable_free_evicted(struct File *files, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		free(files[i].key);
+		blob_unref(files[i].contents);
+		subscribers_free(files[i].subs);
+	}
+	free(files);
 }
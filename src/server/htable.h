@@ -1,8 +1,10 @@
 #ifndef SOL_SERVER_HTABLE
 #define SOL_SERVER_HTABLE
 
+#include "blob.h"
 #include "config.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 enum HTableError
@@ -18,23 +20,46 @@ enum HTableError
 	HTABLE_ERR_ALREADY_CREATED,
 	HTABLE_ERR_ALREADY_CLOSED,
 	HTABLE_ERR_ALREADY_UNLOCKED,
+	HTABLE_ERR_ALREADY_PINNED,
+	HTABLE_ERR_ALREADY_UNPINNED,
 	/* Bad query. */
 	HTABLE_ERR_FILE_NOT_FOUND,
 	/* Permission not granted. */
 	HTABLE_ERR_CANT_UNLOCK,
 	HTABLE_ERR_CANT_OPEN,
 	HTABLE_ERR_CANT_CLOSE,
+	HTABLE_ERR_CANT_PIN,
 	HTABLE_ERR_SIZE,
 };
 
 struct HTableStats
 {
+	/* Contents shared by several files only count once, and compressed ones
+	 * count for their compressed size. */
 	size_t total_space_in_bytes;
 	size_t items_count;
 	size_t open_count;
+	/* Files that are open or pinned, which are never evicted. */
+	size_t spared_count;
 	long unsigned historical_max_items_count;
 	long unsigned historical_max_space_in_bytes;
 	long unsigned historical_num_evictions;
+	/* Lookups of file contents that found the file, or didn't. */
+	long unsigned read_hits;
+	long unsigned read_misses;
+	/* New files that were evicted in place of some older, more popular file. */
+	long unsigned admission_rejections;
+	/* Evicted files that are still within the compressed tier, if enabled, and
+	 * how many of them were read again or pushed out for good. */
+	size_t tier_items_count;
+	size_t tier_space_in_bytes;
+	long unsigned tier_promotions;
+	long unsigned tier_overflows;
+	/* Same, for the spill tier on disk. */
+	size_t spill_items_count;
+	size_t spill_space_in_bytes;
+	long unsigned spill_promotions;
+	long unsigned spill_overflows;
 };
 
 struct Subscriber
@@ -43,6 +68,20 @@ struct Subscriber
 	struct Subscriber *next;
 };
 
+/* A file path, as seen by `struct HTable`. It's not NUL-terminated, and it's
+ * hashed only once. */
+struct HTableKey
+{
+	const char *ptr;
+	size_t len;
+	uint64_t hash;
+};
+
+/* Returns a `struct HTableKey` that points to the `len` bytes at `ptr`, which
+ * must outlive it. */
+struct HTableKey
+htable_key(const void *ptr, size_t len);
+
 /* A specialized, concurrent hash table for the file storage server. */
 struct HTable;
 
@@ -50,17 +89,20 @@ struct HTable;
 struct File
 {
 	char *key;
-	void *contents;
-	size_t length_in_bytes;
+	/* Never NULL. Writers replace it as a whole rather than modifying it. */
+	struct Blob *contents;
 	int fd_owner;
 	bool is_open;
 	bool is_locked;
+	/* Pinned files are never evicted. They can still be removed. */
+	bool is_pinned;
 	struct Subscriber *subs;
 };
 
-/* Creates an empty `struct HTable` with a fixed number of `buckets` and settings
- * as mandated by `config`. Returns NULL on system errors that make the
- * operation impossible. */
+/* Creates an empty `struct HTable` with at least `buckets` buckets and settings
+ * as mandated by `config`. The number of buckets then grows and shrinks over
+ * time to follow the number of items. Returns NULL on system errors that make
+ * the operation impossible. */
 struct HTable *
 htable_create(size_t buckets, const struct Config *config);
 
@@ -68,18 +110,20 @@ htable_create(size_t buckets, const struct Config *config);
 void
 htable_free(struct HTable *htable);
 
-/* Returns a pointer to the internal `struct HTableStats` of `htable`. */
-const struct HTableStats *
-htable_stats(const struct HTable *htable);
+/* Copies the current statistics of `htable` into `stats`. Thread-safe. The
+ * snapshot is exact when no other thread is modifying `htable`, otherwise it
+ * might be slightly off. */
+void
+htable_stats_snapshot(const struct HTable *htable, struct HTableStats *stats);
 
 /* Searches a file with path `key` within `htable` and returns a pointer to its
  * contents if found, NULL otherwise. */
 struct File *
-htable_fetch_file(struct HTable *htable, const char *key);
+htable_fetch_file(struct HTable *htable, const struct HTableKey *key);
 
 enum HTableError
 htable_replace_file_contents(struct HTable *htable,
-                             const char *key,
+                             const struct HTableKey *key,
                              const void *contents,
                              size_t size_in_bytes,
                              struct File **evicted,
@@ -87,35 +131,54 @@ htable_replace_file_contents(struct HTable *htable,
 
 enum HTableError
 htable_append_to_file_contents(struct HTable *htable,
-                               const char *key,
+                               const struct HTableKey *key,
                                const void *contents,
                                size_t size_in_bytes,
                                struct File **evicted,
                                unsigned *evicted_count);
 
+/* Searches a file with path `key` within `htable` without taking any lock, and
+ * returns a new reference to its current contents if found, NULL otherwise.
+ * The caller can take as long as it wants with them and then must call
+ * `blob_unref`; in the meantime, the file can be freely modified, removed, or
+ * evicted by others. */
+struct Blob *
+htable_pin_file(struct HTable *htable, const struct HTableKey *key);
+
 /* Drops a unique handle on the file with path `key` within `htable` and releases
  * an internal lock that blocks access to it from other threads. This MUST
  * always be called after `htable_fetch_file`. */
 void
-htable_release_file(struct HTable *htable, const char *key);
+htable_release_file(struct HTable *htable, const struct HTableKey *key);
 
 /* Locks the file with path `key` within `htable`. */
 enum HTableError
-htable_lock_file(struct HTable *htable, const char *key, int fd);
+htable_lock_file(struct HTable *htable, const struct HTableKey *key, int fd);
 
 /* Unlocks the file with path `key` within `htable`. `new_owner_of_lock`, after
  * this call, will point to the value of the client's file descriptor that owns
  * the lock, or -1 if none. */
 enum HTableError
-htable_unlock_file(struct HTable *htable, const char *key, int fd, int *new_owner_of_lock);
+htable_unlock_file(struct HTable *htable,
+                   const struct HTableKey *key,
+                   int fd,
+                   int *new_owner_of_lock);
 
+/* Pins or unpins the file with path `key` within `htable`. Files locked by
+ * other clients can't be pinned nor unpinned. */
 enum HTableError
-htable_close_file(struct HTable *htable, const char *key, int fd);
+htable_set_file_pinned(struct HTable *htable,
+                       const struct HTableKey *key,
+                       int fd,
+                       bool pinned);
+
+enum HTableError
+htable_close_file(struct HTable *htable, const struct HTableKey *key, int fd);
 
 /* Opens the file with path `key` within `htable`. */
 enum HTableError
 htable_open_or_create_file(struct HTable *htable,
-                           const char *key,
+                           const struct HTableKey *key,
                            int fd,
                            bool create,
                            bool lock);
@@ -123,7 +186,7 @@ htable_open_or_create_file(struct HTable *htable,
 /* Removes the file with path `key` within `htable` and returns 0 if the operation
  * was successful, -1 otherwise. */
 enum HTableError
-htable_remove_file(struct HTable *htable, const char *key, int fd);
+htable_remove_file(struct HTable *htable, const struct HTableKey *key, int fd);
 
 struct HTableVisitor;
 
@@ -133,10 +196,24 @@ struct HTableVisitor;
 struct HTableVisitor *
 htable_visit(struct HTable *htable, unsigned max_visits);
 
+/* Returns the next visited file, or NULL once the visit is complete. The visit
+ * doesn't lock any file, so only `key` and `contents` are meaningful; they stay
+ * valid until the next call. Use `blob_ref` to keep the contents around for
+ * longer. */
 struct File *
 htable_visitor_next(struct HTableVisitor *visitor);
 
 void
 htable_visitor_free(struct HTableVisitor *visitor);
 
+/* Disposes of the `count` files evicted by some operation, as well as the
+ * `files` array itself. */
+void
+htable_free_evicted(struct File *files, unsigned count);
+
+/* Returns the spool that evicted files go to, or NULL if writers get them.
+ * Writers must push the files they evict there, too. */
+struct EvictionSpool *
+htable_eviction_spool(const struct HTable *htable);
+
 #endif
@@ -0,0 +1,659 @@
+/* For `pthread_rwlock_t`. */
+#define _POSIX_C_SOURCE 200809L
+
+#include "epoch.h"
+#include "global_state.h"
+#include "htable_index.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The bucket array never shrinks below this many buckets. Must be a power of
+ * two. */
+#define CHAINED_MIN_BUCKETS_COUNT 16
+/* The bucket array doubles as soon as there are more items than buckets, and
+ * halves as soon as there are less than one item every eight buckets. */
+#define CHAINED_MAX_LOAD_FACTOR 1
+#define CHAINED_MIN_LOAD_FACTOR_INVERSE 8
+/* How many buckets a single operation migrates while a rehash is in progress. */
+#define CHAINED_REHASH_STEP 8
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error during hash table internal manipulation.")
+
+/* Bucket chains are made of `struct HTableItem`s, and they are singly linked
+ * lists as far as lock-free readers are concerned: writers always hold the
+ * bucket lock and publish changes to `next` and to the bucket's `head` with
+ * `EPOCH_STORE`, while `prev` and the bucket's `last` are only ever touched by
+ * writers. Unlinked items keep their `next` pointer, so that readers standing on
+ * them can keep going. */
+struct ChainedBucket
+{
+	pthread_mutex_t guard;
+	/* The array this bucket belongs to. */
+	struct ChainedBuckets *buckets;
+	struct HTableItem *head;
+	struct HTableItem *last;
+	/* `true` once all items have been moved to a newer bucket array by a
+	 * rehash. Migrated buckets stay empty forever. */
+	bool migrated;
+};
+
+struct ChainedBuckets
+{
+	/* Always a power of two. */
+	size_t count;
+	/* One bit per bucket, set while the bucket isn't empty, so that
+	 * `chained_remove_any` doesn't have to probe empty buckets. Bits only
+	 * change under the lock of their bucket, but buckets share words. */
+	uint64_t *occupied;
+	/* One bit per word of `occupied`, set whenever the word might be non-zero.
+	 * Bits are only cleared lazily, by `buckets_find_occupied`. */
+	uint64_t *summary;
+	size_t words_count;
+	size_t summary_words_count;
+	struct ChainedBucket at[];
+};
+
+struct Chained
+{
+	/* Rehash steps hold it in write mode. Visitors hold it in read mode, so that
+	 * items don't move around while they're being visited. */
+	pthread_rwlock_t rehash_guard;
+	/* Incremented before and after each bucket migration, so that lock-free
+	 * readers can detect items moving under their feet. */
+	unsigned rehash_seq;
+	/* Both bucket arrays are read by lock-free readers and retired by rehashes
+	 * via `epoch_retire`. `old_buckets` is NULL unless a rehash is in progress,
+	 * in which case items live in either array: all old buckets before
+	 * `rehash_i` have been migrated already. */
+	struct ChainedBuckets *buckets;
+	struct ChainedBuckets *old_buckets;
+	size_t rehash_i;
+};
+
+static struct ChainedBuckets *
+buckets_create(size_t count)
+{
+	struct ChainedBuckets *buckets =
+	  xmalloc(sizeof(struct ChainedBuckets) + sizeof(struct ChainedBucket) * count);
+	buckets->count = count;
+	buckets->words_count = (count + 63) / 64;
+	buckets->summary_words_count = (buckets->words_count + 63) / 64;
+	buckets->occupied = xmalloc(sizeof(uint64_t) * buckets->words_count);
+	memset(buckets->occupied, 0, sizeof(uint64_t) * buckets->words_count);
+	buckets->summary = xmalloc(sizeof(uint64_t) * buckets->summary_words_count);
+	memset(buckets->summary, 0, sizeof(uint64_t) * buckets->summary_words_count);
+	for (size_t i = 0; i < count; i++) {
+		buckets->at[i].buckets = buckets;
+		buckets->at[i].head = NULL;
+		buckets->at[i].last = NULL;
+		buckets->at[i].migrated = false;
+		ON_MUTEX_ERR(pthread_mutex_init(&buckets->at[i].guard, NULL));
+	}
+	return buckets;
+}
+
+/* Frees a bucket array, but not its items. */
+static void
+buckets_free(void *ptr)
+{
+	struct ChainedBuckets *buckets = ptr;
+	for (size_t i = 0; i < buckets->count; i++) {
+		ON_MUTEX_ERR(pthread_mutex_destroy(&buckets->at[i].guard));
+	}
+	free(buckets->occupied);
+	free(buckets->summary);
+	free(buckets);
+}
+
+static void
+buckets_free_items(struct ChainedBuckets *buckets)
+{
+	for (size_t i = 0; i < buckets->count; i++) {
+		struct HTableItem *item = buckets->at[i].head;
+		while (item) {
+			struct HTableItem *next = item->next;
+			htable_item_free(item);
+			item = next;
+		}
+	}
+}
+
+static void *
+chained_create(size_t capacity)
+{
+	struct Chained *chained = xmalloc(sizeof(struct Chained));
+	ON_MUTEX_ERR(pthread_rwlock_init(&chained->rehash_guard, NULL));
+	/* Bucket indices are computed by masking, so we need a power of two. */
+	size_t count = CHAINED_MIN_BUCKETS_COUNT;
+	while (count < capacity) {
+		count *= 2;
+	}
+	chained->buckets = buckets_create(count);
+	chained->old_buckets = NULL;
+	chained->rehash_i = 0;
+	chained->rehash_seq = 0;
+	return chained;
+}
+
+static void
+chained_free(void *index)
+{
+	struct Chained *chained = index;
+	if (chained->old_buckets) {
+		buckets_free_items(chained->old_buckets);
+		buckets_free(chained->old_buckets);
+	}
+	buckets_free_items(chained->buckets);
+	buckets_free(chained->buckets);
+	ON_MUTEX_ERR(pthread_rwlock_destroy(&chained->rehash_guard));
+	free(chained);
+}
+
+static struct ChainedBucket *
+buckets_at(struct ChainedBuckets *buckets, uint64_t hash)
+{
+	return &buckets->at[hash & (buckets->count - 1)];
+}
+
+/* Returns a pointer to the bucket within `chained` that is currently
+ * responsible for `hash`, or NULL if the bucket arrays changed in the meantime
+ * and the caller should try again. The caller must be within an epoch. */
+static struct ChainedBucket *
+chained_bucket_ptr(struct Chained *chained, uint64_t hash)
+{
+	/* The current array must be read first: if it's older than `old_buckets`,
+	 * its buckets are all migrated and the caller will just try again. */
+	struct ChainedBuckets *buckets = EPOCH_LOAD(chained->buckets);
+	struct ChainedBuckets *old_buckets = EPOCH_LOAD(chained->old_buckets);
+	if (old_buckets) {
+		struct ChainedBucket *old = buckets_at(old_buckets, hash);
+		if (!EPOCH_LOAD(old->migrated)) {
+			return old;
+		}
+	}
+	struct ChainedBucket *bucket = buckets_at(buckets, hash);
+	if (EPOCH_LOAD(bucket->migrated)) {
+		return NULL;
+	}
+	return bucket;
+}
+
+/* Locks and returns the bucket within `chained` that is responsible for
+ * `hash`. The caller must be within an epoch. */
+static struct ChainedBucket *
+chained_lock_bucket(struct Chained *chained, uint64_t hash)
+{
+	while (true) {
+		struct ChainedBucket *bucket = chained_bucket_ptr(chained, hash);
+		if (!bucket) {
+			continue;
+		}
+		ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
+		/* Migrations only happen under the bucket lock, so this is definitive. */
+		if (!bucket->migrated) {
+			return bucket;
+		}
+		ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+	}
+}
+
+static void
+chained_lock(void *index, uint64_t hash)
+{
+	chained_lock_bucket(index, hash);
+}
+
+static void
+chained_unlock(void *index, uint64_t hash)
+{
+	/* We're still holding the lock, so the bucket can't have been migrated in
+	 * the meantime. */
+	struct ChainedBucket *bucket = chained_bucket_ptr(index, hash);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+}
+
+/************ OCCUPANCY BITMAP ***********/
+
+/* Sets the occupancy bit of `bucket`, which must be locked. */
+static void
+bucket_mark_occupied(struct ChainedBucket *bucket)
+{
+	struct ChainedBuckets *buckets = bucket->buckets;
+	size_t i = bucket - buckets->at;
+	size_t word = i / 64;
+	uint64_t summary_bit = UINT64_C(1) << (word % 64);
+	/* The word must be set before the summary is checked, and
+	 * `buckets_find_occupied` does the opposite, so that either we see its
+	 * clearing the summary bit or it sees our bit. */
+	__atomic_fetch_or(&buckets->occupied[word], UINT64_C(1) << (i % 64), __ATOMIC_SEQ_CST);
+	if (!(__atomic_load_n(&buckets->summary[word / 64], __ATOMIC_SEQ_CST) & summary_bit)) {
+		__atomic_fetch_or(&buckets->summary[word / 64], summary_bit, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* Clears the occupancy bit of `bucket`, which must be locked. */
+static void
+bucket_mark_empty(struct ChainedBucket *bucket)
+{
+	struct ChainedBuckets *buckets = bucket->buckets;
+	size_t i = bucket - buckets->at;
+	uint64_t bit = UINT64_C(1) << (i % 64);
+	__atomic_fetch_and(&buckets->occupied[i / 64], ~bit, __ATOMIC_SEQ_CST);
+}
+
+/* Returns the index of the first bucket of `word` that looks occupied, ignoring
+ * those before `from`, or `buckets->count` if there's none. */
+static size_t
+buckets_word_find(struct ChainedBuckets *buckets, size_t word, unsigned from)
+{
+	uint64_t bits = __atomic_load_n(&buckets->occupied[word], __ATOMIC_SEQ_CST);
+	bits &= ~UINT64_C(0) << from;
+	return bits ? word * 64 + __builtin_ctzll(bits) : buckets->count;
+}
+
+/* Returns the index of the first bucket at or after `start` (wrapping around)
+ * that looks occupied, or `buckets->count` if all of them look empty. The
+ * answer is only a hint, since nothing is locked. The caller must be within an
+ * epoch. */
+static size_t
+buckets_find_occupied(struct ChainedBuckets *buckets, size_t start)
+{
+	size_t i = buckets_word_find(buckets, start / 64, start % 64);
+	if (i < buckets->count) {
+		return i;
+	}
+	/* Then all other words, via their summary bits. The first summary word is
+	 * visited twice, since the words before `start` come last. */
+	size_t next = (start / 64 + 1) % buckets->words_count;
+	for (size_t n = 0; n <= buckets->summary_words_count; n++) {
+		size_t s = (next / 64 + n) % buckets->summary_words_count;
+		uint64_t summary = __atomic_load_n(&buckets->summary[s], __ATOMIC_SEQ_CST);
+		if (n == 0) {
+			summary &= ~UINT64_C(0) << (next % 64);
+		}
+		while (summary) {
+			unsigned bit_i = __builtin_ctzll(summary);
+			uint64_t bit = UINT64_C(1) << bit_i;
+			size_t word = s * 64 + bit_i;
+			summary &= ~bit;
+			i = buckets_word_find(buckets, word, 0);
+			if (i < buckets->count) {
+				return i;
+			}
+			/* The word is empty, but it might not be anymore by the time the
+			 * summary bit is clear. */
+			__atomic_fetch_and(&buckets->summary[s], ~bit, __ATOMIC_SEQ_CST);
+			i = buckets_word_find(buckets, word, 0);
+			if (i < buckets->count) {
+				__atomic_fetch_or(&buckets->summary[s], bit, __ATOMIC_SEQ_CST);
+				return i;
+			}
+		}
+	}
+	return buckets->count;
+}
+
+/* Locks and returns an occupied bucket of `buckets`, picked at random thanks to
+ * `seed`, or returns NULL if there seems to be none. The caller must be within
+ * an epoch. */
+static struct ChainedBucket *
+buckets_lock_occupied(struct ChainedBuckets *buckets, uint64_t seed)
+{
+	size_t i = buckets_find_occupied(buckets, seed & (buckets->count - 1));
+	if (i == buckets->count) {
+		return NULL;
+	}
+	struct ChainedBucket *bucket = &buckets->at[i];
+	ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
+	/* It might have been emptied or migrated in the meantime. */
+	if (bucket->migrated || !bucket->last) {
+		ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+		return NULL;
+	}
+	return bucket;
+}
+
+/************ BUCKET CHAINS ***********/
+
+/* Appends `item` at the head of `bucket`, which must be locked. */
+static void
+bucket_push(struct ChainedBucket *bucket, struct HTableItem *item)
+{
+	if (!bucket->head) {
+		bucket_mark_occupied(bucket);
+	}
+	/* Items being migrated might be visible to readers already. */
+	EPOCH_STORE(item->next, bucket->head);
+	item->prev = NULL;
+	if (bucket->head) {
+		bucket->head->prev = item;
+	}
+	if (!bucket->last) {
+		bucket->last = item;
+	}
+	EPOCH_STORE(bucket->head, item);
+}
+
+/* Removes `item` from `bucket`, which must be locked. */
+static void
+bucket_unlink(struct ChainedBucket *bucket, struct HTableItem *item)
+{
+	/* Chain together the previous and next nodes within the bucket's linked
+	 * list. */
+	if (item->prev) {
+		EPOCH_STORE(item->prev->next, item->next);
+	} else {
+		EPOCH_STORE(bucket->head, item->next);
+	}
+	if (item->next) {
+		item->next->prev = item->prev;
+	} else {
+		bucket->last = item->prev;
+	}
+	item->prev = NULL;
+	if (!bucket->head) {
+		bucket_mark_empty(bucket);
+	}
+}
+
+/* Searches `key` within `bucket`. It's safe to call without holding the bucket
+ * lock, as long as the caller is within an epoch. */
+static struct HTableItem *
+bucket_find(struct ChainedBucket *bucket, const struct HTableKey *key)
+{
+	struct HTableItem *item = EPOCH_LOAD(bucket->head);
+	while (item) {
+		assert(item->file.key);
+		if (htable_item_has_key(item, key)) {
+			return item;
+		}
+		item = EPOCH_LOAD(item->next);
+	}
+	return NULL;
+}
+
+static struct HTableItem *
+chained_find_locked(void *index, const struct HTableKey *key)
+{
+	return bucket_find(chained_bucket_ptr(index, key->hash), key);
+}
+
+static void
+chained_insert(void *index, struct HTableItem *item)
+{
+	bucket_push(chained_bucket_ptr(index, item->hash), item);
+}
+
+static void
+chained_remove(void *index, struct HTableItem *item)
+{
+	bucket_unlink(chained_bucket_ptr(index, item->hash), item);
+}
+
+static struct HTableItem *
+chained_find(void *index, const struct HTableKey *key)
+{
+	struct Chained *chained = index;
+	while (true) {
+		unsigned seq = __atomic_load_n(&chained->rehash_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			/* Some items are being moved right now. */
+			sched_yield();
+			continue;
+		}
+		struct ChainedBucket *bucket = chained_bucket_ptr(chained, key->hash);
+		struct HTableItem *item = bucket ? bucket_find(bucket, key) : NULL;
+		if (item) {
+			return item;
+		}
+		/* Unsuccessful searches are only definitive if no item has been moved
+		 * in the meantime. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (bucket && __atomic_load_n(&chained->rehash_seq, __ATOMIC_RELAXED) == seq) {
+			return NULL;
+		}
+	}
+}
+
+/* Removes and returns the oldest item of a random occupied bucket of `buckets`
+ * that isn't spared, if any. The caller must be within an epoch. */
+static struct HTableItem *
+buckets_remove_any(struct ChainedBuckets *buckets, uint64_t seed)
+{
+	struct ChainedBucket *bucket = buckets_lock_occupied(buckets, seed);
+	if (!bucket) {
+		return NULL;
+	}
+	struct HTableItem *item = bucket->last;
+	while (item && htable_item_is_spared(item)) {
+		item = item->prev;
+	}
+	if (item) {
+		bucket_unlink(bucket, item);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+	return item;
+}
+
+static struct HTableItem *
+chained_remove_any(void *index, uint64_t seed)
+{
+	struct Chained *chained = index;
+	/* Same order as `chained_bucket_ptr`. If a rehash starts or ends in the
+	 * meantime we might find nothing, and the caller will just try again. */
+	struct ChainedBuckets *buckets = EPOCH_LOAD(chained->buckets);
+	struct ChainedBuckets *old_buckets = EPOCH_LOAD(chained->old_buckets);
+	struct HTableItem *item = NULL;
+	/* Old buckets are going away anyway, but they might hold nothing but
+	 * spared items, and rehashes only progress as long as there are writes. */
+	if (old_buckets) {
+		item = buckets_remove_any(old_buckets, seed);
+	}
+	if (!item) {
+		item = buckets_remove_any(buckets, seed);
+	}
+	return item;
+}
+
+static struct HTableItem *
+chained_sweep(void *index, uint64_t *hand)
+{
+	/* The hand is just a hash that goes over all buckets, whatever their
+	 * count. */
+	struct ChainedBucket *bucket = chained_lock_bucket(index, *hand);
+	(*hand)++;
+	/* Oldest items first. */
+	struct HTableItem *item = bucket->last;
+	while (item && (htable_item_is_spared(item) || htable_item_clear_referenced(item))) {
+		item = item->prev;
+	}
+	if (item) {
+		bucket_unlink(bucket, item);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+	return item;
+}
+
+/************ INCREMENTAL REHASHING ***********/
+
+/* Moves the contents of the next few old buckets of `chained` into the new
+ * bucket array. The caller must hold `rehash_guard` in write mode. Returns
+ * `true` once the whole old bucket array has been migrated. */
+static bool
+chained_migrate_buckets(struct Chained *chained)
+{
+	struct ChainedBuckets *buckets = chained->buckets;
+	struct ChainedBuckets *old_buckets = chained->old_buckets;
+	for (unsigned step = 0; step < CHAINED_REHASH_STEP; step++) {
+		if (chained->rehash_i == old_buckets->count) {
+			break;
+		}
+		struct ChainedBucket *old = &old_buckets->at[chained->rehash_i];
+		ON_MUTEX_ERR(pthread_mutex_lock(&old->guard));
+		__atomic_fetch_add(&chained->rehash_seq, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		/* Oldest items first, so that insertion order is preserved within each
+		 * bucket. */
+		struct HTableItem *item = old->last;
+		while (item) {
+			struct HTableItem *prev = item->prev;
+			struct ChainedBucket *bucket = buckets_at(buckets, item->hash);
+			ON_MUTEX_ERR(pthread_mutex_lock(&bucket->guard));
+			bucket_push(bucket, item);
+			ON_MUTEX_ERR(pthread_mutex_unlock(&bucket->guard));
+			item = prev;
+		}
+		EPOCH_STORE(old->head, NULL);
+		old->last = NULL;
+		bucket_mark_empty(old);
+		EPOCH_STORE(old->migrated, true);
+		__atomic_fetch_add(&chained->rehash_seq, 1, __ATOMIC_RELEASE);
+		ON_MUTEX_ERR(pthread_mutex_unlock(&old->guard));
+		chained->rehash_i++;
+	}
+	return chained->rehash_i == old_buckets->count;
+}
+
+/* Grows or shrinks `chained` towards its target load factor, a little bit at a
+ * time. */
+static void
+chained_maintain(void *index, size_t items_count)
+{
+	struct Chained *chained = index;
+	int err = pthread_rwlock_trywrlock(&chained->rehash_guard);
+	if (err == EBUSY) {
+		/* Somebody else is taking care of it, or there's an ongoing visit. */
+		return;
+	}
+	ON_MUTEX_ERR(err);
+
+	if (chained->old_buckets) {
+		if (chained_migrate_buckets(chained)) {
+			struct ChainedBuckets *old_buckets = chained->old_buckets;
+			EPOCH_STORE(chained->old_buckets, NULL);
+			/* Readers might still be looking at it. */
+			epoch_retire(old_buckets, buckets_free);
+			glog_debug("Hash table rehash complete (%zu buckets).",
+			           chained->buckets->count);
+		}
+		ON_MUTEX_ERR(pthread_rwlock_unlock(&chained->rehash_guard));
+		return;
+	}
+
+	/* Nobody else can change the bucket count, since we're holding the rehash
+	 * lock. */
+	size_t count = chained->buckets->count;
+	size_t new_count = count;
+	if (items_count > count * CHAINED_MAX_LOAD_FACTOR) {
+		new_count = count * 2;
+	} else if (items_count < count / CHAINED_MIN_LOAD_FACTOR_INVERSE &&
+	           count > CHAINED_MIN_BUCKETS_COUNT) {
+		new_count = count / 2;
+	}
+	if (new_count != count) {
+		chained->rehash_i = 0;
+		/* The old array must be visible before the new one. */
+		EPOCH_STORE(chained->old_buckets, chained->buckets);
+		EPOCH_STORE(chained->buckets, buckets_create(new_count));
+		glog_debug("Hash table rehash started (%zu -> %zu buckets, %zu items).",
+		           count,
+		           new_count,
+		           items_count);
+	}
+	ON_MUTEX_ERR(pthread_rwlock_unlock(&chained->rehash_guard));
+}
+
+/************ VISITOR PATTERN ***********/
+
+/* Returns the `i`-th bucket in visiting order (old buckets first, if any), or
+ * NULL if there's none. */
+static struct ChainedBucket *
+chained_visitor_bucket(struct Chained *chained, size_t i)
+{
+	/* No rehash step can run during the visit, so the bucket arrays are
+	 * stable. */
+	struct ChainedBuckets *old_buckets = EPOCH_LOAD(chained->old_buckets);
+	struct ChainedBuckets *buckets = EPOCH_LOAD(chained->buckets);
+	if (old_buckets) {
+		if (i < old_buckets->count) {
+			return &old_buckets->at[i];
+		}
+		i -= old_buckets->count;
+	}
+	if (i < buckets->count) {
+		return &buckets->at[i];
+	}
+	return NULL;
+}
+
+static void
+chained_visit_begin(void *index, struct HTableCursor *cursor)
+{
+	struct Chained *chained = index;
+	/* Items must not move between buckets during the visit, or we might see
+	 * them twice (or never). Buckets themselves are never locked. */
+	ON_MUTEX_ERR(pthread_rwlock_rdlock(&chained->rehash_guard));
+	/* `i` is the current bucket and `ptr` the current item, while `j` tells
+	 * whether we've started yet. */
+	cursor->i = 0;
+	cursor->j = 0;
+	cursor->ptr = NULL;
+}
+
+static struct HTableItem *
+chained_visit_next(void *index, struct HTableCursor *cursor)
+{
+	struct HTableItem *item = cursor->ptr;
+	if (item) {
+		item = EPOCH_LOAD(item->next);
+	}
+	while (!item) {
+		if (cursor->j) {
+			cursor->i++;
+		}
+		cursor->j = 1;
+		struct ChainedBucket *bucket = chained_visitor_bucket(index, cursor->i);
+		if (!bucket) {
+			/* No more buckets! */
+			cursor->ptr = NULL;
+			return NULL;
+		}
+		/* Migrated buckets are empty anyway. */
+		item = EPOCH_LOAD(bucket->head);
+	}
+	cursor->ptr = item;
+	return item;
+}
+
+static void
+chained_visit_end(void *index, struct HTableCursor *cursor)
+{
+	UNUSED(cursor);
+	struct Chained *chained = index;
+	ON_MUTEX_ERR(pthread_rwlock_unlock(&chained->rehash_guard));
+}
+
+const struct HTableIndexOps htable_chained_ops = {
+	.create = chained_create,
+	.free = chained_free,
+	.lock = chained_lock,
+	.unlock = chained_unlock,
+	.find_locked = chained_find_locked,
+	.insert = chained_insert,
+	.remove = chained_remove,
+	.find = chained_find,
+	.remove_any = chained_remove_any,
+	.sweep = chained_sweep,
+	.maintain = chained_maintain,
+	.visit_begin = chained_visit_begin,
+	.visit_next = chained_visit_next,
+	.visit_end = chained_visit_end,
+};
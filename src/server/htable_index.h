@@ -0,0 +1,158 @@
+#ifndef SOL_SERVER_HTABLE_INDEX
+#define SOL_SERVER_HTABLE_INDEX
+
+#include "htable.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The internal data structure that maps keys to items within a `struct
+ * HTable`. `struct HTable` takes care of file semantics (open and locked files,
+ * contents, eviction, stats), while indices only store items, and there's a
+ * few of them to choose from. See `enum HTableBackend`.
+ *
+ * Indices must allow lock-free lookups from within an epoch (see `epoch.h`),
+ * so they never free items themselves: items are owned by `struct HTable`,
+ * which retires them after removal. */
+
+/* Keys shorter than this are stored within the item itself. */
+#define HTABLE_INLINE_KEY_SIZE 64
+
+/* Per-item bookkeeping of the cache eviction policy, which is free to use
+ * these fields however it likes (see `htable_policy.h`). They're all zero for
+ * new items. */
+struct HTablePolicyData
+{
+	/* Links within intrusive lists of items. */
+	struct HTableItem *next;
+	struct HTableItem *prev;
+	/* E.g. a timestamp, or a position within a heap. */
+	uint64_t position;
+	double priority;
+	/* How many times the item was accessed, more or less. */
+	uint32_t frequency;
+	/* The value of `frequency` when `priority` was last computed. */
+	uint32_t ranked_frequency;
+	/* Which of the lists of the policy holds the item, if any. */
+	uint8_t list;
+	/* Set on every access under the CLOCK policy, and cleared by its hand. */
+	bool referenced;
+};
+
+/* Items take up 176 bytes on 64-bit platforms, about half of which is the inline
+ * key: three cache lines, or two for lookups that stop at `hash`. Items
+ * are slab-allocated, so they share lines with their neighbors; `htable.c` makes
+ * sure they don't grow past three lines. */
+struct HTableItem
+{
+	struct File file;
+	/* The full hash of `file.key`, so that indices never need to compute it
+	 * again. */
+	uint64_t hash;
+	size_t key_len;
+	/* Reserved for the index. */
+	struct HTableItem *next;
+	struct HTableItem *prev;
+	/* Reserved for the cache eviction policy. */
+	struct HTablePolicyData policy;
+	/* `file.key` points here if the key is short enough. */
+	char key_inline[HTABLE_INLINE_KEY_SIZE];
+};
+
+/* Index-specific iteration state. */
+struct HTableCursor
+{
+	size_t i;
+	size_t j;
+	void *ptr;
+};
+
+struct HTableIndexOps
+{
+	/* Creates an empty index that can comfortably hold `capacity` items. */
+	void *(*create)(size_t capacity);
+	/* Frees `index` and all items still within it with `htable_item_free`. */
+	void (*free)(void *index);
+	/* Locks the portion of `index` that is responsible for `hash`, so that no
+	 * other writer can touch it. Must be called within an epoch. */
+	void (*lock)(void *index, uint64_t hash);
+	void (*unlock)(void *index, uint64_t hash);
+	/* Searches `key` within `index`. `key->hash` must be locked. */
+	struct HTableItem *(*find_locked)(void *index, const struct HTableKey *key);
+	/* Inserts `item`, whose key is not yet in `index`. `item->hash` must be
+	 * locked. */
+	void (*insert)(void *index, struct HTableItem *item);
+	/* Removes `item` from `index`. `item->hash` must be locked. Lock-free
+	 * readers might still be looking at it afterwards. */
+	void (*remove)(void *index, struct HTableItem *item);
+	/* Searches `key` within `index` without any lock. Must be called within an
+	 * epoch. */
+	struct HTableItem *(*find)(void *index, const struct HTableKey *key);
+	/* Removes and returns some item picked according to `seed`, or NULL if
+	 * there's none where it looked. Indices should skip empty regions cheaply,
+	 * so that sparse tables don't make callers spin. Spared items are left
+	 * alone. No lock must be held, but it must be called within an epoch. */
+	struct HTableItem *(*remove_any)(void *index, uint64_t seed);
+	/* Moves the CLOCK hand `*hand` over the next few items, clearing their
+	 * reference bits, and removes and returns the first one whose bit was clear
+	 * already, if any. Spared items are skipped. Repeated calls eventually sweep
+	 * over all items, starting from `*hand = 0`. No lock must be held, but it
+	 * must be called within an epoch. */
+	struct HTableItem *(*sweep)(void *index, uint64_t *hand);
+	/* Called without any lock after every operation that changes the number of
+	 * items, which is `items_count`. */
+	void (*maintain)(void *index, size_t items_count);
+	/* Iterates over all items within `index`. Items might be concurrently
+	 * removed, but no item is ever visited twice. Must be called within an
+	 * epoch. */
+	void (*visit_begin)(void *index, struct HTableCursor *cursor);
+	struct HTableItem *(*visit_next)(void *index, struct HTableCursor *cursor);
+	void (*visit_end)(void *index, struct HTableCursor *cursor);
+};
+
+/* Separate chaining with incremental rehashing. */
+extern const struct HTableIndexOps htable_chained_ops;
+/* Open addressing with SIMD fingerprint probing. */
+extern const struct HTableIndexOps htable_swiss_ops;
+
+/* Compares hashes first, so that it's cheap to call on items that don't
+ * match. */
+static inline bool
+htable_item_has_key(const struct HTableItem *item, const struct HTableKey *key)
+{
+	return item->hash == key->hash && item->key_len == key->len &&
+	       memcmp(item->file.key, key->ptr, key->len) == 0;
+}
+
+/* Clears the reference bit of `item` and returns its previous value. Readers
+ * might set it again at any time. */
+static inline bool
+htable_item_clear_referenced(struct HTableItem *item)
+{
+	/* Most bits are clear, and loads don't dirty the cache line. */
+	return __atomic_load_n(&item->policy.referenced, __ATOMIC_RELAXED) &&
+	       __atomic_exchange_n(&item->policy.referenced, false, __ATOMIC_RELAXED);
+}
+
+/* Whether `file`, which must be locked, has to stay within the index whatever
+ * the cache eviction policy says: pinned files, open ones that some client is
+ * using, and those that clients are waiting to lock, since they'd never hear
+ * back otherwise. Locks alone outlive `closeFile`, so they don't tell us much. */
+static inline bool
+htable_file_is_spared(const struct File *file)
+{
+	return file->is_pinned || file->is_open || file->subs;
+}
+
+static inline bool
+htable_item_is_spared(const struct HTableItem *item)
+{
+	return htable_file_is_spared(&item->file);
+}
+
+/* Immediately frees `item` (a `struct HTableItem *`) and everything it owns. */
+void
+htable_item_free(void *item);
+
+#endif
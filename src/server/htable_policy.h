@@ -0,0 +1,123 @@
+#ifndef SOL_SERVER_HTABLE_POLICY
+#define SOL_SERVER_HTABLE_POLICY
+
+#include "htable.h"
+#include "htable_index.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The cache eviction policy of a `struct HTable`, which picks the files to
+ * evict whenever there's too many of them. There's a few policies to choose
+ * from; see `enum CacheEvictionPolicy`.
+ *
+ * `struct HTable` tells policies about items entering and leaving its index,
+ * and policies keep their own bookkeeping within items (see `struct
+ * HTablePolicyData`), so they never need to copy keys nor to look them up. */
+
+/* Policies that keep items in some order give up on `pick_victim` after this
+ * many items in a row couldn't be evicted, most likely because they're spared,
+ * so that crowds of spared items don't make eviction crawl. Spared items are
+ * handed back through `on_insert`, so the next try starts from other ones.
+ * Policies that look for victims within the index also check
+ * `htable_has_victims` before each attempt. */
+#define HTABLE_POLICY_MAX_ATTEMPTS 64
+
+struct HTablePolicyOps
+{
+	/* Creates the state of a policy for `htable`, which is meant to hold up to
+	 * `max_items_count` files. */
+	void *(*create)(struct HTable *htable, size_t max_items_count);
+	void (*free)(void *policy);
+	/* Called right after `item` enters the index, with `item->hash` locked.
+	 * Items that `pick_victim` returned might enter the index again. */
+	void (*on_insert)(void *policy, struct HTableItem *item);
+	/* Records an access to `item`. The caller must be within an epoch, but
+	 * `item` needn't be locked. */
+	void (*on_access)(void *policy, struct HTableItem *item);
+	/* Called right after the contents of `item` change, with `item->hash`
+	 * locked. */
+	void (*on_update)(void *policy, struct HTableItem *item);
+	/* Called right after `item` leaves the index, with `item->hash` locked,
+	 * unless it was `pick_victim` that removed it. */
+	void (*on_remove)(void *policy, struct HTableItem *item);
+	/* Removes some item from the index by means of `htable_evict_item` (or
+	 * similar) and returns it, or returns NULL if there's none. Spared items
+	 * (see `htable_item_is_spared`) can't be removed, so it must give up at
+	 * some point if there's nothing else. Only one thread at a time calls it,
+	 * within an epoch and without any lock. */
+	struct HTableItem *(*pick_victim)(void *policy);
+};
+
+extern const struct HTablePolicyOps policy_fifo_ops;
+extern const struct HTablePolicyOps policy_segmented_fifo_ops;
+extern const struct HTablePolicyOps policy_lru_ops;
+extern const struct HTablePolicyOps policy_clock_ops;
+extern const struct HTablePolicyOps policy_s3fifo_ops;
+extern const struct HTablePolicyOps policy_gdsf_ops;
+
+/* Removes `item` from the index of `htable`, unless somebody else removed it
+ * already or it's spared, in which case it returns false. Spared items are
+ * handed back to the policy through `on_insert`. Must be called within an
+ * epoch. */
+bool
+htable_evict_item(struct HTable *htable, struct HTableItem *item);
+
+/* Returns false if all files within `htable` are spared, or there's none. */
+bool
+htable_has_victims(const struct HTable *htable);
+
+/* Same as `remove_any` within `struct HTableIndexOps`. */
+struct HTableItem *
+htable_evict_any(struct HTable *htable, uint64_t seed);
+
+/* Same as `sweep` within `struct HTableIndexOps`. */
+struct HTableItem *
+htable_evict_sweep(struct HTable *htable, uint64_t *hand);
+
+/* An intrusive, doubly linked list of items, linked through `policy.next` and
+ * `policy.prev`. New items are pushed at `head`. It's up to policies to
+ * protect lists with a lock, but `count` can be read without it. */
+struct HTableItemList
+{
+	struct HTableItem *head;
+	struct HTableItem *tail;
+	size_t count;
+};
+
+static inline void
+item_list_push(struct HTableItemList *list, struct HTableItem *item)
+{
+	item->policy.prev = NULL;
+	item->policy.next = list->head;
+	if (list->head) {
+		list->head->policy.prev = item;
+	} else {
+		list->tail = item;
+	}
+	list->head = item;
+	__atomic_store_n(&list->count, list->count + 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+item_list_unlink(struct HTableItemList *list, struct HTableItem *item)
+{
+	if (item->policy.prev) {
+		item->policy.prev->policy.next = item->policy.next;
+	} else {
+		list->head = item->policy.next;
+	}
+	if (item->policy.next) {
+		item->policy.next->policy.prev = item->policy.prev;
+	} else {
+		list->tail = item->policy.prev;
+	}
+	__atomic_store_n(&list->count, list->count - 1, __ATOMIC_RELAXED);
+}
+
+static inline size_t
+item_list_count(const struct HTableItemList *list)
+{
+	return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
+
+#endif
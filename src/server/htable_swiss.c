@@ -0,0 +1,508 @@
+#include "epoch.h"
+#include "global_state.h"
+#include "htable_index.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ThreadSanitizer doesn't understand concurrent SIMD loads, so we fall back to
+ * the portable implementation. */
+#if defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+#define SWISS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* A Swiss table: open addressing over an array of item pointers, plus an
+ * array of control bytes, one per slot. Control bytes hold 7 bits of the hash
+ * of full slots, so that probing compares 16 of them at a time with a couple
+ * of SIMD instructions and only ever looks at items that are very likely to
+ * match.
+ *
+ * The table is split into shards, each with its own lock and its own slot
+ * array, so that writers don't contend with each other. Lock-free readers load
+ * control bytes and slots without any lock: writers always fill a slot before
+ * its control byte, and grow or shrink shards by building a new slot array
+ * and retiring the old one via `epoch_retire`. */
+
+/* Must be a power of two. */
+#define SWISS_SHARDS_COUNT 64
+#define SWISS_SHARD_BITS 6
+/* Slots are probed in groups of this many. */
+#define SWISS_GROUP_SIZE 16
+/* Shards never shrink below this many slots. Must be a power of two and a
+ * multiple of `SWISS_GROUP_SIZE`. */
+#define SWISS_MIN_CAPACITY 16
+/* Shards grow as soon as 7/8 of their slots are taken (including deleted
+ * ones), and shrink as soon as less than 1/8 of them are full. */
+#define SWISS_MAX_LOAD_NUM 7
+#define SWISS_MAX_LOAD_DEN 8
+#define SWISS_MIN_LOAD_DEN 8
+
+#define SWISS_CTRL_EMPTY ((uint8_t)0x80)
+#define SWISS_CTRL_DELETED ((uint8_t)0xFE)
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error during hash table internal manipulation.")
+
+struct SwissTable
+{
+	/* Always a power of two, and a multiple of `SWISS_GROUP_SIZE`. */
+	size_t capacity;
+	/* Full slots. */
+	size_t used;
+	/* Slots that held an item once and can't be marked as empty again, lest
+	 * probe sequences get broken. */
+	size_t deleted;
+	uint8_t *ctrl;
+	struct HTableItem **slots;
+};
+
+struct SwissShard
+{
+	pthread_mutex_t guard;
+	/* Read by lock-free readers, replaced on resize. */
+	struct SwissTable *table;
+};
+
+struct Swiss
+{
+	struct SwissShard shards[SWISS_SHARDS_COUNT];
+};
+
+/* The top bits of the hash select the shard, the next 7 go into the control
+ * bytes, and the bottom bits select the first group to probe. */
+static size_t
+swiss_shard_i(uint64_t hash)
+{
+	return hash >> (64 - SWISS_SHARD_BITS);
+}
+
+static uint8_t
+swiss_h2(uint64_t hash)
+{
+	return (hash >> (64 - SWISS_SHARD_BITS - 7)) & 0x7F;
+}
+
+static struct SwissTable *
+swiss_table_create(size_t capacity)
+{
+	assert(capacity % SWISS_GROUP_SIZE == 0);
+	/* Slots first, so that they are properly aligned. */
+	struct SwissTable *table = xmalloc(sizeof(struct SwissTable) +
+	                                   capacity * sizeof(struct HTableItem *) + capacity);
+	table->capacity = capacity;
+	table->used = 0;
+	table->deleted = 0;
+	table->slots = (struct HTableItem **)(table + 1);
+	table->ctrl = (uint8_t *)(table->slots + capacity);
+	memset(table->ctrl, SWISS_CTRL_EMPTY, capacity);
+	memset(table->slots, 0, capacity * sizeof(struct HTableItem *));
+	return table;
+}
+
+/************ GROUP MATCHING ***********/
+
+/* Returns a bitmask of the control bytes within the group at `ctrl` that are
+ * equal to `byte`. */
+static unsigned
+swiss_group_match(const uint8_t *ctrl, uint8_t byte)
+{
+#ifdef SWISS_USE_SSE2
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+	unsigned mask = 0;
+	for (unsigned i = 0; i < SWISS_GROUP_SIZE; i++) {
+		if (__atomic_load_n(&ctrl[i], __ATOMIC_RELAXED) == byte) {
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/* Returns a bitmask of the empty or deleted control bytes within the group at
+ * `ctrl`. Full control bytes never have the highest bit set. */
+static unsigned
+swiss_group_match_free(const uint8_t *ctrl)
+{
+#ifdef SWISS_USE_SSE2
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	unsigned mask = 0;
+	for (unsigned i = 0; i < SWISS_GROUP_SIZE; i++) {
+		if (__atomic_load_n(&ctrl[i], __ATOMIC_RELAXED) & 0x80) {
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+static unsigned
+lowest_bit_i(unsigned mask)
+{
+	return __builtin_ctz(mask);
+}
+
+/************ PROBING ***********/
+
+/* Probing visits groups in triangular order (+1, +2, +3...), which covers all
+ * of them when their count is a power of two. */
+struct SwissProbe
+{
+	size_t groups_mask;
+	size_t group;
+	size_t stride;
+};
+
+static struct SwissProbe
+swiss_probe_start(const struct SwissTable *table, uint64_t hash)
+{
+	struct SwissProbe probe;
+	probe.groups_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+	probe.group = hash & probe.groups_mask;
+	probe.stride = 0;
+	return probe;
+}
+
+static void
+swiss_probe_next(struct SwissProbe *probe)
+{
+	probe->stride++;
+	probe->group = (probe->group + probe->stride) & probe->groups_mask;
+}
+
+/* Searches `key` within `table`. Safe without the shard lock, as long as the
+ * caller is within an epoch. */
+static struct HTableItem *
+swiss_table_find(struct SwissTable *table, const struct HTableKey *key)
+{
+	uint8_t h2 = swiss_h2(key->hash);
+	struct SwissProbe probe = swiss_probe_start(table, key->hash);
+	for (size_t i = 0; i <= probe.groups_mask; i++) {
+		const uint8_t *ctrl = &table->ctrl[probe.group * SWISS_GROUP_SIZE];
+		unsigned matches = swiss_group_match(ctrl, h2);
+		unsigned empty = swiss_group_match(ctrl, SWISS_CTRL_EMPTY);
+		/* Slots are always filled before their control byte. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		while (matches) {
+			size_t slot = probe.group * SWISS_GROUP_SIZE + lowest_bit_i(matches);
+			struct HTableItem *item = EPOCH_LOAD(table->slots[slot]);
+			if (item && htable_item_has_key(item, key)) {
+				return item;
+			}
+			matches &= matches - 1;
+		}
+		if (empty) {
+			return NULL;
+		}
+		swiss_probe_next(&probe);
+	}
+	return NULL;
+}
+
+/* Puts `item` into the first free slot along its probe sequence. The caller
+ * must hold the shard lock, and `table` must have at least a free slot. */
+static void
+swiss_table_insert(struct SwissTable *table, struct HTableItem *item)
+{
+	struct SwissProbe probe = swiss_probe_start(table, item->hash);
+	while (true) {
+		const uint8_t *ctrl = &table->ctrl[probe.group * SWISS_GROUP_SIZE];
+		unsigned free_slots = swiss_group_match_free(ctrl);
+		if (free_slots) {
+			size_t slot = probe.group * SWISS_GROUP_SIZE + lowest_bit_i(free_slots);
+			if (table->ctrl[slot] == SWISS_CTRL_DELETED) {
+				table->deleted--;
+			}
+			table->used++;
+			EPOCH_STORE(table->slots[slot], item);
+			EPOCH_STORE(table->ctrl[slot], swiss_h2(item->hash));
+			return;
+		}
+		swiss_probe_next(&probe);
+	}
+}
+
+/* Returns the slot that holds `item` within `table`. The caller must hold the
+ * shard lock. */
+static size_t
+swiss_table_slot_of(struct SwissTable *table, struct HTableItem *item)
+{
+	uint8_t h2 = swiss_h2(item->hash);
+	struct SwissProbe probe = swiss_probe_start(table, item->hash);
+	while (true) {
+		unsigned matches =
+		  swiss_group_match(&table->ctrl[probe.group * SWISS_GROUP_SIZE], h2);
+		while (matches) {
+			size_t slot = probe.group * SWISS_GROUP_SIZE + lowest_bit_i(matches);
+			if (table->slots[slot] == item) {
+				return slot;
+			}
+			matches &= matches - 1;
+		}
+		swiss_probe_next(&probe);
+	}
+}
+
+static void
+swiss_table_remove_at(struct SwissTable *table, size_t slot)
+{
+	/* The slot pointer stays there: lock-free readers check keys anyway. */
+	EPOCH_STORE(table->ctrl[slot], SWISS_CTRL_DELETED);
+	table->used--;
+	table->deleted++;
+}
+
+/************ SHARDS ***********/
+
+/* Replaces the table of `shard` with a new one of size `capacity`, which gets
+ * rid of deleted slots too. The caller must hold the shard lock. */
+static void
+swiss_shard_resize(struct SwissShard *shard, size_t capacity)
+{
+	struct SwissTable *old = shard->table;
+	struct SwissTable *table = swiss_table_create(capacity);
+	for (size_t i = 0; i < old->capacity; i++) {
+		if (!(old->ctrl[i] & 0x80)) {
+			swiss_table_insert(table, old->slots[i]);
+		}
+	}
+	EPOCH_STORE(shard->table, table);
+	/* Readers might still be looking at it. */
+	epoch_retire(old, free);
+}
+
+/* Makes sure the table of `shard` has room for one more item. */
+static void
+swiss_shard_reserve(struct SwissShard *shard)
+{
+	struct SwissTable *table = shard->table;
+	if ((table->used + table->deleted + 1) * SWISS_MAX_LOAD_DEN <=
+	    table->capacity * SWISS_MAX_LOAD_NUM) {
+		return;
+	}
+	/* Plenty of tombstones: a rehash of the same size will do. */
+	size_t capacity = table->capacity;
+	if ((table->used + 1) * SWISS_MAX_LOAD_DEN * 2 > capacity * SWISS_MAX_LOAD_NUM) {
+		capacity *= 2;
+	}
+	swiss_shard_resize(shard, capacity);
+}
+
+static void
+swiss_shard_maybe_shrink(struct SwissShard *shard)
+{
+	struct SwissTable *table = shard->table;
+	if (table->capacity > SWISS_MIN_CAPACITY &&
+	    table->used < table->capacity / SWISS_MIN_LOAD_DEN) {
+		swiss_shard_resize(shard, table->capacity / 2);
+	}
+}
+
+static struct SwissShard *
+swiss_shard(void *index, uint64_t hash)
+{
+	struct Swiss *swiss = index;
+	return &swiss->shards[swiss_shard_i(hash)];
+}
+
+/************ INDEX OPERATIONS ***********/
+
+static void *
+swiss_create(size_t capacity)
+{
+	struct Swiss *swiss = xmalloc(sizeof(struct Swiss));
+	size_t shard_capacity = SWISS_MIN_CAPACITY;
+	while (shard_capacity * SWISS_SHARDS_COUNT < capacity) {
+		shard_capacity *= 2;
+	}
+	for (size_t i = 0; i < SWISS_SHARDS_COUNT; i++) {
+		ON_MUTEX_ERR(pthread_mutex_init(&swiss->shards[i].guard, NULL));
+		swiss->shards[i].table = swiss_table_create(shard_capacity);
+	}
+	return swiss;
+}
+
+static void
+swiss_free(void *index)
+{
+	struct Swiss *swiss = index;
+	for (size_t i = 0; i < SWISS_SHARDS_COUNT; i++) {
+		struct SwissTable *table = swiss->shards[i].table;
+		for (size_t j = 0; j < table->capacity; j++) {
+			if (!(table->ctrl[j] & 0x80)) {
+				htable_item_free(table->slots[j]);
+			}
+		}
+		free(table);
+		ON_MUTEX_ERR(pthread_mutex_destroy(&swiss->shards[i].guard));
+	}
+	free(swiss);
+}
+
+static void
+swiss_lock(void *index, uint64_t hash)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&swiss_shard(index, hash)->guard));
+}
+
+static void
+swiss_unlock(void *index, uint64_t hash)
+{
+	ON_MUTEX_ERR(pthread_mutex_unlock(&swiss_shard(index, hash)->guard));
+}
+
+static struct HTableItem *
+swiss_find_locked(void *index, const struct HTableKey *key)
+{
+	return swiss_table_find(swiss_shard(index, key->hash)->table, key);
+}
+
+static void
+swiss_insert(void *index, struct HTableItem *item)
+{
+	struct SwissShard *shard = swiss_shard(index, item->hash);
+	swiss_shard_reserve(shard);
+	swiss_table_insert(shard->table, item);
+}
+
+static void
+swiss_remove(void *index, struct HTableItem *item)
+{
+	struct SwissShard *shard = swiss_shard(index, item->hash);
+	swiss_table_remove_at(shard->table, swiss_table_slot_of(shard->table, item));
+	swiss_shard_maybe_shrink(shard);
+}
+
+static struct HTableItem *
+swiss_find(void *index, const struct HTableKey *key)
+{
+	return swiss_table_find(EPOCH_LOAD(swiss_shard(index, key->hash)->table), key);
+}
+
+static struct HTableItem *
+swiss_remove_any(void *index, uint64_t seed)
+{
+	struct SwissShard *shard = swiss_shard(index, seed);
+	ON_MUTEX_ERR(pthread_mutex_lock(&shard->guard));
+	struct SwissTable *table = shard->table;
+	struct HTableItem *item = NULL;
+	/* Start from a random group and take the first full slot, a group at a
+	 * time: control bytes are an occupancy bitmap already. */
+	size_t groups_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+	for (size_t i = 0; !item && i <= groups_mask && table->used > 0; i++) {
+		size_t group = (seed + i) & groups_mask;
+		unsigned full = ~swiss_group_match_free(&table->ctrl[group * SWISS_GROUP_SIZE]) &
+		                ((1u << SWISS_GROUP_SIZE) - 1);
+		while (full) {
+			size_t slot = group * SWISS_GROUP_SIZE + lowest_bit_i(full);
+			full &= full - 1;
+			if (!htable_item_is_spared(table->slots[slot])) {
+				item = table->slots[slot];
+				swiss_table_remove_at(table, slot);
+				swiss_shard_maybe_shrink(shard);
+				break;
+			}
+		}
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&shard->guard));
+	return item;
+}
+
+static struct HTableItem *
+swiss_sweep(void *index, uint64_t *hand)
+{
+	/* The hand goes over all shards in turn, a group at a time. */
+	struct Swiss *swiss = index;
+	struct SwissShard *shard = &swiss->shards[*hand % SWISS_SHARDS_COUNT];
+	size_t group = *hand / SWISS_SHARDS_COUNT;
+	(*hand)++;
+	ON_MUTEX_ERR(pthread_mutex_lock(&shard->guard));
+	struct SwissTable *table = shard->table;
+	size_t start = (group * SWISS_GROUP_SIZE) & (table->capacity - 1);
+	struct HTableItem *item = NULL;
+	for (size_t slot = start; slot < start + SWISS_GROUP_SIZE; slot++) {
+		if (!(table->ctrl[slot] & 0x80) && !htable_item_is_spared(table->slots[slot]) &&
+		    !htable_item_clear_referenced(table->slots[slot])) {
+			item = table->slots[slot];
+			swiss_table_remove_at(table, slot);
+			swiss_shard_maybe_shrink(shard);
+			break;
+		}
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&shard->guard));
+	return item;
+}
+
+static void
+swiss_maintain(void *index, size_t items_count)
+{
+	/* Shards resize themselves as needed. */
+	UNUSED(index);
+	UNUSED(items_count);
+}
+
+static void
+swiss_visit_begin(void *index, struct HTableCursor *cursor)
+{
+	UNUSED(index);
+	/* `i` is the current shard, `j` the next slot, and `ptr` the table we're
+	 * visiting. We stick to it even if the shard gets resized in the meantime, so
+	 * that we don't see items twice. */
+	cursor->i = 0;
+	cursor->j = 0;
+	cursor->ptr = NULL;
+}
+
+static struct HTableItem *
+swiss_visit_next(void *index, struct HTableCursor *cursor)
+{
+	struct Swiss *swiss = index;
+	while (cursor->i < SWISS_SHARDS_COUNT) {
+		struct SwissTable *table = cursor->ptr;
+		if (!table) {
+			table = EPOCH_LOAD(swiss->shards[cursor->i].table);
+			cursor->ptr = table;
+		}
+		while (cursor->j < table->capacity) {
+			size_t slot = cursor->j++;
+			if (!(__atomic_load_n(&table->ctrl[slot], __ATOMIC_ACQUIRE) & 0x80)) {
+				return EPOCH_LOAD(table->slots[slot]);
+			}
+		}
+		cursor->i++;
+		cursor->j = 0;
+		cursor->ptr = NULL;
+	}
+	return NULL;
+}
+
+static void
+swiss_visit_end(void *index, struct HTableCursor *cursor)
+{
+	UNUSED(index);
+	UNUSED(cursor);
+}
+
+const struct HTableIndexOps htable_swiss_ops = {
+	.create = swiss_create,
+	.free = swiss_free,
+	.lock = swiss_lock,
+	.unlock = swiss_unlock,
+	.find_locked = swiss_find_locked,
+	.insert = swiss_insert,
+	.remove = swiss_remove,
+	.find = swiss_find,
+	.remove_any = swiss_remove_any,
+	.sweep = swiss_sweep,
+	.maintain = swiss_maintain,
+	.visit_begin = swiss_visit_begin,
+	.visit_next = swiss_visit_next,
+	.visit_end = swiss_visit_end,
+};
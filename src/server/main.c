@@ -1,9 +1,13 @@
+#include "blob.h"
 #include "config.h"
+#include "epoch.h"
+#include "eviction_spool.h"
 #include "global_state.h"
 #include "htable.h"
 #include "logc/src/log.h"
 #include "receiver.h"
 #include "serverapi.h"
+#include "slab.h"
 #include "utilities.h"
 #include "worker.h"
 #include "workload_queue.h"
@@ -75,13 +79,61 @@ listen_for_connections(const char *socket_filepath, int *socket_fd)
 void
 print_summary(void)
 {
-	const struct HTableStats *stats = htable_stats(global_htable);
-	printf("Max. files stored: %lu\n", stats->historical_max_items_count);
-	printf("Max. space in bytes: %lu\n", stats->historical_max_space_in_bytes);
-	printf("Num. of evictions: %lu\n", stats->historical_num_evictions);
+	struct HTableStats stats;
+	htable_stats_snapshot(global_htable, &stats);
+	printf("Max. files stored: %lu\n", stats.historical_max_items_count);
+	printf("Max. space in bytes: %lu\n", stats.historical_max_space_in_bytes);
+	printf("Num. of evictions: %lu\n", stats.historical_num_evictions);
 
-	printf("Current space in bytes: %lu\n", stats->total_space_in_bytes);
-	printf("Current contents of the file storage server: %lu\n", stats->items_count);
+	printf("Current space in bytes: %lu\n", stats.total_space_in_bytes);
+	printf("Current contents of the file storage server: %lu\n", stats.items_count);
+	unsigned long reads = stats.read_hits + stats.read_misses;
+	printf("Read hit ratio: %.2f%% (%lu reads)\n",
+	       reads > 0 ? 100.0 * stats.read_hits / reads : 0.0,
+	       reads);
+	printf("New files rejected by the admission filter: %lu\n", stats.admission_rejections);
+	if (stats.tier_items_count + stats.tier_promotions + stats.tier_overflows > 0) {
+		printf("Files within the compressed tier: %zu (%zu bytes)\n",
+		       stats.tier_items_count,
+		       stats.tier_space_in_bytes);
+		printf("Files promoted back from the compressed tier: %lu\n",
+		       stats.tier_promotions);
+	}
+	if (stats.spill_items_count + stats.spill_promotions + stats.spill_overflows > 0) {
+		printf("Files within the spill tier: %zu (%zu bytes on disk)\n",
+		       stats.spill_items_count,
+		       stats.spill_space_in_bytes);
+		printf("Files promoted back from the spill tier: %lu\n", stats.spill_promotions);
+	}
+	if (htable_eviction_spool(global_htable)) {
+		struct EvictionSpoolStats spool;
+		eviction_spool_stats(htable_eviction_spool(global_htable), &spool);
+		printf("Evicted files written to the spool: %lu (%zu queued, %lu lost)\n",
+		       spool.spooled,
+		       spool.queued_count,
+		       spool.failures);
+	}
+
+	struct SlabStats slab;
+	slab_stats(&slab);
+	printf("Metadata memory in bytes: %zu (%zu reserved for slabs)\n",
+	       slab.used_bytes + slab.large_bytes,
+	       slab.reserved_bytes);
+
+	struct BlobCompressionStats compression;
+	blob_compression_stats(&compression);
+	if (compression.compressed_count + compression.skipped_count > 0) {
+		printf("Compressed files: %zu (%zu skipped)\n",
+		       compression.compressed_count,
+		       compression.skipped_count);
+		printf("Compression ratio: %.2f\n",
+		       compression.compressed_bytes > 0
+		         ? (double)compression.raw_bytes / compression.compressed_bytes
+		         : 1.0);
+		printf("CPU time compressing / decompressing in ms: %.1f / %.1f\n",
+		       compression.compression_ns / 1e6,
+		       compression.decompression_ns / 1e6);
+	}
 
 	struct HTableVisitor *visitor = htable_visit(global_htable, 0);
 	struct File *current_file = htable_visitor_next(visitor);
@@ -89,7 +141,7 @@ print_summary(void)
 	/* Visual separator. */
 	printf("================\n");
 	while (current_file) {
-		printf("- %lu (size): %lu\n", i, current_file->length_in_bytes);
+		printf("- %lu (size): %lu\n", i, current_file->contents->length_in_bytes);
 		printf("  %lu (path): %s\n", i, current_file->key);
 		current_file = htable_visitor_next(visitor);
 		i++;
@@ -125,6 +177,7 @@ inner_main(struct Config *config)
 		}
 		return -1;
 	}
+	epoch_reclaimer_spawn();
 	glog_info("Now spawning %d worker threads...", config->num_workers);
 	workers_spawn(config->num_workers);
 	glog_info("Done.");
@@ -155,6 +208,10 @@ inner_main(struct Config *config)
 	receiver_free(receiver);
 	glog_info("Done.");
 	htable_free(global_htable);
+	/* Only now that nobody can possibly be reading it. */
+	epoch_reclaimer_join();
+	blob_pool_clear();
+	slab_clear();
 	config_free(global_config);
 	glog_info("Goodbye!");
 	workload_queues_free();
@@ -203,9 +260,8 @@ main(int argc, char **argv)
 	 * place. */
 	unlink(config->socket_filepath);
 	workload_queues_init(config->num_workers);
-	/* Initialize the global hash table with a reasonable number of buckets.
-	 * Ideally this should be set with a goal load factor, but we're splitting
-	 * hairs... */
-	global_htable = htable_create(config->max_files, config);
+	/* Initialize the global hash table. We can start small, as it resizes itself
+	 * to keep a sensible load factor. */
+	global_htable = htable_create(1, config);
 	return inner_main(config);
 }
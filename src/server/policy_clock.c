@@ -0,0 +1,76 @@
+#include "htable_policy.h"
+#include "utilities.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Second chance: accesses set the reference bit of items, and the hand of the
+ * clock sweeps over the index, clearing bits until it finds an item whose bit
+ * was clear already. */
+struct PolicyClock
+{
+	struct HTable *htable;
+	/* Only touched by `pick_victim`. */
+	uint64_t hand;
+};
+
+static void *
+clock_create(struct HTable *htable, size_t max_items_count)
+{
+	UNUSED(max_items_count);
+	struct PolicyClock *clock = xmalloc(sizeof(struct PolicyClock));
+	clock->htable = htable;
+	clock->hand = 0;
+	return clock;
+}
+
+static void
+clock_free(void *policy)
+{
+	free(policy);
+}
+
+static void
+clock_on_item(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	UNUSED(item);
+}
+
+static void
+clock_on_access(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	/* Hot items are always referenced already, so we don't keep writing to
+	 * their cache line. */
+	if (!__atomic_load_n(&item->policy.referenced, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&item->policy.referenced, true, __ATOMIC_RELAXED);
+	}
+}
+
+static struct HTableItem *
+clock_pick_victim(void *policy)
+{
+	struct PolicyClock *clock = policy;
+	/* Stats lag behind, so they might promise victims that aren't there. The
+	 * hand stays where it is, so the next call picks up the sweep from there. */
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		if (!htable_has_victims(clock->htable)) {
+			break;
+		}
+		struct HTableItem *item = htable_evict_sweep(clock->htable, &clock->hand);
+		if (item) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_clock_ops = {
+	.create = clock_create,
+	.free = clock_free,
+	.on_insert = clock_on_item,
+	.on_access = clock_on_access,
+	.on_update = clock_on_access,
+	.on_remove = clock_on_item,
+	.pick_victim = clock_pick_victim,
+};
@@ -0,0 +1,98 @@
+#include "global_state.h"
+#include "htable_policy.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <pthread.h>
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error within the cache eviction policy.")
+
+/* Files are evicted in creation order. Items are added and removed under both
+ * their index lock and `guard`, in this order, and `policy.list` tells whether
+ * they're within `queue`. */
+struct PolicyFifo
+{
+	struct HTable *htable;
+	pthread_mutex_t guard;
+	struct HTableItemList queue;
+};
+
+static void *
+fifo_create(struct HTable *htable, size_t max_items_count)
+{
+	UNUSED(max_items_count);
+	struct PolicyFifo *fifo = xmalloc(sizeof(struct PolicyFifo));
+	fifo->htable = htable;
+	ON_MUTEX_ERR(pthread_mutex_init(&fifo->guard, NULL));
+	fifo->queue = (struct HTableItemList){ NULL, NULL, 0 };
+	return fifo;
+}
+
+static void
+fifo_free(void *policy)
+{
+	struct PolicyFifo *fifo = policy;
+	/* Items belong to the index. */
+	ON_MUTEX_ERR(pthread_mutex_destroy(&fifo->guard));
+	free(fifo);
+}
+
+static void
+fifo_on_insert(void *policy, struct HTableItem *item)
+{
+	struct PolicyFifo *fifo = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&fifo->guard));
+	item_list_push(&fifo->queue, item);
+	item->policy.list = 1;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&fifo->guard));
+}
+
+static void
+fifo_on_access(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	UNUSED(item);
+}
+
+static void
+fifo_on_remove(void *policy, struct HTableItem *item)
+{
+	struct PolicyFifo *fifo = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&fifo->guard));
+	/* `pick_victim` might have taken it already. */
+	if (item->policy.list) {
+		item_list_unlink(&fifo->queue, item);
+		item->policy.list = 0;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&fifo->guard));
+}
+
+static struct HTableItem *
+fifo_pick_victim(void *policy)
+{
+	struct PolicyFifo *fifo = policy;
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		ON_MUTEX_ERR(pthread_mutex_lock(&fifo->guard));
+		struct HTableItem *item = fifo->queue.tail;
+		if (item) {
+			item_list_unlink(&fifo->queue, item);
+			item->policy.list = 0;
+		}
+		ON_MUTEX_ERR(pthread_mutex_unlock(&fifo->guard));
+		/* The file might have been removed in the meantime, or be spared. */
+		if (!item || htable_evict_item(fifo->htable, item)) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_fifo_ops = {
+	.create = fifo_create,
+	.free = fifo_free,
+	.on_insert = fifo_on_insert,
+	.on_access = fifo_on_access,
+	.on_update = fifo_on_access,
+	.on_remove = fifo_on_remove,
+	.pick_victim = fifo_pick_victim,
+};
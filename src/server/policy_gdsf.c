@@ -0,0 +1,242 @@
+#include "blob.h"
+#include "epoch.h"
+#include "global_state.h"
+#include "htable_policy.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <pthread.h>
+
+#define GDSF_INITIAL_HEAP_CAPACITY 64
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error within the cache eviction policy.")
+
+/* GreedyDual-Size-Frequency: items are ranked by `L + frequency / size`, where
+ * `L` is the priority of the last evicted item, and the lowest ranked goes
+ * first. All files cost the same to bring back, so that's the number of hits
+ * we're maximizing, and small files are cheaper to keep around.
+ *
+ * Items are kept in a binary min-heap by `policy.priority`, and remember their
+ * position in `policy.position`; `policy.list` tells whether they're within
+ * the heap at all. Hits only increment `policy.frequency`, so priorities
+ * within the heap might be stale: items that were hit since they were last
+ * ranked are ranked again when they reach the top of the heap, and all items
+ * are when their size changes. Items are added and removed under both their
+ * index lock and `guard`, in this order. */
+struct PolicyGdsf
+{
+	struct HTable *htable;
+	pthread_mutex_t guard;
+	struct HTableItem **heap;
+	size_t count;
+	size_t capacity;
+	/* `L`. It never decreases. */
+	double inflation;
+};
+
+static void *
+gdsf_create(struct HTable *htable, size_t max_items_count)
+{
+	UNUSED(max_items_count);
+	struct PolicyGdsf *gdsf = xmalloc(sizeof(struct PolicyGdsf));
+	gdsf->htable = htable;
+	ON_MUTEX_ERR(pthread_mutex_init(&gdsf->guard, NULL));
+	gdsf->capacity = GDSF_INITIAL_HEAP_CAPACITY;
+	gdsf->heap = xmalloc(sizeof(struct HTableItem *) * gdsf->capacity);
+	gdsf->count = 0;
+	gdsf->inflation = 0.0;
+	return gdsf;
+}
+
+static void
+gdsf_free(void *policy)
+{
+	struct PolicyGdsf *gdsf = policy;
+	/* Items belong to the index. */
+	ON_MUTEX_ERR(pthread_mutex_destroy(&gdsf->guard));
+	free(gdsf->heap);
+	free(gdsf);
+}
+
+/* Brings the priority of `item` up to date. The caller must hold `guard`, and
+ * either hold the lock of `item` or be within an epoch. Creating a file counts
+ * as its first access. */
+static void
+gdsf_rank_locked(const struct PolicyGdsf *gdsf, struct HTableItem *item)
+{
+	size_t size = blob_storage_size(EPOCH_LOAD(item->file.contents));
+	uint32_t frequency = __atomic_load_n(&item->policy.frequency, __ATOMIC_RELAXED);
+	item->policy.ranked_frequency = frequency;
+	item->policy.priority =
+	  gdsf->inflation + (double)(frequency + 1) / (size > 0 ? size : 1);
+}
+
+static void
+gdsf_heap_set(struct PolicyGdsf *gdsf, size_t i, struct HTableItem *item)
+{
+	gdsf->heap[i] = item;
+	item->policy.position = i;
+}
+
+static void
+gdsf_sift_up(struct PolicyGdsf *gdsf, size_t i)
+{
+	struct HTableItem *item = gdsf->heap[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (gdsf->heap[parent]->policy.priority <= item->policy.priority) {
+			break;
+		}
+		gdsf_heap_set(gdsf, i, gdsf->heap[parent]);
+		i = parent;
+	}
+	gdsf_heap_set(gdsf, i, item);
+}
+
+static void
+gdsf_sift_down(struct PolicyGdsf *gdsf, size_t i)
+{
+	struct HTableItem *item = gdsf->heap[i];
+	while (true) {
+		size_t child = 2 * i + 1;
+		if (child >= gdsf->count) {
+			break;
+		}
+		if (child + 1 < gdsf->count &&
+		    gdsf->heap[child + 1]->policy.priority < gdsf->heap[child]->policy.priority) {
+			child++;
+		}
+		if (item->policy.priority <= gdsf->heap[child]->policy.priority) {
+			break;
+		}
+		gdsf_heap_set(gdsf, i, gdsf->heap[child]);
+		i = child;
+	}
+	gdsf_heap_set(gdsf, i, item);
+}
+
+/* Moves the item at position `i` wherever its priority says. */
+static void
+gdsf_fix_locked(struct PolicyGdsf *gdsf, size_t i)
+{
+	if (i > 0 && gdsf->heap[i]->policy.priority < gdsf->heap[(i - 1) / 2]->policy.priority) {
+		gdsf_sift_up(gdsf, i);
+	} else {
+		gdsf_sift_down(gdsf, i);
+	}
+}
+
+static void
+gdsf_remove_locked(struct PolicyGdsf *gdsf, struct HTableItem *item)
+{
+	size_t i = item->policy.position;
+	item->policy.list = 0;
+	gdsf->count--;
+	if (i < gdsf->count) {
+		gdsf_heap_set(gdsf, i, gdsf->heap[gdsf->count]);
+		gdsf_fix_locked(gdsf, i);
+	}
+}
+
+static void
+gdsf_on_insert(void *policy, struct HTableItem *item)
+{
+	struct PolicyGdsf *gdsf = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&gdsf->guard));
+	if (gdsf->count == gdsf->capacity) {
+		gdsf->capacity *= 2;
+		gdsf->heap = xrealloc(gdsf->heap, sizeof(struct HTableItem *) * gdsf->capacity);
+	}
+	gdsf_rank_locked(gdsf, item);
+	item->policy.list = 1;
+	gdsf_heap_set(gdsf, gdsf->count, item);
+	gdsf->count++;
+	gdsf_sift_up(gdsf, gdsf->count - 1);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&gdsf->guard));
+}
+
+static void
+gdsf_on_access(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	/* The heap catches up lazily. */
+	__atomic_fetch_add(&item->policy.frequency, 1, __ATOMIC_RELAXED);
+}
+
+/* Sizes matter, so the priority of `item` must be brought up to date right
+ * away. */
+static void
+gdsf_on_update(void *policy, struct HTableItem *item)
+{
+	struct PolicyGdsf *gdsf = policy;
+	gdsf_on_access(gdsf, item);
+	ON_MUTEX_ERR(pthread_mutex_lock(&gdsf->guard));
+	if (item->policy.list) {
+		gdsf_rank_locked(gdsf, item);
+		gdsf_fix_locked(gdsf, item->policy.position);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&gdsf->guard));
+}
+
+static void
+gdsf_on_remove(void *policy, struct HTableItem *item)
+{
+	struct PolicyGdsf *gdsf = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&gdsf->guard));
+	/* `pick_victim` might have taken it already. */
+	if (item->policy.list) {
+		gdsf_remove_locked(gdsf, item);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&gdsf->guard));
+}
+
+/* Removes the item with the lowest priority from the heap and returns it, or
+ * NULL if there's none. */
+static struct HTableItem *
+gdsf_pop(struct PolicyGdsf *gdsf)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&gdsf->guard));
+	struct HTableItem *item = NULL;
+	while (gdsf->count > 0) {
+		item = gdsf->heap[0];
+		/* It might have been accessed since it got its priority. */
+		if (__atomic_load_n(&item->policy.frequency, __ATOMIC_RELAXED) ==
+		    item->policy.ranked_frequency) {
+			break;
+		}
+		gdsf_rank_locked(gdsf, item);
+		gdsf_sift_down(gdsf, 0);
+	}
+	if (gdsf->count > 0) {
+		gdsf->inflation = item->policy.priority;
+		gdsf_remove_locked(gdsf, item);
+	} else {
+		item = NULL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&gdsf->guard));
+	return item;
+}
+
+static struct HTableItem *
+gdsf_pick_victim(void *policy)
+{
+	struct PolicyGdsf *gdsf = policy;
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		struct HTableItem *item = gdsf_pop(gdsf);
+		/* The file might have been removed in the meantime, or be spared. */
+		if (!item || htable_evict_item(gdsf->htable, item)) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_gdsf_ops = {
+	.create = gdsf_create,
+	.free = gdsf_free,
+	.on_insert = gdsf_on_insert,
+	.on_access = gdsf_on_access,
+	.on_update = gdsf_on_update,
+	.on_remove = gdsf_on_remove,
+	.pick_victim = gdsf_pick_victim,
+};
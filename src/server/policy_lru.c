@@ -0,0 +1,139 @@
+#include "global_state.h"
+#include "htable_policy.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <errno.h>
+#include <pthread.h>
+
+/* Items are only moved to the head of the LRU list on access if they aren't
+ * among the most recently moved 1/LRU_PROMOTION_FRACTION of all items already,
+ * so that hot items don't keep taking the lock. */
+#define LRU_PROMOTION_FRACTION 4
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error within the cache eviction policy.")
+
+/* Least recently used: items are kept in recency order, most recently used
+ * first. Items are added and removed under both their index lock and `guard`,
+ * in this order, and `policy.list` tells whether they're within `list`. */
+struct PolicyLru
+{
+	struct HTable *htable;
+	pthread_mutex_t guard;
+	struct HTableItemList list;
+	/* Incremented every time an item is moved to the head of `list`. Items
+	 * remember its value at that time in `policy.position`. */
+	uint64_t clock;
+};
+
+static void *
+lru_create(struct HTable *htable, size_t max_items_count)
+{
+	UNUSED(max_items_count);
+	struct PolicyLru *lru = xmalloc(sizeof(struct PolicyLru));
+	lru->htable = htable;
+	ON_MUTEX_ERR(pthread_mutex_init(&lru->guard, NULL));
+	lru->list = (struct HTableItemList){ NULL, NULL, 0 };
+	lru->clock = 0;
+	return lru;
+}
+
+static void
+lru_free(void *policy)
+{
+	struct PolicyLru *lru = policy;
+	/* Items belong to the index. */
+	ON_MUTEX_ERR(pthread_mutex_destroy(&lru->guard));
+	free(lru);
+}
+
+static void
+lru_push_locked(struct PolicyLru *lru, struct HTableItem *item)
+{
+	item_list_push(&lru->list, item);
+	item->policy.list = 1;
+	/* Read without the lock by `lru_on_access`. */
+	__atomic_store_n(&item->policy.position,
+	                 __atomic_add_fetch(&lru->clock, 1, __ATOMIC_RELAXED),
+	                 __ATOMIC_RELAXED);
+}
+
+static void
+lru_unlink_locked(struct PolicyLru *lru, struct HTableItem *item)
+{
+	item_list_unlink(&lru->list, item);
+	item->policy.list = 0;
+}
+
+static void
+lru_on_insert(void *policy, struct HTableItem *item)
+{
+	struct PolicyLru *lru = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&lru->guard));
+	lru_push_locked(lru, item);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&lru->guard));
+}
+
+static void
+lru_on_access(void *policy, struct HTableItem *item)
+{
+	struct PolicyLru *lru = policy;
+	uint64_t clock = __atomic_load_n(&lru->clock, __ATOMIC_RELAXED);
+	uint64_t tick = __atomic_load_n(&item->policy.position, __ATOMIC_RELAXED);
+	if (clock - tick <= item_list_count(&lru->list) / LRU_PROMOTION_FRACTION) {
+		return;
+	}
+	/* Promotions are only hints, so there's no point in waiting. */
+	int err = pthread_mutex_trylock(&lru->guard);
+	if (err == EBUSY) {
+		return;
+	}
+	ON_MUTEX_ERR(err);
+	/* It might have been removed in the meantime. */
+	if (item->policy.list && lru->list.head != item) {
+		lru_unlink_locked(lru, item);
+		lru_push_locked(lru, item);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&lru->guard));
+}
+
+static void
+lru_on_remove(void *policy, struct HTableItem *item)
+{
+	struct PolicyLru *lru = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&lru->guard));
+	/* `pick_victim` might have taken it already. */
+	if (item->policy.list) {
+		lru_unlink_locked(lru, item);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&lru->guard));
+}
+
+static struct HTableItem *
+lru_pick_victim(void *policy)
+{
+	struct PolicyLru *lru = policy;
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		ON_MUTEX_ERR(pthread_mutex_lock(&lru->guard));
+		struct HTableItem *item = lru->list.tail;
+		if (item) {
+			lru_unlink_locked(lru, item);
+		}
+		ON_MUTEX_ERR(pthread_mutex_unlock(&lru->guard));
+		/* The file might have been removed in the meantime, or be spared. */
+		if (!item || htable_evict_item(lru->htable, item)) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_lru_ops = {
+	.create = lru_create,
+	.free = lru_free,
+	.on_insert = lru_on_insert,
+	.on_access = lru_on_access,
+	.on_update = lru_on_access,
+	.on_remove = lru_on_remove,
+	.pick_victim = lru_pick_victim,
+};
@@ -0,0 +1,218 @@
+#include "global_state.h"
+#include "htable_policy.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <pthread.h>
+#include <string.h>
+
+/* The small queue holds this fraction of the maximum number of files. */
+#define S3FIFO_SMALL_FRACTION 10
+/* Access counters saturate here, so that files that used to be popular
+ * don't stay around forever. */
+#define S3FIFO_MAX_ACCESS_COUNT 3
+#define S3FIFO_MIN_GHOST_SLOTS 64
+#define S3FIFO_MAX_GHOST_SLOTS (1 << 20)
+
+/* Values of `policy.list`. */
+#define S3FIFO_LIST_NONE 0
+#define S3FIFO_LIST_SMALL 1
+#define S3FIFO_LIST_MAIN 2
+
+#define ON_MUTEX_ERR(err)                                                                  \
+	ON_ERR((err), "Unexpected mutex error within the cache eviction policy.")
+
+/* Recently evicted keys are remembered by hash in a direct-mapped table, along
+ * with the time of their eviction. Colliding keys simply replace each other. */
+struct S3FifoGhost
+{
+	uint64_t hash;
+	/* Zero for empty slots. */
+	uint64_t seq;
+};
+
+/* S3-FIFO: new files enter `small`, and only move to `main` if they're
+ * accessed again before reaching its end; otherwise they're evicted, and
+ * their keys end up in the ghost queue. Files that come back while still in
+ * the ghost queue go straight to `main`, which is a FIFO with reinsertion.
+ * Hits only bump the access counter of the item (`policy.frequency`), without
+ * any lock. Items are added and removed under both their index lock and
+ * `guard`, in this order. */
+struct PolicyS3Fifo
+{
+	struct HTable *htable;
+	pthread_mutex_t guard;
+	struct HTableItemList small;
+	struct HTableItemList main;
+	size_t small_capacity;
+	/* How many evictions a ghost survives. */
+	size_t ghost_capacity;
+	/* A power of two. */
+	size_t ghost_slots_count;
+	uint64_t ghost_seq;
+	struct S3FifoGhost *ghost_slots;
+};
+
+static void *
+s3fifo_create(struct HTable *htable, size_t max_items_count)
+{
+	struct PolicyS3Fifo *s3fifo = xmalloc(sizeof(struct PolicyS3Fifo));
+	s3fifo->htable = htable;
+	ON_MUTEX_ERR(pthread_mutex_init(&s3fifo->guard, NULL));
+	s3fifo->small = (struct HTableItemList){ NULL, NULL, 0 };
+	s3fifo->main = (struct HTableItemList){ NULL, NULL, 0 };
+	s3fifo->small_capacity = max_items_count / S3FIFO_SMALL_FRACTION;
+	if (s3fifo->small_capacity == 0) {
+		s3fifo->small_capacity = 1;
+	}
+	/* Ghosts are as many as the files `main` can hold. */
+	s3fifo->ghost_capacity = max_items_count - s3fifo->small_capacity;
+	size_t count = S3FIFO_MIN_GHOST_SLOTS;
+	while (count < s3fifo->ghost_capacity && count < S3FIFO_MAX_GHOST_SLOTS) {
+		count *= 2;
+	}
+	s3fifo->ghost_slots_count = count;
+	s3fifo->ghost_seq = 0;
+	s3fifo->ghost_slots = xmalloc(sizeof(struct S3FifoGhost) * count);
+	memset(s3fifo->ghost_slots, 0, sizeof(struct S3FifoGhost) * count);
+	return s3fifo;
+}
+
+static void
+s3fifo_free(void *policy)
+{
+	struct PolicyS3Fifo *s3fifo = policy;
+	/* Items belong to the index. */
+	ON_MUTEX_ERR(pthread_mutex_destroy(&s3fifo->guard));
+	free(s3fifo->ghost_slots);
+	free(s3fifo);
+}
+
+static void
+s3fifo_ghost_add_locked(struct PolicyS3Fifo *s3fifo, uint64_t hash)
+{
+	struct S3FifoGhost *ghost = &s3fifo->ghost_slots[hash & (s3fifo->ghost_slots_count - 1)];
+	ghost->hash = hash;
+	ghost->seq = ++s3fifo->ghost_seq;
+}
+
+/* Returns true, and forgets about it, if a key with this hash was evicted
+ * recently. */
+static bool
+s3fifo_ghost_take_locked(struct PolicyS3Fifo *s3fifo, uint64_t hash)
+{
+	struct S3FifoGhost *ghost = &s3fifo->ghost_slots[hash & (s3fifo->ghost_slots_count - 1)];
+	bool found = ghost->seq > 0 && ghost->hash == hash &&
+	             s3fifo->ghost_seq - ghost->seq < s3fifo->ghost_capacity;
+	if (found) {
+		ghost->seq = 0;
+	}
+	return found;
+}
+
+static void
+s3fifo_unlink_locked(struct PolicyS3Fifo *s3fifo, struct HTableItem *item)
+{
+	if (item->policy.list == S3FIFO_LIST_SMALL) {
+		item_list_unlink(&s3fifo->small, item);
+	} else if (item->policy.list == S3FIFO_LIST_MAIN) {
+		item_list_unlink(&s3fifo->main, item);
+	}
+	item->policy.list = S3FIFO_LIST_NONE;
+}
+
+static void
+s3fifo_push_main_locked(struct PolicyS3Fifo *s3fifo, struct HTableItem *item)
+{
+	item_list_push(&s3fifo->main, item);
+	item->policy.list = S3FIFO_LIST_MAIN;
+}
+
+static void
+s3fifo_on_insert(void *policy, struct HTableItem *item)
+{
+	struct PolicyS3Fifo *s3fifo = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&s3fifo->guard));
+	if (s3fifo_ghost_take_locked(s3fifo, item->hash)) {
+		s3fifo_push_main_locked(s3fifo, item);
+	} else {
+		item_list_push(&s3fifo->small, item);
+		item->policy.list = S3FIFO_LIST_SMALL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&s3fifo->guard));
+}
+
+static void
+s3fifo_on_access(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	/* Racing increments might get lost, which is fine. */
+	uint32_t count = __atomic_load_n(&item->policy.frequency, __ATOMIC_RELAXED);
+	if (count < S3FIFO_MAX_ACCESS_COUNT) {
+		__atomic_store_n(&item->policy.frequency, count + 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+s3fifo_on_remove(void *policy, struct HTableItem *item)
+{
+	struct PolicyS3Fifo *s3fifo = policy;
+	ON_MUTEX_ERR(pthread_mutex_lock(&s3fifo->guard));
+	s3fifo_unlink_locked(s3fifo, item);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&s3fifo->guard));
+}
+
+/* Unlinks the next victim and returns it, or NULL if there's none. Files that
+ * deserve to stay are moved around in the meantime. */
+static struct HTableItem *
+s3fifo_unlink_victim_locked(struct PolicyS3Fifo *s3fifo)
+{
+	while (true) {
+		bool from_small =
+		  s3fifo->small.count > s3fifo->small_capacity || s3fifo->main.count == 0;
+		struct HTableItem *item = from_small ? s3fifo->small.tail : s3fifo->main.tail;
+		if (!item) {
+			return NULL;
+		}
+		uint32_t count = __atomic_load_n(&item->policy.frequency, __ATOMIC_RELAXED);
+		s3fifo_unlink_locked(s3fifo, item);
+		if (from_small && count > 1) {
+			/* Popular enough to stay. */
+			s3fifo_push_main_locked(s3fifo, item);
+		} else if (from_small) {
+			s3fifo_ghost_add_locked(s3fifo, item->hash);
+			return item;
+		} else if (count > 0) {
+			/* Another round within `main`. */
+			__atomic_store_n(&item->policy.frequency, count - 1, __ATOMIC_RELAXED);
+			s3fifo_push_main_locked(s3fifo, item);
+		} else {
+			return item;
+		}
+	}
+}
+
+static struct HTableItem *
+s3fifo_pick_victim(void *policy)
+{
+	struct PolicyS3Fifo *s3fifo = policy;
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		ON_MUTEX_ERR(pthread_mutex_lock(&s3fifo->guard));
+		struct HTableItem *item = s3fifo_unlink_victim_locked(s3fifo);
+		ON_MUTEX_ERR(pthread_mutex_unlock(&s3fifo->guard));
+		/* The file might have been removed in the meantime, or be spared. */
+		if (!item || htable_evict_item(s3fifo->htable, item)) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_s3fifo_ops = {
+	.create = s3fifo_create,
+	.free = s3fifo_free,
+	.on_insert = s3fifo_on_insert,
+	.on_access = s3fifo_on_access,
+	.on_update = s3fifo_on_access,
+	.on_remove = s3fifo_on_remove,
+	.pick_victim = s3fifo_pick_victim,
+};
@@ -0,0 +1,86 @@
+#include "htable_policy.h"
+#include "utilities.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Any thread might end up picking victims, and `rand` isn't thread-safe, so
+ * each one has its own generator. Zero means not seeded yet. */
+static __thread uint64_t segmented_fifo_rng_state = 0;
+
+/* Files are evicted from random segments of the index, so there's no
+ * bookkeeping at all. */
+struct PolicySegmentedFifo
+{
+	struct HTable *htable;
+};
+
+static void *
+segmented_fifo_create(struct HTable *htable, size_t max_items_count)
+{
+	UNUSED(max_items_count);
+	struct PolicySegmentedFifo *segmented_fifo = xmalloc(sizeof(struct PolicySegmentedFifo));
+	segmented_fifo->htable = htable;
+	return segmented_fifo;
+}
+
+static void
+segmented_fifo_free(void *policy)
+{
+	free(policy);
+}
+
+static void
+segmented_fifo_on_item(void *policy, struct HTableItem *item)
+{
+	UNUSED(policy);
+	UNUSED(item);
+}
+
+/* SplitMix64, which is good enough for picking segments and doesn't mind
+ * weak seeds. */
+static uint64_t
+segmented_fifo_rand(void)
+{
+	if (segmented_fifo_rng_state == 0) {
+		/* Thread-local variables live at different addresses in each
+		 * thread, so threads start from different states. */
+		segmented_fifo_rng_state =
+		  (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&segmented_fifo_rng_state;
+	}
+	uint64_t z = (segmented_fifo_rng_state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+static struct HTableItem *
+segmented_fifo_pick_victim(void *policy)
+{
+	struct PolicySegmentedFifo *segmented_fifo = policy;
+	/* Stats lag behind, so they might promise victims that aren't there. */
+	for (unsigned attempts = 0; attempts < HTABLE_POLICY_MAX_ATTEMPTS; attempts++) {
+		if (!htable_has_victims(segmented_fifo->htable)) {
+			break;
+		}
+		/* Indices only look at occupied segments, so empty ones don't make us
+		 * spin. */
+		struct HTableItem *item =
+		  htable_evict_any(segmented_fifo->htable, segmented_fifo_rand());
+		if (item) {
+			return item;
+		}
+		/* We didn't find anything there, so let's try again. */
+	}
+	return NULL;
+}
+
+const struct HTablePolicyOps policy_segmented_fifo_ops = {
+	.create = segmented_fifo_create,
+	.free = segmented_fifo_free,
+	.on_insert = segmented_fifo_on_item,
+	.on_access = segmented_fifo_on_item,
+	.on_update = segmented_fifo_on_item,
+	.on_remove = segmented_fifo_on_item,
+	.pick_victim = segmented_fifo_pick_victim,
+};
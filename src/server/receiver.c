@@ -1,40 +1,81 @@
+#define _GNU_SOURCE
+
 #include "receiver.h"
 #include "deserializer.h"
 #include "global_state.h"
+#include "slab.h"
 #include "utilities.h"
 #include "workload_queue.h"
 #include <assert.h>
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+/* How many events a single `epoll_wait` can return. */
+#define RECEIVER_MAX_EVENTS 256
+/* Connections that still have data after this many reads go back to the end of
+ * the ready list, so that a busy client can't starve all others. */
+#define RECEIVER_MAX_READS_PER_TURN 16
+
+/* The state of a single client connection. Connections are edge-triggered, so
+ * one with pending data must stay within the ready list until a read would
+ * block; `epoll` won't tell us again otherwise. */
+struct Connection
+{
+	int fd;
+	unsigned id;
+	struct Deserializer *deserializer;
+	/* All connections, for `receiver_free`. */
+	struct Connection *prev;
+	struct Connection *next;
+	struct Connection *ready_next;
+	bool is_ready;
+};
+
 struct Receiver
 {
 	unsigned num_workers;
-	int max_fd;
-	unsigned active_sockets_count;
-	struct pollfd *active_sockets;
-	struct Deserializer **deserializers;
+	int epoll_fd;
+	int socket_fd;
 	bool accept_new_connections;
+	unsigned connections_count;
+	unsigned next_connection_id;
+	struct Connection *connections;
+	struct Connection *ready_head;
+	struct Connection *ready_tail;
+	struct epoll_event events[RECEIVER_MAX_EVENTS];
 };
 
 struct Receiver *
 receiver_create(int socket_descriptor, unsigned num_workers)
 {
 	struct Receiver *r = xmalloc(sizeof(struct Receiver));
-	r->max_fd = socket_descriptor;
-	r->active_sockets_count = 1;
 	r->num_workers = num_workers;
+	r->socket_fd = socket_descriptor;
 	r->accept_new_connections = true;
-	r->active_sockets = xmalloc(sizeof(struct pollfd));
-	r->active_sockets[0].events = POLLIN;
-	r->active_sockets[0].fd = socket_descriptor;
-	r->active_sockets[0].revents = 0;
-	r->deserializers = xmalloc(sizeof(struct Deserializer *));
-	r->deserializers[0] = deserializer_create();
+	r->connections_count = 0;
+	r->next_connection_id = 1;
+	r->connections = NULL;
+	r->ready_head = NULL;
+	r->ready_tail = NULL;
+	r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epoll_fd < 0) {
+		glog_fatal("`epoll_create1` syscall failed (errno = %d).", errno);
+		exit(EXIT_FAILURE);
+	}
+	/* New connections are accepted until `accept4` would block, so the main socket
+	 * must not block. It's the only one without a `struct Connection`. */
+	int flags = fcntl(socket_descriptor, F_GETFL);
+	struct epoll_event event = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+	if (flags < 0 || fcntl(socket_descriptor, F_SETFL, flags | O_NONBLOCK) < 0 ||
+	    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, socket_descriptor, &event) < 0) {
+		glog_fatal("Couldn't watch the main socket (errno = %d).", errno);
+		exit(EXIT_FAILURE);
+	}
 	return r;
 }
 
@@ -42,68 +83,93 @@ void
 receiver_disable_new_connections(struct Receiver *r)
 {
 	assert(r);
+	if (r->accept_new_connections) {
+		epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, r->socket_fd, NULL);
+	}
 	r->accept_new_connections = false;
 }
 
-/* Returns `true` if and only if a new readable event is detected on the main
- * socket. */
-bool
-receiver_has_new_connection(const struct Receiver *r)
+static void
+receiver_mark_ready(struct Receiver *r, struct Connection *conn)
 {
-	assert(r);
-	return (r->active_sockets[0].revents & POLLIN) > 0;
+	if (conn->is_ready) {
+		return;
+	}
+	conn->is_ready = true;
+	conn->ready_next = NULL;
+	if (r->ready_tail) {
+		r->ready_tail->ready_next = conn;
+	} else {
+		r->ready_head = conn;
+	}
+	r->ready_tail = conn;
 }
 
-void
-receiver_add_new_connection(struct Receiver *r)
+/* Accepts all pending connections at once. */
+static void
+receiver_accept_connections(struct Receiver *r)
 {
-	assert(r);
-	glog_info("Adding a new connection to the server's pool.");
-	int fd = accept(r->active_sockets[0].fd, NULL, NULL);
-	/* Faulty new connection. Let's keep going and don't stop the whole server. */
-	if (fd < 0) {
-		glog_warn("Ignoring faulty connection (errno = %d).", errno);
-		read(fd, NULL, 0);
-		r->active_sockets[0].revents = 0;
-		return;
+	while (r->accept_new_connections) {
+		/* Client sockets stay blocking, because workers write responses to them.
+		 * Reads don't block thanks to `MSG_DONTWAIT`. */
+		int fd = accept4(r->socket_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				/* Faulty new connection. Let's keep going and don't stop the whole
+				 * server. */
+				glog_warn("Ignoring faulty connection (errno = %d).", errno);
+			}
+			return;
+		}
+		struct Connection *conn = slab_alloc(sizeof(struct Connection));
+		conn->fd = fd;
+		conn->id = r->next_connection_id++;
+		conn->deserializer = deserializer_create();
+		conn->is_ready = false;
+		struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET,
+			                         .data.ptr = conn };
+		if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			glog_warn("Ignoring connection that can't be watched (errno = %d).", errno);
+			deserializer_free(conn->deserializer);
+			slab_free(conn, sizeof(struct Connection));
+			close(fd);
+			continue;
+		}
+		glog_info("Adding connection n.%u to the server's pool.", conn->id);
+		conn->prev = NULL;
+		conn->next = r->connections;
+		if (r->connections) {
+			r->connections->prev = conn;
+		}
+		r->connections = conn;
+		r->connections_count++;
+		/* Clients might have written something before we started watching. */
+		receiver_mark_ready(r, conn);
 	}
-	r->active_sockets_count++;
-	r->active_sockets =
-	  xrealloc(r->active_sockets, sizeof(struct pollfd) * r->active_sockets_count);
-	r->active_sockets[r->active_sockets_count - 1].fd = fd;
-	r->active_sockets[r->active_sockets_count - 1].events = POLLIN;
-	r->active_sockets[r->active_sockets_count - 1].revents = 0;
-	r->deserializers =
-	  xrealloc(r->deserializers, sizeof(struct Deserializer *) * r->active_sockets_count);
-	r->deserializers[r->active_sockets_count - 1] = deserializer_create();
-	/* Clear state. */
-	read(fd, NULL, 0);
-	r->active_sockets[0].revents = 0;
 }
 
-/* Removes dead connetions from this `struct Receiver`. */
-void
-receiver_cleanup(struct Receiver *r)
+/* Closes the connection, which must not be within the ready list. Closing the
+ * file descriptor also removes it from the `epoll` instance. */
+static void
+receiver_drop_connection(struct Receiver *r, struct Connection *conn)
 {
-	size_t last_i = r->active_sockets_count - 1;
-	for (size_t i = 1; i <= last_i; i++) {
-		if (r->active_sockets[i].fd < 0) {
-			close(-r->active_sockets[i].fd);
-			deserializer_free(r->deserializers[i]);
-			r->active_sockets[i] = r->active_sockets[last_i];
-			r->deserializers[i] = r->deserializers[last_i];
-			last_i--;
-			r->active_sockets_count--;
-		}
+	close(conn->fd);
+	deserializer_free(conn->deserializer);
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		r->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
 	}
-	struct pollfd *new_active_sockets =
-	  xrealloc(r->active_sockets, sizeof(struct pollfd) * r->active_sockets_count);
-	r->active_sockets = new_active_sockets;
-	r->deserializers =
-	  xrealloc(r->deserializers, sizeof(struct Deserializer *) * r->active_sockets_count);
+	r->connections_count--;
+	slab_free(conn, sizeof(struct Connection));
 }
 
-void
+static void
 hand_over_buf_to_worker(struct Receiver *r,
                         void *buffer,
                         size_t size,
@@ -120,90 +186,100 @@ hand_over_buf_to_worker(struct Receiver *r,
 	workload_queue_add(msg, thread_i);
 }
 
+/* Reads from `conn` until it would block, up to a limit. Returns -1 if the
+ * connection must be dropped, 1 if it has more data, and 0 otherwise. */
+static int
+receiver_read_connection(struct Receiver *r, struct Connection *conn)
+{
+	for (unsigned i = 0; i < RECEIVER_MAX_READS_PER_TURN; i++) {
+		void *buffer = deserializer_buffer(conn->deserializer);
+		size_t missing_bytes = deserializer_missing(conn->deserializer);
+		/* Incomplete messages always need a positive number of bytes! */
+		assert(missing_bytes > 0);
+		ssize_t num_bytes = recv(conn->fd, buffer, missing_bytes, MSG_DONTWAIT);
+		/* We drop connections on two situations:
+		 *  - EOF.
+		 *  - Errors during read. */
+		if (num_bytes == 0) {
+			glog_info("Dropping connection n.%u due to EOF.", conn->id);
+			return -1;
+		} else if (num_bytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			} else if (errno == EINTR) {
+				continue;
+			}
+			glog_warn("Dropping connection n.%u due to socket error.", conn->id);
+			return -1;
+		}
+		glog_trace("Read %zd bytes from connection n.%u.", num_bytes, conn->id);
+		struct Buffer *buf = deserializer_detach(conn->deserializer, num_bytes);
+		if (buf) {
+			glog_debug("Got a full message of %zu bytes from connection n.%u.",
+			           buf->size_in_bytes,
+			           conn->id);
+			hand_over_buf_to_worker(r, buf->raw, buf->size_in_bytes, conn->id, conn->fd);
+			free(buf);
+		} else if (!deserializer_validate(conn->deserializer)) {
+			glog_error("The deserializer of connection n.%u is NOT valid. Dropping it.",
+			           conn->id);
+			return -1;
+		}
+	}
+	return 1;
+}
+
 bool
 receiver_is_dead(const struct Receiver *receiver)
 {
 	assert(receiver);
-	return !receiver->accept_new_connections && receiver->active_sockets_count <= 1;
+	return !receiver->accept_new_connections && receiver->connections_count == 0;
 }
 
 int
 receiver_poll(struct Receiver *r)
 {
 	assert(r);
-	/* Remove all dead connections before polling. */
-	receiver_cleanup(r);
-	/* The first socket is not a client-to-server connection, remember! It's the
-	 * main socket, which accepts new incoming connections. */
-	glog_debug("New iteration in the polling loop with %zu connection(s).",
-	           r->active_sockets_count - 1);
-
-	/* Block until something happens. */
-	int num_reads = poll(r->active_sockets, r->active_sockets_count, -1);
-	if (num_reads < 0) {
+	glog_debug("New iteration in the polling loop with %u connection(s).",
+	           r->connections_count);
+
+	/* Block until something happens, unless some connections still have data we
+	 * haven't read. */
+	int timeout = r->ready_head ? 0 : -1;
+	int num_events = epoll_wait(r->epoll_fd, r->events, RECEIVER_MAX_EVENTS, timeout);
+	if (num_events < 0) {
 		errno = EIO;
 		return -1;
-	} else if (num_reads == 0) {
-		return 0;
 	}
-	if (receiver_has_new_connection(r)) {
-		num_reads--;
-		if (r->accept_new_connections) {
-			receiver_add_new_connection(r);
+	for (int i = 0; i < num_events; i++) {
+		struct Connection *conn = r->events[i].data.ptr;
+		if (!conn) {
+			receiver_accept_connections(r);
 		} else {
-			r->active_sockets[0].revents = 0;
+			/* Hang-ups and errors are found out by reading, after any data the
+			 * client sent before them. */
+			glog_trace("Polled a relevant event on connection n.%u.", conn->id);
+			receiver_mark_ready(r, conn);
 		}
 	}
 
-	/* We start counting from 1 because the first element contains the root
-	 * socket connection and we're not interested in that. */
-	for (size_t i = 1; i < r->active_sockets_count; i++) {
-		bool is_valid = deserializer_validate(r->deserializers[i]);
-		if (!is_valid) {
-			glog_error(
-			  "The deserializer n.%zu is NOT valid. Dropping connection n.%zu", i, i);
-			r->active_sockets[i].fd = -r->active_sockets[i].fd;
-			return 0;
+	/* Only connections that were ready before this loop get a turn, so ones that
+	 * go back to the list wait for the next iteration. */
+	struct Connection *last = r->ready_tail;
+	struct Connection *conn = NULL;
+	while (r->ready_head && conn != last) {
+		conn = r->ready_head;
+		r->ready_head = conn->ready_next;
+		if (!r->ready_head) {
+			r->ready_tail = NULL;
 		}
-		size_t missing = deserializer_missing(r->deserializers[i]);
-		glog_trace("The deserializer n.%zu needs %zu more bytes.", i, missing);
-	}
-	for (size_t i = 1; i < r->active_sockets_count; i++) {
-		if (r->active_sockets[i].revents > 0 && r->active_sockets[i].revents != POLLIN) {
-			glog_warn("Closing the connection n.%zu", i);
-			r->active_sockets[i].fd = -r->active_sockets[i].fd;
-			return 0;
-		} else if ((r->active_sockets[i].revents & POLLIN) > 0) {
-			glog_trace("Polled a relevant event on connection n.%zu.", i);
-			int fd = r->active_sockets[i].fd;
-			void *buffer = deserializer_buffer(r->deserializers[i]);
-			size_t missing_bytes = deserializer_missing(r->deserializers[i]);
-			/* Incomplete messages always need a positive number of bytes! */
-			assert(missing_bytes > 0);
-			ssize_t num_bytes = read(fd, buffer, missing_bytes);
-			/* We drop connections on two situations:
-			 *  - EOF.
-			 *  - Errors during read. */
-			if (num_bytes == 0) {
-				glog_info("Dropping connection n.%zu due to EOF.", i);
-				r->active_sockets[i].fd = -1;
-			} else if (num_bytes < 0) {
-				glog_warn("Dropping connection n.%zu due to socket error.", i);
-				r->active_sockets[i].fd = -1;
-			} else {
-				glog_trace("Read %zd bytes from connection n.%zu.", num_bytes, i);
-				struct Buffer *buf = deserializer_detach(r->deserializers[i], num_bytes);
-				if (buf) {
-					glog_debug("Got a full message of %zu bytes from connection n.%zu.",
-					           buf->size_in_bytes,
-					           i);
-					hand_over_buf_to_worker(r, buf->raw, buf->size_in_bytes, i, fd);
-					free(buf);
-				}
-			}
+		conn->is_ready = false;
+		int result = receiver_read_connection(r, conn);
+		if (result < 0) {
+			receiver_drop_connection(r, conn);
+		} else if (result > 0) {
+			receiver_mark_ready(r, conn);
 		}
-		/* Clear all events. */
-		r->active_sockets[i].revents = 0;
 	}
 	return 0;
 }
@@ -214,31 +290,10 @@ receiver_free(struct Receiver *r)
 	if (!r) {
 		return;
 	}
-	for (size_t i = 0; i < r->active_sockets_count; i++) {
-		close(r->active_sockets[i].fd);
-	}
-	free(r->active_sockets);
-	for (size_t i = 0; i < r->active_sockets_count; i++) {
-		deserializer_free(r->deserializers[i]);
+	while (r->connections) {
+		receiver_drop_connection(r, r->connections);
 	}
-	free(r->deserializers);
+	close(r->socket_fd);
+	close(r->epoll_fd);
 	free(r);
 }
-
-int
-receiver_add(struct Receiver *r, int fd)
-{
-	struct pollfd *new_active_sockets =
-	  xrealloc(r->active_sockets, sizeof(struct pollfd) * r->active_sockets_count);
-	struct Deserializer **new_deserializers =
-	  xrealloc(r->deserializers, sizeof(struct Deserializer *) * r->active_sockets_count);
-	struct Deserializer *deserializer = deserializer_create();
-	r->active_sockets = new_active_sockets;
-	r->deserializers = new_deserializers;
-	r->active_sockets[r->active_sockets_count].events = POLLIN;
-	r->active_sockets[r->active_sockets_count].fd = fd;
-	r->active_sockets[r->active_sockets_count].revents = 0;
-	r->deserializers[r->active_sockets_count] = deserializer;
-	r->active_sockets_count++;
-	return 0;
-}
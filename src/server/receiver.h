@@ -8,7 +8,11 @@
 
 /* Opaque data structure that simplifies the following actions:
  *  - reading incoming data from client connections.
- *  - automatically accepting new connections. */
+ *  - automatically accepting new connections.
+ *
+ * It's built on an edge-triggered `epoll` instance, so the cost of each
+ * iteration depends on how many connections are active rather than on how many
+ * are open. */
 struct Receiver;
 
 /* The data type of incoming messages. */
@@ -34,13 +38,11 @@ receiver_disable_new_connections(struct Receiver *receiver);
 bool
 receiver_is_dead(const struct Receiver *receiver);
 
-/* Suspends the execution of the current thread until one or more incoming
- * messages are available. After this call, `*messages` will point to a
- * heap-allocated array of all available messages. The caller has the
- * responsability to free all memory used by `messages` after use.
+/* Suspends the execution of the current thread until there's some incoming
+ * data, then hands all complete messages over to the workload queues.
  *
- * New connection attempts are automatically accepted. It returns 0 on success
- * and -1 on failure. */
+ * New connection attempts are automatically accepted, all pending ones at once.
+ * It returns 0 on success and -1 on failure. */
 int
 receiver_poll(struct Receiver *receiver);
 
@@ -0,0 +1,116 @@
+#include "sketch.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+/* Every key maps to one counter per row. */
+#define SKETCH_DEPTH 4
+/* Rows are a few times wider than the number of keys we track, to keep
+ * collisions rare. */
+#define SKETCH_WIDTH_PER_KEY 4
+#define SKETCH_MIN_WIDTH 64
+#define SKETCH_MAX_WIDTH (1 << 20)
+/* Counters stop counting here, just like 4-bit counters would. */
+#define SKETCH_MAX_COUNT 15
+/* All counters are halved after this many increments per column. */
+#define SKETCH_SAMPLE_FACTOR 10
+
+#define ON_MUTEX_ERR(err) ON_ERR((err), "Unexpected mutex error within the frequency sketch.")
+
+struct Sketch
+{
+	/* A power of two. */
+	size_t width;
+	/* Increments since the last aging. */
+	size_t additions;
+	size_t sample_size;
+	/* Only one thread at a time ages counters. */
+	pthread_mutex_t aging_guard;
+	/* `SKETCH_DEPTH` rows of `width` counters each. */
+	uint8_t counters[];
+};
+
+struct Sketch *
+sketch_create(size_t capacity)
+{
+	size_t width = SKETCH_MIN_WIDTH;
+	while (width < capacity * SKETCH_WIDTH_PER_KEY && width < SKETCH_MAX_WIDTH) {
+		width *= 2;
+	}
+	struct Sketch *sketch = xmalloc(sizeof(struct Sketch) + SKETCH_DEPTH * width);
+	sketch->width = width;
+	sketch->additions = 0;
+	sketch->sample_size = SKETCH_SAMPLE_FACTOR * width;
+	ON_MUTEX_ERR(pthread_mutex_init(&sketch->aging_guard, NULL));
+	memset(sketch->counters, 0, SKETCH_DEPTH * width);
+	return sketch;
+}
+
+void
+sketch_free(struct Sketch *sketch)
+{
+	if (!sketch) {
+		return;
+	}
+	ON_MUTEX_ERR(pthread_mutex_destroy(&sketch->aging_guard));
+	free(sketch);
+}
+
+/* Rows pick their counter via double hashing over the two halves of `hash`. */
+static size_t
+sketch_index(const struct Sketch *sketch, uint64_t hash, unsigned row)
+{
+	uint32_t h1 = (uint32_t)hash;
+	uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+	return row * sketch->width + ((h1 + row * h2) & (sketch->width - 1));
+}
+
+/* Halves all counters. Concurrent increments might get lost, which is fine. */
+static void
+sketch_age(struct Sketch *sketch)
+{
+	int err = pthread_mutex_trylock(&sketch->aging_guard);
+	if (err == EBUSY) {
+		return;
+	}
+	ON_MUTEX_ERR(err);
+	for (size_t i = 0; i < SKETCH_DEPTH * sketch->width; i++) {
+		uint8_t count = __atomic_load_n(&sketch->counters[i], __ATOMIC_RELAXED);
+		__atomic_store_n(&sketch->counters[i], count / 2, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_sub(&sketch->additions, sketch->sample_size, __ATOMIC_RELAXED);
+	ON_MUTEX_ERR(pthread_mutex_unlock(&sketch->aging_guard));
+}
+
+void
+sketch_increment(struct Sketch *sketch, uint64_t hash)
+{
+	for (unsigned row = 0; row < SKETCH_DEPTH; row++) {
+		uint8_t *counter = &sketch->counters[sketch_index(sketch, hash, row)];
+		/* Counts are estimates anyway, so racing increments can get lost. */
+		uint8_t count = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		if (count < SKETCH_MAX_COUNT) {
+			__atomic_store_n(counter, count + 1, __ATOMIC_RELAXED);
+		}
+	}
+	if (__atomic_add_fetch(&sketch->additions, 1, __ATOMIC_RELAXED) == sketch->sample_size) {
+		sketch_age(sketch);
+	}
+}
+
+unsigned
+sketch_estimate(const struct Sketch *sketch, uint64_t hash)
+{
+	unsigned estimate = SKETCH_MAX_COUNT;
+	for (unsigned row = 0; row < SKETCH_DEPTH; row++) {
+		uint8_t count =
+		  __atomic_load_n(&sketch->counters[sketch_index(sketch, hash, row)], __ATOMIC_RELAXED);
+		if (count < estimate) {
+			estimate = count;
+		}
+	}
+	return estimate;
+}
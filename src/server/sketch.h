@@ -0,0 +1,30 @@
+#ifndef SOL_SERVER_SKETCH
+#define SOL_SERVER_SKETCH
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* A count-min sketch that estimates how often each key was accessed lately,
+ * in little memory and without any lock. Counters saturate at a small value
+ * and are all halved every once in a while, so that popularity fades over
+ * time. Estimates are never lower than the (aged) truth, but they might be
+ * higher because of collisions. */
+struct Sketch;
+
+/* Creates a sketch that is meant to track around `capacity` distinct keys. */
+struct Sketch *
+sketch_create(size_t capacity);
+
+void
+sketch_free(struct Sketch *sketch);
+
+/* Records an access to the key with hash `hash`. Thread-safe. */
+void
+sketch_increment(struct Sketch *sketch, uint64_t hash);
+
+/* Returns how many times the key with hash `hash` was accessed lately, more or
+ * less. Thread-safe. */
+unsigned
+sketch_estimate(const struct Sketch *sketch, uint64_t hash);
+
+#endif
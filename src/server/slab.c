@@ -0,0 +1,235 @@
+#include "slab.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <pthread.h>
+#include <string.h>
+
+/* Size classes are multiples of this. */
+#define SLAB_ALIGNMENT 16
+#define SLAB_CLASSES (SLAB_MAX_OBJECT_SIZE / SLAB_ALIGNMENT)
+
+/* How much memory we ask for at a time. */
+#define SLAB_SIZE_IN_BYTES (64 * 1024)
+
+/* How many objects move between thread caches and shared freelists at a time.
+ * Thread caches never hold more than twice as many. */
+#define SLAB_BATCH 32
+
+#define ON_MUTEX_ERR(err) ON_ERR((err), "Unexpected mutex error within the slab allocator.")
+
+struct SlabObject
+{
+	struct SlabObject *next;
+};
+
+struct Slab
+{
+	struct Slab *next;
+	/* Keeps objects aligned. */
+	char padding[SLAB_ALIGNMENT - sizeof(struct Slab *)];
+	char data[];
+};
+
+struct SlabClass
+{
+	pthread_mutex_t guard;
+	struct SlabObject *freelist;
+	size_t freelist_count;
+	/* What's left of the most recent slab. */
+	char *cursor;
+	char *end;
+	/* How many objects were ever carved out of slabs. */
+	size_t carved_count;
+};
+
+struct SlabCache
+{
+	struct SlabObject *head;
+	unsigned count;
+};
+
+static struct SlabClass classes[SLAB_CLASSES];
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t slabs_guard = PTHREAD_MUTEX_INITIALIZER;
+static struct Slab *slabs = NULL;
+static size_t slabs_count = 0;
+
+static size_t large_bytes = 0;
+
+static __thread struct SlabCache thread_caches[SLAB_CLASSES];
+
+static void
+slab_init_classes(void)
+{
+	for (unsigned i = 0; i < SLAB_CLASSES; i++) {
+		ON_MUTEX_ERR(pthread_mutex_init(&classes[i].guard, NULL));
+		classes[i].freelist = NULL;
+		classes[i].freelist_count = 0;
+		classes[i].cursor = NULL;
+		classes[i].end = NULL;
+		classes[i].carved_count = 0;
+	}
+}
+
+static void
+slab_init(void)
+{
+	ON_ERR(pthread_once(&classes_once, slab_init_classes),
+	       "Unexpected error during slab allocator initialization.");
+}
+
+static unsigned
+slab_class_of(size_t size)
+{
+	if (size == 0) {
+		size = 1;
+	}
+	return (size + SLAB_ALIGNMENT - 1) / SLAB_ALIGNMENT - 1;
+}
+
+static size_t
+slab_class_size(unsigned i)
+{
+	return (i + 1) * SLAB_ALIGNMENT;
+}
+
+/* Moves up to `SLAB_BATCH` objects of size class `i` into `cache`. It must be
+ * called with the class lock held. */
+static void
+slab_refill_locked(unsigned i, struct SlabCache *cache)
+{
+	struct SlabClass *class = &classes[i];
+	size_t size = slab_class_size(i);
+	while (cache->count < SLAB_BATCH) {
+		struct SlabObject *obj = class->freelist;
+		if (obj) {
+			class->freelist = obj->next;
+			class->freelist_count--;
+		} else {
+			if (class->cursor == class->end) {
+				struct Slab *slab = xmalloc(sizeof(struct Slab) + SLAB_SIZE_IN_BYTES);
+				ON_MUTEX_ERR(pthread_mutex_lock(&slabs_guard));
+				slab->next = slabs;
+				slabs = slab;
+				slabs_count++;
+				ON_MUTEX_ERR(pthread_mutex_unlock(&slabs_guard));
+				class->cursor = slab->data;
+				class->end = slab->data + SLAB_SIZE_IN_BYTES / size * size;
+			}
+			obj = (struct SlabObject *)(void *)class->cursor;
+			class->cursor += size;
+			class->carved_count++;
+		}
+		obj->next = cache->head;
+		cache->head = obj;
+		cache->count++;
+	}
+}
+
+void *
+slab_alloc(size_t size)
+{
+	if (size > SLAB_MAX_OBJECT_SIZE) {
+		__atomic_fetch_add(&large_bytes, size, __ATOMIC_RELAXED);
+		return xmalloc(size);
+	}
+	slab_init();
+	unsigned i = slab_class_of(size);
+	struct SlabCache *cache = &thread_caches[i];
+	if (!cache->head) {
+		ON_MUTEX_ERR(pthread_mutex_lock(&classes[i].guard));
+		slab_refill_locked(i, cache);
+		ON_MUTEX_ERR(pthread_mutex_unlock(&classes[i].guard));
+	}
+	struct SlabObject *obj = cache->head;
+	cache->head = obj->next;
+	cache->count--;
+	return obj;
+}
+
+void
+slab_free(void *ptr, size_t size)
+{
+	if (!ptr) {
+		return;
+	}
+	if (size > SLAB_MAX_OBJECT_SIZE) {
+		__atomic_fetch_sub(&large_bytes, size, __ATOMIC_RELAXED);
+		free(ptr);
+		return;
+	}
+	unsigned i = slab_class_of(size);
+	struct SlabCache *cache = &thread_caches[i];
+	struct SlabObject *obj = ptr;
+	obj->next = cache->head;
+	cache->head = obj;
+	cache->count++;
+	if (cache->count < 2 * SLAB_BATCH) {
+		return;
+	}
+
+	/* Objects might be freed by a different thread than the one that allocated
+	 * them (e.g. the memory reclaimer), so caches must not grow unbounded. */
+	struct SlabObject *first = cache->head;
+	struct SlabObject *last = first;
+	for (unsigned j = 1; j < SLAB_BATCH; j++) {
+		last = last->next;
+	}
+	cache->head = last->next;
+	cache->count -= SLAB_BATCH;
+	ON_MUTEX_ERR(pthread_mutex_lock(&classes[i].guard));
+	last->next = classes[i].freelist;
+	classes[i].freelist = first;
+	classes[i].freelist_count += SLAB_BATCH;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&classes[i].guard));
+}
+
+char *
+slab_strndup(const char *str, size_t len)
+{
+	char *copy = slab_alloc(len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+void
+slab_stats(struct SlabStats *stats)
+{
+	stats->used_bytes = 0;
+	stats->large_bytes = __atomic_load_n(&large_bytes, __ATOMIC_RELAXED);
+	ON_MUTEX_ERR(pthread_mutex_lock(&slabs_guard));
+	stats->reserved_bytes = slabs_count * SLAB_SIZE_IN_BYTES;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&slabs_guard));
+	slab_init();
+	for (unsigned i = 0; i < SLAB_CLASSES; i++) {
+		ON_MUTEX_ERR(pthread_mutex_lock(&classes[i].guard));
+		size_t count = classes[i].carved_count - classes[i].freelist_count;
+		ON_MUTEX_ERR(pthread_mutex_unlock(&classes[i].guard));
+		stats->used_bytes += count * slab_class_size(i);
+	}
+}
+
+void
+slab_clear(void)
+{
+	ON_MUTEX_ERR(pthread_mutex_lock(&slabs_guard));
+	while (slabs) {
+		struct Slab *next = slabs->next;
+		free(slabs);
+		slabs = next;
+	}
+	slabs_count = 0;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&slabs_guard));
+	slab_init();
+	for (unsigned i = 0; i < SLAB_CLASSES; i++) {
+		classes[i].freelist = NULL;
+		classes[i].freelist_count = 0;
+		classes[i].cursor = NULL;
+		classes[i].end = NULL;
+		classes[i].carved_count = 0;
+	}
+	memset(thread_caches, 0, sizeof(thread_caches));
+}
@@ -0,0 +1,48 @@
+#ifndef SOL_SERVER_SLAB
+#define SOL_SERVER_SLAB
+
+#include <stdlib.h>
+
+/* A slab allocator for small metadata objects: hash table items, key copies,
+ * subscribers, and the like. Objects are carved out of large slabs and recycled
+ * through freelists, one for each size class. Every thread keeps a small cache
+ * in front of each freelist, so most allocations don't take any lock.
+ *
+ * Slabs are only given back to the operating system by `slab_clear`. Requests
+ * larger than `SLAB_MAX_OBJECT_SIZE` go straight to `malloc`. */
+
+#define SLAB_MAX_OBJECT_SIZE 256
+
+struct SlabStats
+{
+	/* Memory requested from the operating system for slabs. */
+	size_t reserved_bytes;
+	/* Slab memory that is currently handed out (or cached by some thread). */
+	size_t used_bytes;
+	/* Memory handed out outside of slabs, for objects that don't fit. */
+	size_t large_bytes;
+};
+
+/* Allocates `size` bytes. Infallible, just like `xmalloc`. */
+void *
+slab_alloc(size_t size);
+
+/* Frees `ptr`, which must come from `slab_alloc` with the same `size`. */
+void
+slab_free(void *ptr, size_t size);
+
+/* Allocates a NUL-terminated copy of the first `len` bytes of `str`, to be
+ * freed with `slab_free(ptr, len + 1)`. */
+char *
+slab_strndup(const char *str, size_t len);
+
+/* Thread-safe. */
+void
+slab_stats(struct SlabStats *stats);
+
+/* Frees all slabs at once. Nothing allocated by `slab_alloc` must be in use
+ * anymore, and no other thread must be running. */
+void
+slab_clear(void);
+
+#endif
@@ -0,0 +1,721 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "spill_tier.h"
+#include "global_state.h"
+#include "server_utilities.h"
+#include "utilities.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SPILL_TIER_MIN_BUCKETS 64
+/* Segments are rolled over at this size, or at a fraction of the capacity for
+ * small tiers, so that dropping the oldest one never throws away too much. */
+#define SPILL_TIER_SEGMENT_SIZE (64 * 1024 * 1024)
+#define SPILL_TIER_MIN_SEGMENTS 4
+/* Files that wait for the writer still take up memory, so past this many bytes
+ * they leave the server right away instead. */
+#define SPILL_TIER_MAX_QUEUED_BYTES (64 * 1024 * 1024)
+#define SPILL_TIER_RECORD_MAGIC 0x534f4c53
+#define SPILL_TIER_SEGMENT_PREFIX "segment-"
+#define SPILL_TIER_SEGMENT_SUFFIX ".log"
+
+#define ON_MUTEX_ERR(err) ON_ERR((err), "Unexpected mutex error within the spill tier.")
+
+/* Every record within a segment starts with this header, followed by the key
+ * and then by the contents. Records are only ever appended, so those of files
+ * that left the tier stay where they are until the whole segment goes. */
+struct SpillRecordHeader
+{
+	uint32_t magic;
+	uint32_t key_len;
+	uint64_t contents_len;
+};
+
+struct SpillSegment
+{
+	unsigned id;
+	int fd;
+	/* Bytes of records, written or about to be. */
+	size_t size;
+	/* Files within the index whose records are here. */
+	struct SpillEntry *entries;
+	size_t entries_count;
+	/* Threads in the middle of reading some record. Dropped segments are only
+	 * deleted once they're done. */
+	unsigned readers;
+	bool is_dropped;
+	/* Set after write errors, since the end of the file is unknown then. */
+	bool is_sealed;
+	/* From the oldest segment to the newest one, which is being written. */
+	struct SpillSegment *next;
+};
+
+struct SpillEntry
+{
+	struct SpillEntry *hash_next;
+	struct SpillEntry *segment_prev;
+	struct SpillEntry *segment_next;
+	struct SpillEntry *queue_next;
+	/* NUL-terminated. */
+	char *key;
+	size_t key_len;
+	uint64_t hash;
+	size_t length_in_bytes;
+	/* Only set until the record is written. */
+	struct Blob *contents;
+	/* Only set once the record is written. */
+	struct SpillSegment *segment;
+	off_t offset;
+	/* Entries are freed once they're neither within the index nor waiting for
+	 * (or in the hands of) the writer. */
+	bool is_indexed;
+	bool is_queued;
+};
+
+struct SpillTier
+{
+	char *directory;
+	size_t capacity_in_bytes;
+	size_t segment_size;
+	pthread_mutex_t guard;
+	pthread_cond_t writer_cond;
+	pthread_t writer;
+	bool writer_stop;
+	/* A power of two. */
+	size_t buckets_count;
+	struct SpillEntry **buckets;
+	struct SpillEntry *queue_head;
+	struct SpillEntry *queue_tail;
+	size_t queued_bytes;
+	struct SpillSegment *oldest;
+	struct SpillSegment *newest;
+	unsigned next_segment_id;
+	/* Only modified under `guard`, but read without it. */
+	size_t items_count;
+	size_t space_in_bytes;
+	long unsigned stores;
+	long unsigned promotions;
+	long unsigned overflows;
+};
+
+static void *
+spill_tier_writer_entry_point(void *args);
+
+/************ SEGMENTS ***********/
+
+static char *
+segment_path(const struct SpillTier *tier, unsigned id)
+{
+	size_t len = strlen(tier->directory) + sizeof(SPILL_TIER_SEGMENT_PREFIX) +
+	             sizeof(SPILL_TIER_SEGMENT_SUFFIX) + 16;
+	char *path = xmalloc(len);
+	snprintf(path,
+	         len,
+	         "%s/" SPILL_TIER_SEGMENT_PREFIX "%08u" SPILL_TIER_SEGMENT_SUFFIX,
+	         tier->directory,
+	         id);
+	return path;
+}
+
+/* Deletes any segment within the directory of `tier`. */
+static void
+segments_clear(const struct SpillTier *tier)
+{
+	DIR *dir = opendir(tier->directory);
+	if (!dir) {
+		return;
+	}
+	struct dirent *dirent = NULL;
+	size_t prefix_len = strlen(SPILL_TIER_SEGMENT_PREFIX);
+	size_t suffix_len = strlen(SPILL_TIER_SEGMENT_SUFFIX);
+	while ((dirent = readdir(dir))) {
+		size_t len = strlen(dirent->d_name);
+		if (len > prefix_len + suffix_len &&
+		    strncmp(dirent->d_name, SPILL_TIER_SEGMENT_PREFIX, prefix_len) == 0 &&
+		    strcmp(dirent->d_name + len - suffix_len, SPILL_TIER_SEGMENT_SUFFIX) == 0) {
+			size_t path_len = strlen(tier->directory) + len + 2;
+			char *path = xmalloc(path_len);
+			snprintf(path, path_len, "%s/%s", tier->directory, dirent->d_name);
+			unlink(path);
+			free(path);
+		}
+	}
+	closedir(dir);
+}
+
+/* Opens a new, empty segment and makes it the newest one. Returns NULL on
+ * system errors. */
+static struct SpillSegment *
+segment_open_locked(struct SpillTier *tier)
+{
+	unsigned id = tier->next_segment_id++;
+	char *path = segment_path(tier, id);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	free(path);
+	if (fd < 0) {
+		glog_error("Couldn't create a new spill tier segment (errno %d).", errno);
+		return NULL;
+	}
+	struct SpillSegment *segment = xmalloc(sizeof(struct SpillSegment));
+	segment->id = id;
+	segment->fd = fd;
+	segment->size = 0;
+	segment->entries = NULL;
+	segment->entries_count = 0;
+	segment->readers = 0;
+	segment->is_dropped = false;
+	segment->is_sealed = false;
+	segment->next = NULL;
+	if (tier->newest) {
+		tier->newest->next = segment;
+	} else {
+		tier->oldest = segment;
+	}
+	tier->newest = segment;
+	return segment;
+}
+
+static void
+segment_delete(const struct SpillTier *tier, struct SpillSegment *segment)
+{
+	close(segment->fd);
+	char *path = segment_path(tier, segment->id);
+	unlink(path);
+	free(path);
+	free(segment);
+}
+
+static void
+segment_link_entry(struct SpillSegment *segment, struct SpillEntry *entry)
+{
+	entry->segment = segment;
+	entry->segment_prev = NULL;
+	entry->segment_next = segment->entries;
+	if (segment->entries) {
+		segment->entries->segment_prev = entry;
+	}
+	segment->entries = entry;
+	segment->entries_count++;
+}
+
+static void
+segment_unlink_entry(struct SpillSegment *segment, struct SpillEntry *entry)
+{
+	if (entry->segment_prev) {
+		entry->segment_prev->segment_next = entry->segment_next;
+	} else {
+		segment->entries = entry->segment_next;
+	}
+	if (entry->segment_next) {
+		entry->segment_next->segment_prev = entry->segment_prev;
+	}
+	segment->entries_count--;
+}
+
+/* Reads exactly `len` bytes at `offset`. Returns 0 on success, -1 otherwise. */
+static int
+segment_read(const struct SpillSegment *segment, void *buf, size_t len, off_t offset)
+{
+	char *ptr = buf;
+	while (len > 0) {
+		ssize_t n = pread(segment->fd, ptr, len, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return -1;
+		}
+		ptr += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/************ INDEX ***********/
+
+static void
+entry_free(struct SpillEntry *entry)
+{
+	free(entry->key);
+	if (entry->contents) {
+		blob_unref(entry->contents);
+	}
+	free(entry);
+}
+
+static struct SpillEntry **
+tier_bucket(struct SpillTier *tier, uint64_t hash)
+{
+	return &tier->buckets[hash & (tier->buckets_count - 1)];
+}
+
+/* Doubles the number of buckets, so that chains stay short. */
+static void
+tier_grow_locked(struct SpillTier *tier)
+{
+	struct SpillEntry **old = tier->buckets;
+	size_t old_count = tier->buckets_count;
+	tier->buckets_count *= 2;
+	tier->buckets = xmalloc(sizeof(struct SpillEntry *) * tier->buckets_count);
+	memset(tier->buckets, 0, sizeof(struct SpillEntry *) * tier->buckets_count);
+	for (size_t i = 0; i < old_count; i++) {
+		struct SpillEntry *entry = old[i];
+		while (entry) {
+			struct SpillEntry *next = entry->hash_next;
+			struct SpillEntry **bucket = tier_bucket(tier, entry->hash);
+			entry->hash_next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	free(old);
+}
+
+static void
+tier_index_locked(struct SpillTier *tier, struct SpillEntry *entry)
+{
+	struct SpillEntry **bucket = tier_bucket(tier, entry->hash);
+	entry->hash_next = *bucket;
+	*bucket = entry;
+	entry->is_indexed = true;
+	__atomic_fetch_add(&tier->items_count, 1, __ATOMIC_RELAXED);
+	if (tier->items_count > tier->buckets_count) {
+		tier_grow_locked(tier);
+	}
+}
+
+/* Removes the entry with path `key` from the index and returns it, or NULL.
+ * It's up to the caller to free it, unless it's queued. */
+static struct SpillEntry *
+tier_unindex_locked(struct SpillTier *tier, const struct HTableKey *key)
+{
+	struct SpillEntry **ptr = tier_bucket(tier, key->hash);
+	while (*ptr && ((*ptr)->hash != key->hash || (*ptr)->key_len != key->len ||
+	                memcmp((*ptr)->key, key->ptr, key->len) != 0)) {
+		ptr = &(*ptr)->hash_next;
+	}
+	struct SpillEntry *entry = *ptr;
+	if (!entry) {
+		return NULL;
+	}
+	*ptr = entry->hash_next;
+	entry->is_indexed = false;
+	if (entry->segment) {
+		segment_unlink_entry(entry->segment, entry);
+	}
+	__atomic_fetch_sub(&tier->items_count, 1, __ATOMIC_RELAXED);
+	return entry;
+}
+
+/* Hands `file` over to the caller of `spill_tier_store`, by appending it to
+ * `overflow`. */
+static void
+tier_overflow(struct SpillTier *tier,
+              struct File *file,
+              struct File **overflow,
+              unsigned *overflow_count)
+{
+	*overflow = xrealloc(*overflow, sizeof(struct File) * (*overflow_count + 1));
+	(*overflow)[(*overflow_count)++] = *file;
+	__atomic_fetch_add(&tier->overflows, 1, __ATOMIC_RELAXED);
+}
+
+/* Drops the oldest segment, and hands the files still within it over to the
+ * caller. The oldest segment must not be the newest one, which is the only one
+ * that the writer touches. */
+static void
+tier_drop_oldest_locked(struct SpillTier *tier,
+                        struct File **overflow,
+                        unsigned *overflow_count)
+{
+	struct SpillSegment *segment = tier->oldest;
+	tier->oldest = segment->next;
+	__atomic_fetch_sub(&tier->space_in_bytes, segment->size, __ATOMIC_RELAXED);
+	segment->is_dropped = true;
+	/* Entries are unlinked from the head of the list, and keep pointing to
+	 * the next one. */
+	struct SpillEntry *entries = segment->entries;
+	while (segment->entries) {
+		struct SpillEntry *entry = segment->entries;
+		struct HTableKey key = {
+			.ptr = entry->key, .len = entry->key_len, .hash = entry->hash
+		};
+		tier_unindex_locked(tier, &key);
+	}
+	segment->readers++;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	struct SpillEntry *entry = entries;
+	while (entry) {
+		struct SpillEntry *next = entry->segment_next;
+		char *buffer = xmalloc(entry->length_in_bytes > 0 ? entry->length_in_bytes : 1);
+		if (segment_read(segment, buffer, entry->length_in_bytes, entry->offset) < 0) {
+			glog_error("Couldn't read a file from the spill tier (errno %d).", errno);
+			entry_free(entry);
+		} else {
+			struct File file = {
+				.key = entry->key,
+				.contents = blob_create(buffer, entry->length_in_bytes),
+				.fd_owner = -1,
+				.subs = NULL,
+			};
+			tier_overflow(tier, &file, overflow, overflow_count);
+			free(entry);
+		}
+		free(buffer);
+		entry = next;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	segment->readers--;
+	if (segment->readers == 0) {
+		segment_delete(tier, segment);
+	}
+}
+
+/************ PUBLIC API ***********/
+
+struct SpillTier *
+spill_tier_create(const char *directory, size_t capacity_in_bytes)
+{
+	if (mkdir(directory, 0700) < 0 && errno != EEXIST) {
+		glog_error(
+		  "Couldn't create the spill directory '%s' (errno %d).", directory, errno);
+		return NULL;
+	}
+	struct SpillTier *tier = xmalloc(sizeof(struct SpillTier));
+	tier->directory = buf_to_str(directory, strlen(directory));
+	tier->capacity_in_bytes = capacity_in_bytes;
+	tier->segment_size = capacity_in_bytes / SPILL_TIER_MIN_SEGMENTS;
+	if (tier->segment_size > SPILL_TIER_SEGMENT_SIZE) {
+		tier->segment_size = SPILL_TIER_SEGMENT_SIZE;
+	}
+	segments_clear(tier);
+	ON_MUTEX_ERR(pthread_mutex_init(&tier->guard, NULL));
+	ON_MUTEX_ERR(pthread_cond_init(&tier->writer_cond, NULL));
+	tier->writer_stop = false;
+	tier->buckets_count = SPILL_TIER_MIN_BUCKETS;
+	tier->buckets = xmalloc(sizeof(struct SpillEntry *) * tier->buckets_count);
+	memset(tier->buckets, 0, sizeof(struct SpillEntry *) * tier->buckets_count);
+	tier->queue_head = NULL;
+	tier->queue_tail = NULL;
+	tier->queued_bytes = 0;
+	tier->oldest = NULL;
+	tier->newest = NULL;
+	tier->next_segment_id = 0;
+	tier->items_count = 0;
+	tier->space_in_bytes = 0;
+	tier->stores = 0;
+	tier->promotions = 0;
+	tier->overflows = 0;
+	int err = pthread_create(&tier->writer, NULL, spill_tier_writer_entry_point, tier);
+	if (err) {
+		glog_error("Unexpected `pthread_create` error code %d when spawning the spill tier "
+		           "writer.",
+		           err);
+		ON_MUTEX_ERR(pthread_cond_destroy(&tier->writer_cond));
+		ON_MUTEX_ERR(pthread_mutex_destroy(&tier->guard));
+		free(tier->buckets);
+		free(tier->directory);
+		free(tier);
+		return NULL;
+	}
+	return tier;
+}
+
+void
+spill_tier_free(struct SpillTier *tier)
+{
+	if (!tier) {
+		return;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	tier->writer_stop = true;
+	ON_MUTEX_ERR(pthread_cond_signal(&tier->writer_cond));
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	ON_MUTEX_ERR(pthread_join(tier->writer, NULL));
+
+	/* Queued entries might be within the index as well. */
+	struct SpillEntry *entry = tier->queue_head;
+	while (entry) {
+		struct SpillEntry *next = entry->queue_next;
+		if (!entry->is_indexed) {
+			entry_free(entry);
+		}
+		entry = next;
+	}
+	for (size_t i = 0; i < tier->buckets_count; i++) {
+		entry = tier->buckets[i];
+		while (entry) {
+			struct SpillEntry *next = entry->hash_next;
+			entry_free(entry);
+			entry = next;
+		}
+	}
+	struct SpillSegment *segment = tier->oldest;
+	while (segment) {
+		struct SpillSegment *next = segment->next;
+		segment_delete(tier, segment);
+		segment = next;
+	}
+	free(tier->buckets);
+	ON_MUTEX_ERR(pthread_cond_destroy(&tier->writer_cond));
+	ON_MUTEX_ERR(pthread_mutex_destroy(&tier->guard));
+	free(tier->directory);
+	free(tier);
+}
+
+void
+spill_tier_store(struct SpillTier *tier,
+                 struct File *file,
+                 struct File **overflow,
+                 unsigned *overflow_count)
+{
+	struct SpillEntry *entry = xmalloc(sizeof(struct SpillEntry));
+	entry->key = file->key;
+	entry->key_len = strlen(file->key);
+	entry->hash = htable_key(entry->key, entry->key_len).hash;
+	entry->length_in_bytes = file->contents->length_in_bytes;
+	entry->contents = file->contents;
+	entry->segment = NULL;
+	entry->offset = 0;
+	entry->is_indexed = false;
+	entry->is_queued = false;
+	size_t record_size =
+	  sizeof(struct SpillRecordHeader) + entry->key_len + entry->length_in_bytes;
+
+	struct HTableKey key = {
+		.ptr = entry->key, .len = entry->key_len, .hash = entry->hash
+	};
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct SpillEntry *stale = tier_unindex_locked(tier, &key);
+	if (stale && !stale->is_queued) {
+		entry_free(stale);
+	}
+	if (record_size > tier->capacity_in_bytes ||
+	    tier->queued_bytes + entry->length_in_bytes > SPILL_TIER_MAX_QUEUED_BYTES) {
+		ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+		tier_overflow(tier, file, overflow, overflow_count);
+		free(entry);
+		return;
+	}
+	tier_index_locked(tier, entry);
+	entry->is_queued = true;
+	entry->queue_next = NULL;
+	if (tier->queue_tail) {
+		tier->queue_tail->queue_next = entry;
+	} else {
+		tier->queue_head = entry;
+	}
+	tier->queue_tail = entry;
+	tier->queued_bytes += entry->length_in_bytes;
+	__atomic_fetch_add(&tier->stores, 1, __ATOMIC_RELAXED);
+	ON_MUTEX_ERR(pthread_cond_signal(&tier->writer_cond));
+	/* Room is made right away, so that the caller can take care of the files
+	 * that leave the tier. The segment being written can't go, so the tier
+	 * might be past its capacity by up to one segment for a while. */
+	while (tier->oldest && tier->oldest != tier->newest &&
+	       tier->space_in_bytes + tier->queued_bytes > tier->capacity_in_bytes) {
+		tier_drop_oldest_locked(tier, overflow, overflow_count);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+}
+
+struct Blob *
+spill_tier_take(struct SpillTier *tier, const struct HTableKey *key, bool compress)
+{
+	if (__atomic_load_n(&tier->items_count, __ATOMIC_RELAXED) == 0) {
+		return NULL;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct SpillEntry *entry = tier_unindex_locked(tier, key);
+	if (!entry) {
+		ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+		return NULL;
+	}
+	__atomic_fetch_add(&tier->promotions, 1, __ATOMIC_RELAXED);
+	if (entry->contents) {
+		/* Not written yet, or just being written. */
+		struct Blob *blob = entry->contents;
+		blob_ref(blob);
+		if (!entry->is_queued) {
+			entry_free(entry);
+		}
+		ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+		return blob;
+	}
+	/* The entry still knows where its record is, even if it's not within the
+	 * segment anymore. */
+	struct SpillSegment *segment = entry->segment;
+	off_t offset = entry->offset;
+	size_t length_in_bytes = entry->length_in_bytes;
+	entry_free(entry);
+	segment->readers++;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+
+	char *buffer = xmalloc(length_in_bytes > 0 ? length_in_bytes : 1);
+	int err = segment_read(segment, buffer, length_in_bytes, offset);
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	segment->readers--;
+	bool is_gone = segment->is_dropped && segment->readers == 0;
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	if (is_gone) {
+		segment_delete(tier, segment);
+	}
+	if (err < 0) {
+		glog_error("Couldn't read a file from the spill tier (errno %d).", errno);
+		free(buffer);
+		return NULL;
+	}
+	struct Blob *blob = compress ? blob_create_compressed(buffer, length_in_bytes)
+	                             : blob_create(buffer, length_in_bytes);
+	free(buffer);
+	return blob;
+}
+
+bool
+spill_tier_drop(struct SpillTier *tier, const struct HTableKey *key)
+{
+	if (__atomic_load_n(&tier->items_count, __ATOMIC_RELAXED) == 0) {
+		return false;
+	}
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	struct SpillEntry *entry = tier_unindex_locked(tier, key);
+	if (entry && !entry->is_queued) {
+		entry_free(entry);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	return entry != NULL;
+}
+
+void
+spill_tier_stats(const struct SpillTier *tier, struct SpillTierStats *stats)
+{
+	stats->items_count = __atomic_load_n(&tier->items_count, __ATOMIC_RELAXED);
+	stats->space_in_bytes = __atomic_load_n(&tier->space_in_bytes, __ATOMIC_RELAXED);
+	stats->stores = __atomic_load_n(&tier->stores, __ATOMIC_RELAXED);
+	stats->promotions = __atomic_load_n(&tier->promotions, __ATOMIC_RELAXED);
+	stats->overflows = __atomic_load_n(&tier->overflows, __ATOMIC_RELAXED);
+}
+
+/************ WRITER ***********/
+
+/* Appends the record of `entry` with the given contents to `segment`, at the
+ * current end of the file. Returns 0 on success, -1 otherwise. */
+static int
+writer_append(struct SpillSegment *segment,
+              const struct SpillEntry *entry,
+              struct Blob *blob)
+{
+	struct SpillRecordHeader header = {
+		.magic = SPILL_TIER_RECORD_MAGIC,
+		.key_len = (uint32_t)entry->key_len,
+		.contents_len = entry->length_in_bytes,
+	};
+	if (write_bytes(segment->fd, &header, sizeof(header)) != 1 ||
+	    write_bytes(segment->fd, entry->key, entry->key_len) != 1 ||
+	    blob_write(segment->fd, blob) != 1) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Deletes segments that only hold records of files that are gone. Making room
+ * within the capacity is up to `spill_tier_store`, whose caller takes the files
+ * that have to leave. */
+static void
+writer_compact_locked(struct SpillTier *tier)
+{
+	/* Segments are rare to be empty, and cheap to check. */
+	struct SpillSegment **ptr = &tier->oldest;
+	while (*ptr && *ptr != tier->newest) {
+		struct SpillSegment *segment = *ptr;
+		if (segment->entries_count > 0) {
+			ptr = &segment->next;
+			continue;
+		}
+		*ptr = segment->next;
+		__atomic_fetch_sub(&tier->space_in_bytes, segment->size, __ATOMIC_RELAXED);
+		segment->is_dropped = true;
+		if (segment->readers == 0) {
+			segment_delete(tier, segment);
+		}
+	}
+}
+
+/* Writes the record of the oldest queued entry. The caller must be the
+ * writer. */
+static void
+writer_flush_one_locked(struct SpillTier *tier)
+{
+	struct SpillEntry *entry = tier->queue_head;
+	tier->queue_head = entry->queue_next;
+	if (!tier->queue_head) {
+		tier->queue_tail = NULL;
+	}
+	tier->queued_bytes -= entry->length_in_bytes;
+	if (!entry->is_indexed) {
+		/* Taken or dropped before it could be written. */
+		entry_free(entry);
+		return;
+	}
+
+	size_t record_size =
+	  sizeof(struct SpillRecordHeader) + entry->key_len + entry->length_in_bytes;
+	struct SpillSegment *segment = tier->newest;
+	if (!segment || segment->is_sealed ||
+	    (segment->size > 0 && segment->size + record_size > tier->segment_size)) {
+		segment = segment_open_locked(tier);
+	}
+	int err = -1;
+	if (segment) {
+		entry->offset = segment->size + sizeof(struct SpillRecordHeader) + entry->key_len;
+		segment->size += record_size;
+		__atomic_fetch_add(&tier->space_in_bytes, record_size, __ATOMIC_RELAXED);
+		/* Readers might take the entry in the meantime, which is why it's still
+		 * queued: they leave it to us. */
+		struct Blob *blob = entry->contents;
+		ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+		err = writer_append(segment, entry, blob);
+		ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+		if (err < 0) {
+			glog_error("Couldn't write a file to the spill tier (errno %d).", errno);
+			segment->is_sealed = true;
+		}
+	}
+	entry->is_queued = false;
+	if (!entry->is_indexed) {
+		entry_free(entry);
+	} else if (err < 0) {
+		/* Nobody is around to take the file, so it stays within the index with
+		 * its contents still in memory, until it's taken or dropped. */
+		entry->segment = NULL;
+	} else {
+		segment_link_entry(segment, entry);
+		blob_unref(entry->contents);
+		entry->contents = NULL;
+	}
+	writer_compact_locked(tier);
+}
+
+static void *
+spill_tier_writer_entry_point(void *args)
+{
+	struct SpillTier *tier = args;
+	ON_MUTEX_ERR(pthread_mutex_lock(&tier->guard));
+	while (!tier->writer_stop) {
+		if (!tier->queue_head) {
+			ON_MUTEX_ERR(pthread_cond_wait(&tier->writer_cond, &tier->guard));
+			continue;
+		}
+		writer_flush_one_locked(tier);
+	}
+	ON_MUTEX_ERR(pthread_mutex_unlock(&tier->guard));
+	return NULL;
+}
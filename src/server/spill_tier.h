@@ -0,0 +1,62 @@
+#ifndef SOL_SERVER_SPILL_TIER
+#define SOL_SERVER_SPILL_TIER
+
+#include "blob.h"
+#include "htable.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* A tier for evicted files on local disk, much larger than memory. Files are
+ * appended by a background thread to log-structured segment files within a
+ * directory, and found again through an index in memory. Once the segments go
+ * past the capacity of the tier, the oldest one is dropped and the files still
+ * within it are handed to whoever stored the file that didn't fit. Nothing
+ * survives restarts. Thread-safe. */
+struct SpillTier;
+
+struct SpillTierStats
+{
+	size_t items_count;
+	/* Size of all segments, including records of files that are gone. */
+	size_t space_in_bytes;
+	long unsigned stores;
+	long unsigned promotions;
+	long unsigned overflows;
+};
+
+/* Creates an empty tier within `directory`, which is created if missing, with
+ * room for `capacity_in_bytes` bytes of segments. Segments left over by some
+ * previous tier are deleted. Returns NULL on system errors. */
+struct SpillTier *
+spill_tier_create(const char *directory, size_t capacity_in_bytes);
+
+/* Stops the background thread and deletes `tier`, as well as its segments. */
+void
+spill_tier_free(struct SpillTier *tier);
+
+/* Queues `file` to be written to `tier`, which takes over its key and contents
+ * and replaces any older copy with it. Files that leave the tier to make room
+ * are appended to `overflow` just like `htable_evict_files` does, and so is
+ * `file` itself if it's too big or if the disk can't keep up. Making room
+ * means reading the oldest segment back, so it might take a while. */
+void
+spill_tier_store(struct SpillTier *tier,
+                 struct File *file,
+                 struct File **overflow,
+                 unsigned *overflow_count);
+
+/* Removes the file with path `key` from `tier` and returns its contents,
+ * compressed if `compress` is set. The caller must `blob_unref` them. Returns
+ * NULL if there's no such file or if it can't be read. */
+struct Blob *
+spill_tier_take(struct SpillTier *tier, const struct HTableKey *key, bool compress);
+
+/* Just like `spill_tier_take`, but throws the contents away without reading
+ * them. Returns true if there was such a file. */
+bool
+spill_tier_drop(struct SpillTier *tier, const struct HTableKey *key);
+
+void
+spill_tier_stats(const struct SpillTier *tier, struct SpillTierStats *stats);
+
+#endif
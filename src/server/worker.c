@@ -1,6 +1,8 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "worker.h"
+#include "blob.h"
+#include "eviction_spool.h"
 #include "global_state.h"
 #include "htable.h"
 #include "logc/src/log.h"
@@ -34,15 +36,6 @@ struct Worker
 	  err,                                                                                 \
 	  errno)
 
-static void
-free_files(struct File *files, unsigned int size)
-{
-	for (size_t i = 0; i < size; i++) {
-		free(files[i].key);
-		free(files[i].contents);
-	}
-}
-
 static void
 write_response_byte(struct Worker *worker, int fd, int result)
 {
@@ -62,28 +55,29 @@ static void
 worker_handle_read_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
 {
 	glog_info("[Worker n.%u] New API request `readFile`.", worker->id);
-	char *path = buf_to_str(buffer, len_in_bytes);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
 
-	struct File *file = htable_fetch_file(global_htable, path);
-	if (!file) {
+	/* We don't hold any lock while sending the contents, so slow clients don't
+	 * get in the way of anybody else. */
+	struct Blob *contents = htable_pin_file(global_htable, &key);
+	if (!contents) {
 		write_response_byte(worker, fd, -1);
 		return;
 	}
 
 	glog_debug("[Worker n.%u] This read operation consists of %zu bytes.",
 	           worker->id,
-	           file->length_in_bytes);
+	           contents->length_in_bytes);
 
 	uint8_t response[9] = { RESPONSE_OK };
-	u64_to_big_endian(file->length_in_bytes, &response[1]);
+	u64_to_big_endian(contents->length_in_bytes, &response[1]);
 	int err = 0;
 	err |= write_bytes(fd, response, 9);
-	err |= write_bytes(fd, file->contents, file->length_in_bytes);
+	err |= blob_write(fd, contents);
 	if (err < 0) {
 		LOG_IO_ERR(worker, err);
 	}
-	htable_release_file(global_htable, path);
-	free(path);
+	blob_unref(contents);
 }
 
 static void
@@ -96,39 +90,67 @@ worker_handle_read_n_files(struct Worker *worker, int fd, void *buffer, size_t l
 		return;
 	}
 	uint64_t n = big_endian_to_u64(buffer);
+
+	/* Pin all files first, so that the visit doesn't last as long as the
+	 * transfer. It also tells us how many files we're going to send. */
+	struct File *files = NULL;
+	unsigned files_count = 0;
 	struct HTableVisitor *visitor = htable_visit(global_htable, n);
 	struct File *file = NULL;
 	while ((file = htable_visitor_next(visitor))) {
-		glog_debug("[Worker n.%u] Sending '%s' to client.", worker->id, file->key);
+		files = xrealloc(files, sizeof(struct File) * (files_count + 1));
+		files[files_count].key = xmalloc(strlen(file->key) + 1);
+		strcpy(files[files_count].key, file->key);
+		files[files_count].contents = file->contents;
+		blob_ref(file->contents);
+		files_count++;
+	}
+	htable_visitor_free(visitor);
+
+	uint8_t buf_response_code[1] = { RESPONSE_OK };
+	uint8_t buf[8] = { 0 };
+	u64_to_big_endian(files_count, buf);
+	err |= write_bytes(fd, buf_response_code, 1);
+	err |= write_bytes(fd, buf, 8);
+	for (unsigned i = 0; i < files_count && err >= 0; i++) {
+		glog_debug("[Worker n.%u] Sending '%s' to client.", worker->id, files[i].key);
 		glog_debug("[Worker n.%u] This read operation consists of %zu bytes.",
 		           worker->id,
-		           file->length_in_bytes);
+		           files[i].contents->length_in_bytes);
 
 		uint8_t buf1[8] = { 0 };
 		uint8_t buf2[8] = { 0 };
-		u64_to_big_endian(strlen(file->key), buf1);
-		u64_to_big_endian(file->length_in_bytes, buf2);
+		u64_to_big_endian(strlen(files[i].key), buf1);
+		u64_to_big_endian(files[i].contents->length_in_bytes, buf2);
 		err |= write_bytes(fd, buf1, 8);
 		err |= write_bytes(fd, buf2, 8);
-		err |= write_bytes(fd, file->key, strlen(file->key));
-		err |= write_bytes(fd, file->contents, file->length_in_bytes);
-		if (err < 0) {
-			LOG_IO_ERR(worker, err);
-			break;
-		}
+		err |= write_bytes(fd, files[i].key, strlen(files[i].key));
+		err |= blob_write(fd, files[i].contents);
 	}
-	uint8_t buf[8] = { 0 };
-	err |= write_bytes(fd, buf, 8);
 	if (err < 0) {
 		LOG_IO_ERR(worker, err);
 	}
-	htable_visitor_free(visitor);
+	for (unsigned i = 0; i < files_count; i++) {
+		free(files[i].key);
+		blob_unref(files[i].contents);
+	}
+	free(files);
 }
 
+/* Handles both `writeFile` and `appendToFile`, which share the same message
+ * format and the same response. */
 static void
-worker_handle_write_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
+worker_handle_write_file(struct Worker *worker,
+                         int fd,
+                         void *buffer,
+                         size_t len_in_bytes,
+                         bool append)
 {
-	glog_debug("[Worker n.%u] New API request `writeFile`.", worker->id);
+	if (append) {
+		glog_debug("[Worker n.%u] New API request `appendToFile`.", worker->id);
+	} else {
+		glog_debug("[Worker n.%u] New API request `writeFile`.", worker->id);
+	}
 	if (len_in_bytes < 8 + 8) {
 		glog_error("[Worker n.%u] Bad message format.", worker->id);
 		return;
@@ -139,10 +161,11 @@ worker_handle_write_file(struct Worker *worker, int fd, void *buffer, size_t len
 		glog_error("[Worker n.%u] Bad message format.", worker->id);
 		return;
 	}
-	char *path = buf_to_str((uint8_t *)(buffer) + 16, arg1_size);
-	glog_debug("[Worker n.%u] The path is '%s', file size is %lu bytes.",
+	struct HTableKey key = htable_key((uint8_t *)(buffer) + 16, arg1_size);
+	glog_debug("[Worker n.%u] The path is '%.*s', file size is %lu bytes.",
 	           worker->id,
-	           path,
+	           (int)key.len,
+	           key.ptr,
 	           arg2_size);
 	glog_debug(
 	  "[Worker n.%u] This write operation consists of %zu bytes.", worker->id, arg2_size);
@@ -150,8 +173,14 @@ worker_handle_write_file(struct Worker *worker, int fd, void *buffer, size_t len
 	unsigned evicted_count = 0;
 	glog_debug("[Worker n.%u] Successfully parsed the latest message.", worker->id);
 	void *arg2_buffer = (char *)buffer + 8 * 2 + arg1_size;
-	int err = htable_replace_file_contents(
-	  global_htable, path, arg2_buffer, arg2_size, &evicted, &evicted_count);
+	int err = 0;
+	if (append) {
+		err = htable_append_to_file_contents(
+		  global_htable, &key, arg2_buffer, arg2_size, &evicted, &evicted_count);
+	} else {
+		err = htable_replace_file_contents(
+		  global_htable, &key, arg2_buffer, arg2_size, &evicted, &evicted_count);
+	}
 	if (err != HTABLE_ERR_OK) {
 		glog_error(
 		  "[Worker n.%u] Last operation failed with err code %d.", worker->id, err);
@@ -160,11 +189,23 @@ worker_handle_write_file(struct Worker *worker, int fd, void *buffer, size_t len
 	uint8_t buf_response_code[1] = { RESPONSE_OK };
 	uint8_t buf[8] = { 0 };
 	u64_to_big_endian(evicted_count, buf);
+	struct EvictionSpool *spool = htable_eviction_spool(global_htable);
+	if (spool && evicted_count > 0) {
+		/* The client only gets the count, and the spool takes care of the rest
+		 * after we've already replied. */
+		buf_response_code[0] = RESPONSE_OK_SPOOLED;
+		err |= write_bytes(fd, buf_response_code, 1);
+		err |= write_bytes(fd, buf, 8);
+		eviction_spool_push(spool, evicted, evicted_count);
+		if (err < 0) {
+			LOG_IO_ERR(worker, err);
+		}
+		return;
+	}
 	err |= write_bytes(fd, buf_response_code, 1);
 	err |= write_bytes(fd, buf, 8);
 	if (err < 0) {
-		free(path);
-		free_files(evicted, evicted_count);
+		htable_free_evicted(evicted, evicted_count);
 		LOG_IO_ERR(worker, err);
 		return;
 	}
@@ -175,20 +216,18 @@ worker_handle_write_file(struct Worker *worker, int fd, void *buffer, size_t len
 		uint8_t buf_arg1_size[8];
 		uint8_t buf_arg2_size[8];
 		u64_to_big_endian(strlen(evicted[i].key), buf_arg1_size);
-		u64_to_big_endian(evicted[i].length_in_bytes, buf_arg2_size);
+		u64_to_big_endian(evicted[i].contents->length_in_bytes, buf_arg2_size);
 		err |= write_bytes(fd, buf_arg1_size, 8);
 		err |= write_bytes(fd, buf_arg2_size, 8);
 		err |= write_bytes(fd, evicted[i].key, strlen(evicted[i].key));
-		err |= write_bytes(fd, evicted[i].contents, evicted[i].length_in_bytes);
+		err |= blob_write(fd, evicted[i].contents);
 		if (err < 0) {
-			free(path);
-			free_files(evicted, evicted_count);
+			htable_free_evicted(evicted, evicted_count);
 			LOG_IO_ERR(worker, err);
 			return;
 		}
 	}
-	free(path);
-	free_files(evicted, evicted_count);
+	htable_free_evicted(evicted, evicted_count);
 }
 
 static void
@@ -203,11 +242,10 @@ worker_handle_open_file(struct Worker *worker,
 	           worker->id,
 	           create,
 	           lock);
-	char *path = buf_to_str(buffer, len_in_bytes);
-	glog_debug("[Worker n.%u] The path is '%s'.", worker->id, path);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
+	glog_debug("[Worker n.%u] The path is '%.*s'.", worker->id, (int)key.len, key.ptr);
 	enum HTableError result =
-	  htable_open_or_create_file(global_htable, path, fd, create, lock);
-	free(path);
+	  htable_open_or_create_file(global_htable, &key, fd, create, lock);
 	write_response_byte(worker, fd, result);
 }
 
@@ -215,9 +253,9 @@ static void
 worker_handle_lock_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
 {
 	glog_debug("[Worker n.%u] New API request `lockFile`.", worker->id);
-	char *path = buf_to_str(buffer, len_in_bytes);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
 	char response[1];
-	enum HTableError result = htable_lock_file(global_htable, path, fd);
+	enum HTableError result = htable_lock_file(global_htable, &key, fd);
 	if (result < 0) {
 		response[0] = RESPONSE_ERR;
 	} else {
@@ -227,17 +265,15 @@ worker_handle_lock_file(struct Worker *worker, int fd, void *buffer, size_t len_
 	if (err < 0) {
 		LOG_IO_ERR(worker, err);
 	}
-	free(path);
 }
 
 static void
 worker_handle_unlock_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
 {
 	glog_debug("[Worker n.%u] New API request `unlockFile`.", worker->id);
-	char *path = buf_to_str(buffer, len_in_bytes);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
 	int new_fd = -1;
-	enum HTableError result = htable_unlock_file(global_htable, path, fd, &new_fd);
-	free(path);
+	enum HTableError result = htable_unlock_file(global_htable, &key, fd, &new_fd);
 	write_response_byte(worker, fd, result);
 
 	if (new_fd != -1) {
@@ -249,9 +285,8 @@ static void
 worker_handle_close_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
 {
 	glog_debug("[Worker n.%u] New API request `closeFile`.", worker->id);
-	char *path = buf_to_str(buffer, len_in_bytes);
-	enum HTableError result = htable_close_file(global_htable, path, fd);
-	free(path);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
+	enum HTableError result = htable_close_file(global_htable, &key, fd);
 	write_response_byte(worker, fd, result);
 }
 
@@ -259,9 +294,23 @@ static void
 worker_handle_remove_file(struct Worker *worker, int fd, void *buffer, size_t len_in_bytes)
 {
 	glog_debug("[Worker n.%u] New API request `removeFile`.", worker->id);
-	char *path = buf_to_str(buffer, len_in_bytes);
-	int result = htable_remove_file(global_htable, path, fd);
-	free(path);
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
+	int result = htable_remove_file(global_htable, &key, fd);
+	write_response_byte(worker, fd, result);
+}
+
+static void
+worker_handle_pin_file(struct Worker *worker,
+                       int fd,
+                       void *buffer,
+                       size_t len_in_bytes,
+                       bool pinned)
+{
+	glog_debug("[Worker n.%u] New API request `%s`.",
+	           worker->id,
+	           pinned ? "pinFile" : "unpinFile");
+	struct HTableKey key = htable_key(buffer, len_in_bytes);
+	enum HTableError result = htable_set_file_pinned(global_htable, &key, fd, pinned);
 	write_response_byte(worker, fd, result);
 }
 
@@ -315,7 +364,10 @@ worker_handle_message(struct Worker *worker, int fd, void *buffer, size_t len_in
 			worker_handle_open_file(worker, fd, buffer, len_in_bytes, true, true);
 			break;
 		case API_OP_WRITE_FILE:
-			worker_handle_write_file(worker, fd, buffer, len_in_bytes);
+			worker_handle_write_file(worker, fd, buffer, len_in_bytes, false);
+			break;
+		case API_OP_APPEND_TO_FILE:
+			worker_handle_write_file(worker, fd, buffer, len_in_bytes, true);
 			break;
 		case API_OP_UNLOCK_FILE:
 			worker_handle_unlock_file(worker, fd, buffer, len_in_bytes);
@@ -329,6 +381,12 @@ worker_handle_message(struct Worker *worker, int fd, void *buffer, size_t len_in
 		case API_OP_REMOVE_FILE:
 			worker_handle_remove_file(worker, fd, buffer, len_in_bytes);
 			break;
+		case API_OP_PIN_FILE:
+			worker_handle_pin_file(worker, fd, buffer, len_in_bytes, true);
+			break;
+		case API_OP_UNPIN_FILE:
+			worker_handle_pin_file(worker, fd, buffer, len_in_bytes, false);
+			break;
 		default:
 			glog_error("[Worker n.%u] Unrecognized request from client.", worker->id);
 	}
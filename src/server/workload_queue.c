@@ -58,6 +58,9 @@ workload_queue_pull(unsigned i)
 	struct Message *msg = queue->next_incoming;
 	if (msg) {
 		queue->next_incoming = msg->next;
+		if (!queue->next_incoming) {
+			queue->last_incoming = NULL;
+		}
 		msg->next = NULL;
 	}
 	ON_MUTEX_ERR(pthread_mutex_unlock(&queue->mutex));
@@ -72,7 +75,6 @@ workload_queue_add(struct Message *msg, unsigned i)
 	struct WorkloadQueue *queue = &workload_queues[i];
 	assert(queue);
 	ON_MUTEX_ERR(pthread_mutex_lock(&queue->mutex));
-	queue->next_incoming = msg;
 	struct Message *last = queue->last_incoming;
 	if (last) {
 		last->next = msg;
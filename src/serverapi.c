@@ -170,6 +170,10 @@ handle_response_with_files(int fd, const char *dirname)
 		return -1;
 	}
 	size_t num_files = big_endian_to_u64(buffer_num_files);
+	if (buffer_response_code[0] == RESPONSE_OK_SPOOLED) {
+		log_debug("The server spooled %zu evicted files.", num_files);
+		return 0;
+	}
 	/* Read actual file contents. */
 	for (uint64_t i = 0; i < num_files; i++) {
 		uint8_t buffer_lengths[16] = { '\0' };
@@ -181,7 +185,7 @@ handle_response_with_files(int fd, const char *dirname)
 		size_t len_contents = big_endian_to_u64(buffer_lengths + 8);
 		void *buffer = xmalloc(len_path + len_contents);
 		err |= read_bytes(state.fd, buffer, len_path + len_contents);
-		if (!err) {
+		if (err < 0) {
 			free(buffer);
 			return on_io_err();
 		}
@@ -388,7 +392,7 @@ readNFiles(int n, const char *dirname)
 		size_t len_contents = big_endian_to_u64(buffer_lengths + 8);
 		void *buffer = xmalloc(len_path + len_contents);
 		err |= read_bytes(state.fd, buffer, len_path + len_contents);
-		if (!err) {
+		if (err < 0) {
 			free(buffer);
 			return on_io_err();
 		}
@@ -446,6 +450,18 @@ removeFile(const char *pathname)
 	return make_simple_request(API_OP_REMOVE_FILE, pathname, EINVAL);
 }
 
+int
+pinFile(const char *pathname)
+{
+	return make_simple_request(API_OP_PIN_FILE, pathname, EINVAL);
+}
+
+int
+unpinFile(const char *pathname)
+{
+	return make_simple_request(API_OP_UNPIN_FILE, pathname, EINVAL);
+}
+
 /******* API WRITE OPERATIONS
  * These are by far the most complicated, because they must take evictions into
  * account. */
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+
+# Pinned files must survive evictions, and be evicted like any other once
+# unpinned.
+
+PARENT_PATH=$(cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P)
+echo "The parent path of this test is $PARENT_PATH."
+echo ""
+
+TARGET="$PARENT_PATH/data/target"
+mkdir -p "$TARGET/files" "$TARGET/read" "$TARGET/evicted"
+rm -rf "$TARGET/files/"* "$TARGET/read/"* "$TARGET/evicted/"*
+for n in 1 2 3 4 5 6 7 8 9 10; do
+	head -c 10000 /dev/urandom > "$TARGET/files/$n.bin"
+done
+FAILED=0
+
+# Checks that `$2` (the actual value) matches `$3` (the expected one).
+check() {
+	echo "$1: $2 ($3 expected)."
+	if [ "$2" != "$3" ]; then
+		FAILED=1
+	fi
+}
+
+# Locks outlive `closeFile`, so only the writer can pin and unpin its files.
+./client -f /tmp/LSOfiletorage.sk -z 1 \
+	-W "$TARGET/files/1.bin" -D "$TARGET/evicted" \
+	-P "$TARGET/files/1.bin" \
+	-W "$TARGET/files/2.bin,$TARGET/files/3.bin,$TARGET/files/4.bin,$TARGET/files/5.bin" \
+	-D "$TARGET/evicted" \
+	-W "$TARGET/files/6.bin" -D "$TARGET/evicted"
+check "Evicted files" "$(ls -1q "$TARGET/evicted" | wc -l)" 2
+PINNED_EVICTED=$([ -f "$TARGET/evicted/1.bin" ] && echo yes || echo no)
+check "Pinned file evicted" "$PINNED_EVICTED" no
+
+./client -f /tmp/LSOfiletorage.sk -z 1 -r "$TARGET/files/1.bin" -d "$TARGET/read"
+INTACT=$(cmp -s "$TARGET/files/1.bin" "$TARGET/read/1.bin" && echo yes || echo no)
+check "Pinned file read back intact" "$INTACT" yes
+
+./client -f /tmp/LSOfiletorage.sk -z 1 \
+	-U "$TARGET/files/1.bin" \
+	-W "$TARGET/files/7.bin,$TARGET/files/8.bin,$TARGET/files/9.bin,$TARGET/files/10.bin" \
+	-D "$TARGET/evicted"
+check "Evicted files" "$(ls -1q "$TARGET/evicted" | wc -l)" 6
+INTACT=$(cmp -s "$TARGET/files/1.bin" "$TARGET/evicted/1.bin" && echo yes || echo no)
+check "Unpinned file evicted intact" "$INTACT" yes
+
+kill -s SIGINT "$(head -n 1 server.pid)"
+./statistiche.sh server.log
+
+exit $FAILED
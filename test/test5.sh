@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+
+# Evicted files go to the compressed tier, where reads promote them back. Only
+# what overflows it goes back to the writer.
+
+PARENT_PATH=$(cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P)
+echo "The parent path of this test is $PARENT_PATH."
+echo ""
+
+TARGET="$PARENT_PATH/data/target"
+NUM_FILES=12
+mkdir -p "$TARGET/files" "$TARGET/read" "$TARGET/evicted"
+rm -rf "$TARGET/files/"* "$TARGET/read/"* "$TARGET/evicted/"*
+FILES=""
+for (( n=1; n<=$NUM_FILES; n++ )); do
+	# Random contents don't compress, so the tier has room for two of them.
+	head -c 10000 /dev/urandom > "$TARGET/files/$n.bin"
+	FILES="$FILES,$TARGET/files/$n.bin"
+done
+FAILED=0
+
+# Checks that `$2` (the actual value) matches `$3` (the expected one).
+check() {
+	echo "$1: $2 ($3 expected)."
+	if [ "$2" != "$3" ]; then
+		FAILED=1
+	fi
+}
+
+./client -f /tmp/LSOfiletorage.sk -z 1 -W "${FILES:1}" -D "$TARGET/evicted"
+check "Overflowing files sent back to the writer" "$(ls -1q "$TARGET/evicted" | wc -l)" 8
+NUM_INTACT=0
+for (( n=1; n<=$NUM_FILES - 4; n++ )); do
+	if cmp -s "$TARGET/files/$n.bin" "$TARGET/evicted/$n.bin"; then
+		NUM_INTACT=$(( $NUM_INTACT + 1 ))
+	fi
+done
+check "Oldest files sent back intact" "$NUM_INTACT" 8
+
+# The two newest files are still in memory, and the two before them within the
+# tier. Reads of missing files fail, so there's one client for each.
+NUM_INTACT=0
+for (( n=$NUM_FILES - 3; n<=$NUM_FILES; n++ )); do
+	./client -f /tmp/LSOfiletorage.sk -z 1 -r "$TARGET/files/$n.bin" -d "$TARGET/read"
+	if cmp -s "$TARGET/files/$n.bin" "$TARGET/read/$n.bin"; then
+		NUM_INTACT=$(( $NUM_INTACT + 1 ))
+	fi
+done
+check "Files read back intact" "$NUM_INTACT" 4
+
+kill -s SIGINT "$(head -n 1 server.pid)"
+./statistiche.sh server.log
+
+exit $FAILED
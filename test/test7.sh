@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+
+# With an eviction spool, writers only learn how many files were evicted and
+# their contents end up within the spool's directory instead.
+
+PARENT_PATH=$(cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P)
+echo "The parent path of this test is $PARENT_PATH."
+echo ""
+
+TARGET="$PARENT_PATH/data/target"
+SPOOL="/tmp/LSOfiletorage-spool"
+NUM_FILES=10
+mkdir -p "$TARGET/files" "$TARGET/evicted"
+rm -rf "$TARGET/files/"* "$TARGET/evicted/"* "$SPOOL/"*
+FILES=""
+for (( n=1; n<=$NUM_FILES; n++ )); do
+	head -c 10000 /dev/urandom > "$TARGET/files/$n.bin"
+	FILES="$FILES,$TARGET/files/$n.bin"
+done
+FAILED=0
+
+# Checks that `$2` (the actual value) matches `$3` (the expected one).
+check() {
+	echo "$1: $2 ($3 expected)."
+	if [ "$2" != "$3" ]; then
+		FAILED=1
+	fi
+}
+
+./client -f /tmp/LSOfiletorage.sk -z 1 -W "${FILES:1}" -D "$TARGET/evicted"
+check "Writer's exit status" "$?" 0
+check "Evicted files sent back to the writer" "$(ls -1q "$TARGET/evicted" | wc -l)" 0
+
+# The spool is drained before the server exits.
+SERVER_PID="$(head -n 1 server.pid)"
+kill -s SIGINT "$SERVER_PID"
+while kill -0 "$SERVER_PID" 2> /dev/null; do
+	sleep 0.1
+done
+check "Evicted files within the spool" "$(ls -1q "$SPOOL" | wc -l)" "$(( $NUM_FILES - 4 ))"
+
+# Spooled files are named after their percent-encoded paths.
+NUM_INTACT=0
+for (( n=1; n<=$NUM_FILES - 4; n++ )); do
+	SPOOLED="$SPOOL/$(sed 's/%/%25/g; s/\//%2F/g' <<< "$TARGET/files/$n.bin")"
+	if cmp -s "$TARGET/files/$n.bin" "$SPOOLED"; then
+		NUM_INTACT=$(( $NUM_INTACT + 1 ))
+	fi
+done
+check "Spooled files intact" "$NUM_INTACT" "$(( $NUM_FILES - 4 ))"
+
+./statistiche.sh server.log
+
+exit $FAILED
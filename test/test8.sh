@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+
+# Many clients at once, each writing its own file and reading it back, so that
+# the receiver has to juggle their connections.
+#
+# Each client is a process of its own, so this stays far below the hundred
+# thousand connections that the receiver is meant for. The benchmark tool goes
+# that far, as long as the file descriptor limit has room for both ends of each
+# connection.
+
+PARENT_PATH=$(cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P)
+echo "The parent path of this test is $PARENT_PATH."
+echo ""
+
+TARGET="$PARENT_PATH/data/target"
+NUM_CLIENTS=200
+mkdir -p "$TARGET/files" "$TARGET/read"
+rm -rf "$TARGET/files/"* "$TARGET/read/"*
+for (( n=1; n<=$NUM_CLIENTS; n++ )); do
+	head -c $(( $RANDOM * 4 )) /dev/urandom > "$TARGET/files/$n.bin"
+	mkdir -p "$TARGET/read/$n"
+done
+FAILED=0
+
+# Checks that `$2` (the actual value) matches `$3` (the expected one).
+check() {
+	echo "$1: $2 ($3 expected)."
+	if [ "$2" != "$3" ]; then
+		FAILED=1
+	fi
+}
+
+for (( n=1; n<=$NUM_CLIENTS; n++ )); do
+	./client -f /tmp/LSOfiletorage.sk -z 1 \
+		-W "$TARGET/files/$n.bin" -r "$TARGET/files/$n.bin" -d "$TARGET/read/$n" &
+done
+wait
+
+NUM_INTACT=0
+for (( n=1; n<=$NUM_CLIENTS; n++ )); do
+	if cmp -s "$TARGET/files/$n.bin" "$TARGET/read/$n/$n.bin"; then
+		NUM_INTACT=$(( $NUM_INTACT + 1 ))
+	fi
+done
+check "Files read back intact" "$NUM_INTACT" "$NUM_CLIENTS"
+
+kill -s SIGINT "$(head -n 1 server.pid)"
+./statistiche.sh server.log
+
+exit $FAILED